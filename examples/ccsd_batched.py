@@ -0,0 +1,32 @@
+
+import pdaggerq
+
+pq = pdaggerq.pq_helper("fermi")
+
+# energy, singles, and doubles equations, generated together: each term of the
+# similarity-transformed hamiltonian is expanded once for all three projections
+
+pq.set_projections([[['1']], [['e1(m,e)']], [['e2(m,n,f,e)']]])
+
+pq.add_st_operator(1.0,['f'],['t1','t2'])
+pq.add_st_operator(1.0,['v'],['t1','t2'])
+
+pq.simplify()
+
+headers = ['    < 0 | e(-T) H e(T) | 0> :',
+           '    < 0 | m* e e(-T) H e(T) | 0> :',
+           '    < 0 | m* n* f e e(-T) H e(T) | 0> :']
+
+for n in range(pq.num_projections()):
+
+    print('')
+    print(headers[n])
+    print('')
+
+    # grab list of fully-contracted strings for this projection, then print
+    terms = pq.get_projection(n).strings()
+    for my_term in terms:
+        print(my_term)
+
+pq.clear()
+
@@ -0,0 +1,112 @@
+//
+// pdaggerq - A code for bringing strings of creation / annihilation operators to normal order.
+// Filename: pq_export.cc
+// Copyright (C) 2020 A. Eugene DePrince III
+//
+// Author: A. Eugene DePrince III <adeprince@fsu.edu>
+// Maintainer: DePrince group
+//
+// This file is part of the pdaggerq package.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+
+#include "pq_helper.h"
+#include "pq_string.h"
+
+namespace pdaggerq {
+
+// strings() reports operators of rank 0 through 8
+static constexpr size_t max_exported_rank = 9;
+
+pq_string_cursor::pq_string_cursor(const pq_helper &pq)
+    : terms_(pq.get_ordered_strings(pq_string::is_spin_blocked || pq_string::is_range_blocked)) {
+}
+
+std::shared_ptr<pq_string> pq_string_cursor::next() {
+
+    // same order as the nested loops in strings(): all terms with no operators, then
+    // all terms with one operator, and so on. skipped terms format to an empty list
+    // and are never reported.
+    for (; rank_ < max_exported_rank; rank_++, pos_ = 0) {
+        while ( pos_ < terms_.size() ) {
+            const std::shared_ptr<pq_string> & pq_str = terms_[pos_++];
+            if ( pq_str->symbol.size() != rank_ ) continue;
+            if ( pq_str->skip ) continue;
+            return pq_str;
+        }
+    }
+    return nullptr;
+}
+
+void pq_helper::for_each_string(const std::function<void(std::vector<std::string> &)> &visitor) const {
+
+    pq_string_cursor cursor(*this);
+    while ( std::shared_ptr<pq_string> pq_str = cursor.next() ) {
+        std::vector<std::string> my_string = pq_str->get_string();
+        visitor(my_string);
+    }
+}
+
+void pq_helper::write_strings(const std::string &filename) const {
+
+    std::ofstream buffer(filename);
+    if ( !buffer ) {
+        printf("\n");
+        printf("    error: could not open %s for writing\n", filename.c_str());
+        printf("\n");
+        exit(1);
+    }
+
+    for_each_string([&buffer](std::vector<std::string> &my_string) {
+        for (size_t i = 0; i < my_string.size(); i++) {
+            if ( i > 0 ) buffer << '\t';
+            buffer << my_string[i];
+        }
+        buffer << '\n';
+    });
+}
+
+pq_string_table pq_helper::string_table() const {
+
+    pq_string_table table;
+    table.offsets.push_back(0);
+
+    std::unordered_map<std::string, int32_t> codes;
+
+    pq_string_cursor cursor(*this);
+    while ( std::shared_ptr<pq_string> pq_str = cursor.next() ) {
+
+        // get_string() also makes the factor non-negative, so read the factor after it
+        std::vector<std::string> my_string = pq_str->get_string();
+        table.factors.push_back(pq_str->sign * pq_str->factor);
+
+        // the first string is the formatted factor, which the table stores numerically
+        for (size_t i = 1; i < my_string.size(); i++) {
+            auto [it, inserted] = codes.try_emplace(my_string[i], (int32_t)table.labels.size());
+            if ( inserted ) table.labels.push_back(my_string[i]);
+            table.codes.push_back(it->second);
+        }
+        table.offsets.push_back((int64_t)table.codes.size());
+    }
+
+    return table;
+}
+
+} // namespace pdaggerq
@@ -34,6 +34,7 @@
 #include <algorithm>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <pybind11/numpy.h>
 
 #include "pq_helper.h"
 #include "pq_utils.h"
@@ -68,6 +69,10 @@ void export_pq_helper(py::module& m) {
         .def("set_bernoulli_excitation_level", &pq_helper::set_bernoulli_excitation_level)
         .def("set_left_operators", &pq_helper::set_left_operators)
         .def("set_right_operators", &pq_helper::set_right_operators)
+        .def("set_projections", &pq_helper::set_projections,
+            py::arg("left"), py::arg("right") = std::vector<std::vector<std::vector<std::string>>>() )
+        .def("get_projection", &pq_helper::get_projection)
+        .def("num_projections", &pq_helper::num_projections)
         .def("set_left_operators_type", &pq_helper::set_left_operators_type)
         .def("set_right_operators_type", &pq_helper::set_right_operators_type)
         .def("get_right_operators_type", &pq_helper::get_right_operators_type)
@@ -116,6 +121,13 @@ void export_pq_helper(py::module& m) {
             },
             py::arg("spin_labels") = std::unordered_map<std::string, std::string>{{"DUMMY",""}},
             py::arg("label_ranges") = std::unordered_map<std::string, std::vector<std::string>>{{"DUMMY",{""}}} )
+        .def("iter_strings",
+            [](const pq_helper& self) {
+                return pq_string_cursor(self);
+            },
+            py::keep_alive<0, 1>() )
+        .def("write_strings", &pq_helper::write_strings)
+        .def("string_table", &pq_helper::string_table)
         .def("block_by_spin",
             [](pq_helper& self, const std::unordered_map<std::string, std::string> &spin_labels) {
                 self.block_by_spin(spin_labels);
@@ -145,6 +157,34 @@ void export_pq_helper(py::module& m) {
         .def("add_hextuple_commutator", &pq_helper::add_hextuple_commutator)
         .def("add_operator_product", &pq_helper::py_add_operator_product);
 
+    // lazy iterator over the terms of a pq_helper (see pq_helper.iter_strings)
+    py::class_<pdaggerq::pq_string_cursor>(m, "pq_string_iterator")
+        // return the iterator itself (not a copy), which keeps its pq_helper alive
+        .def("__iter__", [](py::object self) { return self; })
+        .def("__next__", [](pq_string_cursor& self) {
+            std::shared_ptr<pq_string> pq_str = self.next();
+            if ( !pq_str ) throw py::stop_iteration();
+            return pq_str->get_string();
+        });
+
+    // columnar terms (see pq_helper.string_table). the arrays view the table's own
+    // storage, which they keep alive, rather than copying it
+    py::class_<pdaggerq::pq_string_table>(m, "pq_string_table")
+        .def_readonly("labels", &pq_string_table::labels)
+        .def_property_readonly("factors", [](py::object self) {
+            pq_string_table& table = self.cast<pq_string_table&>();
+            return py::array_t<double>(table.factors.size(), table.factors.data(), self);
+        })
+        .def_property_readonly("codes", [](py::object self) {
+            pq_string_table& table = self.cast<pq_string_table&>();
+            return py::array_t<int32_t>(table.codes.size(), table.codes.data(), self);
+        })
+        .def_property_readonly("offsets", [](py::object self) {
+            pq_string_table& table = self.cast<pq_string_table&>();
+            return py::array_t<int64_t>(table.offsets.size(), table.offsets.data(), self);
+        })
+        .def("__len__", [](const pq_string_table& self) { return self.factors.size(); });
+
     py::class_<pdaggerq::pq_operator_terms>(m, "pq_operator_terms")
         .def(py::init<double, std::vector<std::string>>())
         .def("factor", &pq_operator_terms::get_factor)
@@ -215,6 +255,7 @@ pq_helper::pq_helper(const pq_helper &other) {
     this->right_operators_type      = other.right_operators_type;
     this->left_operators_type       = other.left_operators_type;
     this->find_paired_permutations  = other.find_paired_permutations;
+    this->projections               = other.projections;
 
     // deep copy pointers to pq_strings
     ordered.clear();
@@ -272,6 +313,65 @@ void pq_helper::set_left_operators(const std::vector<std::vector<std::string>> &
     }
 }
 
+void pq_helper::set_projections(const std::vector<std::vector<std::vector<std::string>>> &left,
+                                const std::vector<std::vector<std::vector<std::string>>> &right) {
+
+    size_t n_projections = std::max(left.size(), right.size());
+    if ( left.size() > 1 && right.size() > 1 && left.size() != right.size() ) {
+        printf("\n");
+        printf("    error: set_projections needs the same number of bras (%zu) and kets (%zu)\n", left.size(), right.size());
+        printf("\n");
+        exit(1);
+    }
+
+    projections.clear();
+    left_operators.clear();
+    right_operators.clear();
+
+    for (size_t n = 0; n < n_projections; n++) {
+        pq_helper projection(vacuum);
+        if ( !left.empty() )  projection.set_left_operators(left.size() > 1 ? left[n] : left[0]);
+        if ( !right.empty() ) projection.set_right_operators(right.size() > 1 ? right[n] : right[0]);
+        projections.push_back(std::move(projection));
+    }
+
+    // the bra and ket of the batch as a whole are those of all projections, so that
+    // the checks made while expanding operator products see every one of them
+    for (const std::vector<std::vector<std::string>> & in : left) {
+        left_operators.insert(left_operators.end(), in.begin(), in.end());
+    }
+    for (const std::vector<std::vector<std::string>> & in : right) {
+        right_operators.insert(right_operators.end(), in.begin(), in.end());
+    }
+}
+
+pq_helper pq_helper::get_projection(size_t n) const {
+
+    if ( n >= projections.size() ) {
+        printf("\n");
+        printf("    error: projection %zu does not exist (%zu projections)\n", n, projections.size());
+        printf("\n");
+        exit(1);
+    }
+
+    pq_helper projection(projections[n]);
+    configure_projection(projection);
+    return projection;
+}
+
+void pq_helper::configure_projection(pq_helper &projection) const {
+    projection.vacuum                        = vacuum;
+    projection.print_level                   = print_level;
+    projection.use_rdms                      = use_rdms;
+    projection.ignore_cumulant_rdms          = ignore_cumulant_rdms;
+    projection.is_unitary_cc                 = is_unitary_cc;
+    projection.bernoulli_excitation_level    = bernoulli_excitation_level;
+    projection.is_hamiltonian_normal_ordered = is_hamiltonian_normal_ordered;
+    projection.find_paired_permutations      = find_paired_permutations;
+    projection.left_operators_type           = left_operators_type;
+    projection.right_operators_type          = right_operators_type;
+}
+
 void pq_helper::set_left_operators_type(const  std::string &type) {
     if ( type == "EE" || type == "IP" || type == "EA" || type == "DIP" || type == "DEA" ) {
         left_operators_type = type;
@@ -1013,9 +1113,25 @@ op_class classify_operator(const std::string &op) {
 
 void pq_helper::screen_operator_products(std::vector<pq_operator_terms> &ops, bool connected) {
 
+    std::vector<bool> keep = screen_operator_products_mask(ops, connected);
+
+    std::vector<pq_operator_terms> kept;
+    kept.reserve(ops.size());
+    for (size_t i = 0; i < ops.size(); i++) {
+        if ( keep[i] ) kept.push_back(ops[i]);
+    }
+
+    ops = std::move(kept);
+}
+
+std::vector<bool> pq_helper::screen_operator_products_mask(const std::vector<pq_operator_terms> &ops, bool connected) const {
+
+    // products the screen cannot reason about are all kept
+    std::vector<bool> keep(ops.size(), true);
+
     // the screen presumes that only fully contracted strings survive, which is
     // what cleanup() enforces for standard coupled cluster at the fermi vacuum.
-    if ( vacuum != "FERMI" || use_rdms || is_unitary_cc ) return;
+    if ( vacuum != "FERMI" || use_rdms || is_unitary_cc ) return keep;
 
     // accumulated excitation level of the bra and the ket. a term needs only one
     // pair of them to balance, so the widest range over all of them is what a
@@ -1029,7 +1145,7 @@ void pq_helper::screen_operator_products(std::vector<pq_operator_terms> &ops, bo
             int min_level = 0, max_level = 0;
             for (const std::string &op : alternative) {
                 op_class c = classify_operator(op);
-                if ( !c.known ) return;
+                if ( !c.known ) return keep;
                 min_level += c.min_level;
                 max_level += c.max_level;
             }
@@ -1045,10 +1161,11 @@ void pq_helper::screen_operator_products(std::vector<pq_operator_terms> &ops, bo
         outer_max += side_max;
     }
 
-    std::vector<pq_operator_terms> kept;
-    kept.reserve(ops.size());
+    std::vector<bool> survives(ops.size(), false);
+
+    for (size_t i = 0; i < ops.size(); i++) {
 
-    for (const pq_operator_terms &term : ops) {
+        const pq_operator_terms &term = ops[i];
 
         int min_level = outer_min, max_level = outer_max;
 
@@ -1065,7 +1182,7 @@ void pq_helper::screen_operator_products(std::vector<pq_operator_terms> &ops, bo
             if ( c.is_amplitude ) n_amplitudes++;
             else                  legs += c.legs;
         }
-        if ( !screenable ) return;
+        if ( !screenable ) return keep;
 
         // 1. excitation balance
         if ( min_level > 0 || max_level < 0 ) continue;
@@ -1074,10 +1191,10 @@ void pq_helper::screen_operator_products(std::vector<pq_operator_terms> &ops, bo
         //    with the target block, and amplitudes never contract with each other
         if ( connected && n_amplitudes > legs ) continue;
 
-        kept.push_back(term);
+        survives[i] = true;
     }
 
-    ops = std::move(kept);
+    return survives;
 }
 
 void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
@@ -1087,8 +1204,27 @@ void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
     // what the classifier understands (and what makes the screen cheapest).
     // connectivity is not assumed: this entry point also serves bare operator
     // products, for which disconnected terms are perfectly legitimate.
+    if ( !projections.empty() ) {
+        process_projected_operator_products(ops, false);
+        return;
+    }
+
     screen_operator_products(ops, false);
 
+    ops = expand_operator_products(ops);
+
+    ensure_bra_and_ket();
+
+    std::vector<std::pair<pq_helper *, pq_operator_terms> > products;
+    products.reserve(ops.size());
+    for (const pq_operator_terms & op : ops) {
+        products.emplace_back(this, op);
+    }
+    normal_order_operator_products(products);
+}
+
+std::vector<pq_operator_terms> pq_helper::expand_operator_products(std::vector<pq_operator_terms> ops) {
+
     std::vector<pq_operator_terms> new_ops;
 
     // check for fluctuation potential because it should be split as
@@ -1114,6 +1250,56 @@ void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
         ops = new_ops;
     }while(!done_processing);
 
+    return ops;
+}
+
+void pq_helper::process_projected_operator_products(const std::vector<pq_operator_terms> &ops, bool connected) {
+
+    // each projection keeps exactly the products that it would keep on its own
+    std::vector<std::vector<bool> > keep;
+    keep.reserve(projections.size());
+    for (pq_helper & projection : projections) {
+        configure_projection(projection);
+        std::vector<bool> mask = projection.screen_operator_products_mask(ops, false);
+        if ( connected ) {
+            std::vector<bool> connected_mask = projection.screen_operator_products_mask(ops, true);
+            for (size_t i = 0; i < ops.size(); i++) {
+                mask[i] = mask[i] && connected_mask[i];
+            }
+        }
+        keep.push_back(std::move(mask));
+        projection.ensure_bra_and_ket();
+    }
+
+    // split the operators of each product that survives any of the screens once.
+    // the split only validates the bra and ket, which here are the union of all
+    // of them. the strings (and their normal ordering) still differ per projection,
+    // because the bra is part of each string, so every (product, projection) pair is
+    // built and normal ordered on its own. the pairs are ordered as (product, split,
+    // projection) so that every projection receives its strings in the same order,
+    // and consolidates them at the same points, as it would have when generated by
+    // itself.
+    std::vector<std::pair<pq_helper *, pq_operator_terms> > products;
+    for (size_t i = 0; i < ops.size(); i++) {
+
+        bool needed = false;
+        for (const std::vector<bool> & mask : keep) {
+            needed = needed || mask[i];
+        }
+        if ( !needed ) continue;
+
+        for (const pq_operator_terms & op : expand_operator_products({ops[i]})) {
+            for (size_t n = 0; n < projections.size(); n++) {
+                if ( keep[n][i] ) products.emplace_back(&projections[n], op);
+            }
+        }
+    }
+
+    normal_order_operator_products(products);
+}
+
+void pq_helper::normal_order_operator_products(const std::vector<std::pair<pq_helper *, pq_operator_terms> > &products) {
+
     // While generating terms, periodically fold the running list down with the
     // confluent (combine-only) part of simplify(). The brute-force normal
     // ordering of high-rank similarity transforms (e.g. the two-electron
@@ -1138,8 +1324,8 @@ void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
     // essentially all of the time goes into the expansion that follows it.
     //
     // What happens to the results is exactly what the serial version did: each
-    // product's strings are appended to `ordered` in product order and the
-    // consolidation threshold is tested after each one. That keeps the equations
+    // product's strings are appended to its target's `ordered` in product order
+    // and the consolidation threshold is tested after each one. That keeps the equations
     // -- and the code generated from them -- byte for byte independent of the
     // batch size and of the number of threads, which matters because consumers
     // freeze the generated code and because the incremental consolidation is
@@ -1150,8 +1336,6 @@ void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
     // `ordered` itself: a single similarity transform of the two-electron
     // operator with high-rank amplitudes can produce millions of raw strings, and
     // expanding a fixed number of those at once would exhaust memory.
-    ensure_bra_and_ket();
-
     const size_t max_batch = 64 * (size_t)std::max(1, omp_get_max_threads());
     size_t batch_size = max_batch;
 
@@ -1159,14 +1343,15 @@ void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
     std::vector<std::vector<std::vector<std::shared_ptr<pq_string> > > > jobs;
     std::vector<std::vector<std::shared_ptr<pq_string> > > batch;
 
-    for (size_t first = 0; first < ops.size(); first += jobs.size()) {
+    for (size_t first = 0; first < products.size(); first += jobs.size()) {
 
-        const size_t last = std::min(first + batch_size, ops.size());
+        const size_t last = std::min(first + batch_size, products.size());
 
         jobs.clear();
         jobs.resize(last - first);
         for (size_t i = first; i < last; i++) {
-            build_operator_product(ops[i].factor, ops[i].operators, jobs[i - first]);
+            const pq_operator_terms & op = products[i].second;
+            products[i].first->build_operator_product(op.factor, op.operators, jobs[i - first]);
         }
 
         // flatten to one expansion per (product, bra/ket pair) so that the work is
@@ -1181,20 +1366,22 @@ void pq_helper::process_operator_products(std::vector<pq_operator_terms> ops) {
         batch.clear();
         batch.resize(work.size());
 
-        #pragma omp parallel for schedule(dynamic) default(none) shared(jobs, work, batch)
+        #pragma omp parallel for schedule(dynamic) default(none) shared(products, first, jobs, work, batch)
         for (size_t w = 0; w < work.size(); w++) {
-            normal_order_strings(jobs[work[w].first][work[w].second], batch[w]);
+            const pq_helper * target = products[first + work[w].first].first;
+            target->normal_order_strings(jobs[work[w].first][work[w].second], batch[w]);
         }
 
         size_t produced = 0;
         size_t w = 0;
         for (size_t i = 0; i < jobs.size(); i++) {
+            pq_helper * target = products[first + i].first;
             for (size_t j = 0; j < jobs[i].size(); j++, w++) {
                 produced += batch[w].size();
-                ordered.insert(ordered.end(), batch[w].begin(), batch[w].end());
+                target->ordered.insert(target->ordered.end(), batch[w].begin(), batch[w].end());
             }
-            if ( can_consolidate && ordered.size() > consolidate_threshold ) {
-                consolidate_running_terms();
+            if ( can_consolidate && target->ordered.size() > consolidate_threshold ) {
+                target->consolidate_running_terms();
             }
         }
 
@@ -1262,6 +1449,14 @@ void pq_helper::py_add_operator_product(double factor, std::vector<std::string>
 // add a string of operators
 void pq_helper::add_operator_product(double factor, std::vector<std::string>  in){
 
+    if ( !projections.empty() ) {
+        for (pq_helper & projection : projections) {
+            configure_projection(projection);
+            projection.add_operator_product(factor, in);
+        }
+        return;
+    }
+
     ensure_bra_and_ket();
 
     std::vector<std::vector<std::shared_ptr<pq_string> > > jobs;
@@ -1340,6 +1535,11 @@ void pq_helper::build_operator_product(double factor, const std::vector<std::str
                             continue;
                         }
 
+                        // drop splits of general labels that normal ordering would discard anyway
+                        if ( vacuum == "FERMI" && !fermi_vacuum_sandwich_survives(*left, *center, *right) ) {
+                            continue;
+                        }
+
                         std::shared_ptr<pq_string> newguy (new pq_string(vacuum));
 
                         newguy->append(left.get());
@@ -2258,24 +2458,8 @@ std::vector<std::shared_ptr<pq_string>> pq_helper::build_new_strings(double fact
 
     // expand general labels (fermi vacuum)
     if (vacuum != "TRUE") {
-        
-        bool done_expanding = false;
-        do {
-            std::vector< std::shared_ptr<pq_string> > list;
-            done_expanding = true;
-            for (const std::shared_ptr<pq_string> & pq_str : new_pq_strings) {
-                bool am_i_done = expand_general_labels(pq_str, list, occ_label_count, vir_label_count);
-                if ( !am_i_done ) done_expanding = false;
-            }
-            if (!done_expanding) {
-                new_pq_strings.clear();
-                for (std::shared_ptr<pq_string> & pq_str : list) {
-                    new_pq_strings.push_back(pq_str);
-                }
-            }
-            occ_label_count++;
-            vir_label_count++;
-        }while(!done_expanding);
+        new_pq_strings.clear();
+        expand_all_general_labels(newguy, new_pq_strings, occ_label_count, vir_label_count);
     }
 
     // now, we need to convert the list "new_pq_strings[i]->string" into symbols and daggers
@@ -2296,6 +2480,12 @@ std::vector<std::shared_ptr<pq_string>> pq_helper::build_new_strings(double fact
 
 void pq_helper::simplify() {
 
+    // each projection is a separate set of equations
+    for (pq_helper & projection : projections) {
+        configure_projection(projection);
+        projection.simplify();
+    }
+
     // eliminate strings based on delta functions and use delta functions to alter integral / amplitude labels
     for (std::shared_ptr<pq_string> & pq_str : ordered) {
 
@@ -2419,20 +2609,10 @@ void pq_helper::block_by_spin(const std::unordered_map<std::string, std::string>
 
 std::vector<std::vector<std::string> > pq_helper::strings() const {
 
-    bool is_blocked = pq_string::is_spin_blocked || pq_string::is_range_blocked;
-    const auto &reference = is_blocked ? ordered_blocked : ordered;
-
     std::vector<std::vector<std::string> > list;
-    // print operators by rank
-    for (size_t i = 0; i < 9; i++) {
-        for (const std::shared_ptr<pq_string> & pq_str : reference) {
-            if ( pq_str->symbol.size() != i  ) continue;
-            std::vector<std::string> my_string = pq_str->get_string();
-            if ( (int)my_string.size() > 0 ) {
-                list.push_back(my_string);
-            }
-        }
-    }
+    for_each_string([&list](std::vector<std::string> &my_string) {
+        list.push_back(std::move(my_string));
+    });
 
     return list;
 
@@ -2441,6 +2621,10 @@ std::vector<std::vector<std::string> > pq_helper::strings() const {
 void pq_helper::clear() {
     ordered.clear();
     ordered_blocked.clear();
+    for (pq_helper & projection : projections) {
+        projection.ordered.clear();
+        projection.ordered_blocked.clear();
+    }
     pq_string::is_spin_blocked = false;
     pq_string::is_range_blocked = false;
 }
@@ -2452,6 +2636,11 @@ void pq_helper::add_st_operator(double factor,
 
     std::vector<pq_operator_terms> st_ops = get_st_operator_terms(factor, targets, ops, do_operators_commute);
 
+    if ( !projections.empty() ) {
+        process_projected_operator_products(st_ops, true);
+        return;
+    }
+
     // every term of the BCH series past zeroth order is a nested commutator, so
     // the connectivity half of the screen applies (the zeroth-order term carries
     // no cluster amplitudes and passes it trivially). this is where the bulk of
@@ -26,10 +26,55 @@
 
 #include "pq_string.h"
 
+#include <cstdint>
+#include <functional>
 #include <utility>
 
 namespace pdaggerq {
 
+class pq_helper;
+
+/**
+ *
+ * forward cursor over the terms of a pq_helper, in the order used by pq_helper::strings()
+ * (by number of remaining operators, then by position). terms are handed out one at a
+ * time, so the whole list of strings never has to be formatted at once.
+ *
+ */
+class pq_string_cursor {
+  public:
+    explicit pq_string_cursor(const pq_helper &pq);
+
+    /**
+     *
+     * advance to the next term
+     *
+     * @return the next term, or nullptr once every term has been visited
+     *
+     */
+    std::shared_ptr<pq_string> next();
+
+  private:
+    const std::vector<std::shared_ptr<pq_string> > &terms_;
+    size_t rank_ = 0;
+    size_t pos_ = 0;
+};
+
+/**
+ *
+ * columnar representation of the terms returned by pq_helper::strings(). every string
+ * other than the numerical factor is stored once in a table of labels, and each term
+ * is a run of integer codes into that table.
+ *
+ */
+class pq_string_table {
+  public:
+    std::vector<std::string> labels; // unique strings, in order of first appearance
+    std::vector<double> factors;     // signed numerical factor of each term
+    std::vector<int32_t> codes;      // codes of all terms, concatenated
+    std::vector<int64_t> offsets;    // term i is codes[offsets[i]:offsets[i+1]]
+};
+
 class pq_operator_terms {
   public:
     pq_operator_terms(double in_factor, std::vector<std::string> in_operators):
@@ -137,6 +182,43 @@ class pq_helper {
      */
     const std::vector<std::vector<std::string>> & get_right_operators() const { return right_operators; }
 
+    /**
+     *
+     * generate several projections together. every operator product added afterwards
+     * is screened for each projection, and the products that survive are normal ordered
+     * for all projections in one parallel pass. each (product, projection) pair is still
+     * normal ordered on its own, since the bra is part of the string; what is shared is
+     * the splitting of the operators, the batching, and the threads. the strings are
+     * sorted into one list of terms per projection. simplify() consolidates each list
+     * separately, and get_projection() returns the terms of one projection. passing
+     * empty lists turns batched generation off again.
+     *
+     * @param left: one bra (a sum of products of operators, as in set_left_operators) per projection
+     * @param right: one ket (as in set_right_operators) per projection
+     *
+     * a single bra or ket (or none) is shared by all projections.
+     *
+     */
+    void set_projections(const std::vector<std::vector<std::vector<std::string>>> &left,
+                         const std::vector<std::vector<std::vector<std::string>>> &right);
+
+    /**
+     *
+     * get the terms generated for one of the projections given to set_projections()
+     *
+     * @param n: the index of the projection
+     * @return a pq_helper holding the terms of projection n
+     *
+     */
+    pq_helper get_projection(size_t n) const;
+
+    /**
+     *
+     * the number of projections given to set_projections() (zero if not batched)
+     *
+     */
+    size_t num_projections() const { return projections.size(); }
+
     /**
      *
      * set right-hand operators type
@@ -316,6 +398,39 @@ class pq_helper {
      */
     void process_operator_products(std::vector<pq_operator_terms> ops);
 
+    /**
+     *
+     * expand a list of operator products where necessary, e.g., 't1' -> 'te1' - 'td1',
+     * 'v' -> 'j1' + 'j2', etc. each product expands into a contiguous run of the result.
+     *
+     * @param ops: a list of pq_operator_terms
+     *
+     */
+    std::vector<pq_operator_terms> expand_operator_products(std::vector<pq_operator_terms> ops);
+
+    /**
+     *
+     * process a list of operator products for every projection given to set_projections().
+     * each projection is screened on its own, and the operators of each surviving product
+     * are split (expand_operator_products) once. the strings of every (product, projection)
+     * pair are then built and normal ordered separately, in a single parallel pass.
+     *
+     * @param ops: a list of pq_operator_terms
+     * @param connected: whether the products come from a commutator expansion
+     *
+     */
+    void process_projected_operator_products(const std::vector<pq_operator_terms> &ops, bool connected);
+
+    /**
+     *
+     * build, normal order, and store the strings for a list of operator products. each
+     * product is paired with the pq_helper whose bra, ket, and list of terms it goes to.
+     *
+     * @param products: a list of (target, operator product) pairs
+     *
+     */
+    void normal_order_operator_products(const std::vector<std::pair<pq_helper *, pq_operator_terms> > &products);
+
     /**
      * Discard operator products that cannot contribute to a fully contracted
      * expectation value, BEFORE they are normal ordered.
@@ -343,6 +458,15 @@ class pq_helper {
      */
     void screen_operator_products(std::vector<pq_operator_terms> &ops, bool connected);
 
+    /**
+     * which products would survive screen_operator_products() (all of them when the
+     * screen does not apply)
+     *
+     * @param ops: a list of pq_operator_terms
+     * @param connected: whether the products come from a commutator expansion
+     */
+    std::vector<bool> screen_operator_products_mask(const std::vector<pq_operator_terms> &ops, bool connected) const;
+
     /**
      * Incrementally combine the running list of terms in `ordered` while it is
      * being generated. This applies only the confluent, combine-only portion of
@@ -681,6 +805,33 @@ class pq_helper {
      */
     std::vector<std::vector<std::string> > strings() const;
 
+    /**
+     *
+     * visit the terms returned by strings() one at a time, in the same order, without
+     * materializing the whole list
+     *
+     * @param visitor: called once per term with the strings of that term
+     *
+     */
+    void for_each_string(const std::function<void(std::vector<std::string> &)> &visitor) const;
+
+    /**
+     *
+     * write the terms returned by strings() to a file, one term per line with
+     * its strings separated by tabs
+     *
+     * @param filename: the name of the file to which the terms are written
+     *
+     */
+    void write_strings(const std::string &filename) const;
+
+    /**
+     *
+     * get the terms returned by strings() as a table of unique labels plus integer codes
+     *
+     */
+    pq_string_table string_table() const;
+
     /**
      *
      * this function is used to block strings by spin
@@ -731,6 +882,22 @@ private:
     std::vector< std::shared_ptr<pq_string> > ordered;
     std::vector< std::shared_ptr<pq_string> > ordered_blocked;
 
+    /**
+     *
+     * one pq_helper per projection when several projections are generated together
+     * (see set_projections). each holds the bra, ket, and terms of its projection.
+     *
+     */
+    std::vector<pq_helper> projections;
+
+    /**
+     *
+     * copy the settings that control how strings are generated and simplified
+     * into a projection
+     *
+     */
+    void configure_projection(pq_helper &projection) const;
+
     /**
      *
      * the vacuum type ("TRUE" or "FERMI")
@@ -21,9 +21,12 @@
 //  limitations under the License.
 //
 
+#include <cstdint>
+
 #include "pq_tensor.h"
 #include "pq_string.h"
 #include "pq_utils.h"
+#include "pq_swap_operators.h"
 
 namespace pdaggerq {
 
@@ -332,6 +335,97 @@ bool swap_operators_fermi_vacuum_no_deltas(std::shared_ptr<pq_string> &in) {
     return am_i_done;
 }
 
+namespace {
+
+// a string of fermion operators, each coded by its position in the string it came
+// from (with the high bit flagging creators), and the pairs of operators that have
+// been contracted into delta functions so far
+struct coded_string {
+    std::vector<uint8_t> ops;
+    std::vector<std::pair<uint8_t, uint8_t> > contractions;
+    int sign;
+};
+
+constexpr uint8_t dagger_bit = 0x80;
+
+// position of the first annihilator that is followed by a creator, or ops.size()
+// if the string is in normal order with respect to the true vacuum
+size_t first_unordered_pair(const std::vector<uint8_t> &ops) {
+    for (size_t i = 0; i + 1 < ops.size(); i++) {
+        if ( !(ops[i] & dagger_bit) && (ops[i+1] & dagger_bit) ) return i;
+    }
+    return ops.size();
+}
+
+} // anonymous namespace
+
+bool normal_order_true_vacuum_fermions(const std::shared_ptr<pq_string> &in, std::vector<std::shared_ptr<pq_string> > &ordered) {
+
+    if ( !in->is_boson_dagger.empty() ) return false;
+    if ( in->symbol.size() >= dagger_bit ) return false;
+
+    if ( in->skip ) return true;
+
+    coded_string root;
+    root.sign = in->sign;
+    root.ops.reserve(in->symbol.size());
+    for (size_t i = 0; i < in->symbol.size(); i++) {
+        root.ops.push_back( (uint8_t)i | (in->is_dagger[i] ? dagger_bit : 0) );
+    }
+
+    // a string that is already in normal order is passed on as is
+    if ( first_unordered_pair(root.ops) == root.ops.size() ) {
+        ordered.push_back(in);
+        return true;
+    }
+
+    // each swap of an annihilator past a creator yields the contracted string and
+    // the swapped one. expanding the contracted string first visits the fully
+    // ordered strings in the same order as the breadth-first expansion built from
+    // swap_operators_true_vacuum does.
+    std::vector<coded_string> stack;
+    stack.push_back(std::move(root));
+
+    while ( !stack.empty() ) {
+
+        coded_string term = std::move(stack.back());
+        stack.pop_back();
+
+        size_t i = first_unordered_pair(term.ops);
+
+        if ( i == term.ops.size() ) {
+
+            std::shared_ptr<pq_string> newguy = std::make_shared<pq_string>(in.get(), false);
+            newguy->sign = term.sign;
+            for (const std::pair<uint8_t, uint8_t> & contraction : term.contractions) {
+                delta_functions deltas;
+                deltas.labels.push_back(in->symbol[contraction.first & ~dagger_bit]);
+                deltas.labels.push_back(in->symbol[contraction.second & ~dagger_bit]);
+                deltas.sort();
+                newguy->deltas.push_back(deltas);
+            }
+            for (uint8_t op : term.ops) {
+                newguy->symbol.push_back(in->symbol[op & ~dagger_bit]);
+                newguy->is_dagger.push_back( (op & dagger_bit) != 0 );
+            }
+            ordered.push_back(newguy);
+            continue;
+        }
+
+        coded_string swapped = term;
+        swapped.sign = -swapped.sign;
+        std::swap(swapped.ops[i], swapped.ops[i+1]);
+
+        term.contractions.emplace_back(term.ops[i], term.ops[i+1]);
+        term.ops.erase(term.ops.begin() + (long)i, term.ops.begin() + (long)i + 2);
+
+        stack.push_back(std::move(swapped));
+        stack.push_back(std::move(term));
+    }
+
+    return true;
+}
+
 bool swap_operators_true_vacuum(const std::shared_ptr<pq_string> &in, std::vector<std::shared_ptr<pq_string> > &ordered, bool keep_operators) {
 
     if ( in->skip ) return true;
@@ -58,6 +58,19 @@ bool swap_operators_fermi_vacuum_no_deltas(std::shared_ptr<pq_string> &in);
  */
 bool swap_operators_true_vacuum(const std::shared_ptr<pq_string> &in, std::vector<std::shared_ptr<pq_string> > &ordered, bool keep_operators);
 
+/**
+ *
+ * bring a string of fermion operators all the way to normal order with respect to the true vacuum.
+ * the string is expanded on integer codes for its operators, and only the resulting strings are built
+ * as pq_strings. they (and their deltas) come out in the same order as from repeated calls to
+ * swap_operators_true_vacuum.
+ *
+ * @param in: the input string
+ * @param ordered: a list of strings to which the normal-ordered strings will be added
+ * @return false if the string contains bosons (and was left alone), true otherwise
+ */
+bool normal_order_true_vacuum_fermions(const std::shared_ptr<pq_string> &in, std::vector<std::shared_ptr<pq_string> > &ordered);
+
 }
 
 #endif 
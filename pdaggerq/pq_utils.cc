@@ -645,6 +645,54 @@ void consolidate_permutations_plus_swaps(std::vector<std::shared_ptr<pq_string>
 
 }
 
+// the number of label permutations that sorting applied to the amplitudes and integrals
+// of a string. the sign compare_strings() finds for two strings with the same key is
+// that of the sum of theirs.
+static int permutation_count(const pq_string &in) {
+
+    int n_permute = 0;
+    for (const auto &amp_pair : in.amps) {
+        for (const amplitudes & amp : amp_pair.second) {
+            n_permute += amp.permutations;
+        }
+    }
+    for (const auto &int_pair : in.ints) {
+        for (const integrals & integral : int_pair.second) {
+            n_permute += integral.permutations;
+        }
+    }
+    return n_permute;
+}
+
+// positions of the (non-skipped) strings in a list, by key
+static std::unordered_map<std::string, std::vector<size_t> > positions_by_key(const std::vector<std::shared_ptr<pq_string> > &ordered) {
+
+    std::unordered_map<std::string, std::vector<size_t> > positions;
+    for (size_t i = 0; i < ordered.size(); i++) {
+        if ( ordered[i]->skip ) continue;
+        positions[ordered[i]->key].push_back(i);
+    }
+    return positions;
+}
+
+// positions after i of the strings with any of the given keys, in order. these are the only
+// strings that can compare equal to string i or to any of the variants of it with those keys.
+static std::vector<size_t> later_positions_with_keys(const std::unordered_map<std::string, std::vector<size_t> > &positions,
+                                                     const std::vector<const std::string *> &keys,
+                                                     size_t i) {
+
+    std::vector<size_t> later;
+    for (const std::string * key : keys) {
+        auto it = positions.find(*key);
+        if ( it == positions.end() ) continue;
+        const std::vector<size_t> & list = it->second;
+        later.insert(later.end(), std::upper_bound(list.begin(), list.end(), i), list.end());
+    }
+    std::sort(later.begin(), later.end());
+    later.erase(std::unique(later.begin(), later.end()), later.end());
+    return later;
+}
+
 // consolidate terms that differ by permutations of non-summed labels
 void consolidate_permutations_non_summed(
     std::vector<std::shared_ptr<pq_string> > &ordered,
@@ -782,8 +830,26 @@ void consolidate_permutations_non_summed(
     return;
 */
 
+    // a string can only absorb a later one that matches it or one of the strings made by
+    // swapping two of its non-summed labels. those swaps depend on nothing but the string
+    // itself, so they are made for all strings concurrently, and only their keys are kept.
+    // the strings are then visited in order, exactly as in the pairwise search, but only
+    // alongside the later strings with one of those keys. every other pair left both
+    // strings untouched, so the equations do not depend on the number of threads.
+    struct swapped_string {
+        std::string key;
+        int n_permute;
+        size_t id1, id2;
+    };
+
+    std::vector<int> n_permute_of(ordered.size(), 0);
+    std::vector<std::vector<swapped_string> > swaps(ordered.size());
+
+    #pragma omp parallel for schedule(dynamic) default(none) shared(ordered, labels, n_permute_of, swaps)
     for (size_t i = 0; i < ordered.size(); i++) {
 
+        n_permute_of[i] = permutation_count(*ordered[i]);
+
         // not sure if this logic works with existing permutation operators ... skip those for now
         //if ( !ordered[i]->permutations.empty() ) continue;
 
@@ -820,12 +886,40 @@ void consolidate_permutations_non_summed(
             }
         }
 
-        for (size_t j = i+1; j < ordered.size(); j++) {
+        // try swapping non-summed labels
+        for (size_t id1 = 0; id1 < labels.size(); id1++) {
+            if ( find_idx[id1] != 1 ) continue;
+            for (size_t id2 = id1 + 1; id2 < labels.size(); id2++) {
+                if ( find_idx[id2] != 1 ) continue;
+
+                std::shared_ptr<pq_string> newguy = std::make_shared<pq_string>(*ordered[i]);
+                swap_two_labels(newguy, labels[id1], labels[id2]);
+                swaps[i].push_back({newguy->key, permutation_count(*newguy), id1, id2});
+            }
+        }
+    }
+
+    std::unordered_map<std::string, std::vector<size_t> > positions = positions_by_key(ordered);
+
+    for (size_t i = 0; i < ordered.size(); i++) {
+
+        if ( !ordered[i]->paired_permutations_2.empty() ) continue;
+        if ( !ordered[i]->paired_permutations_3.empty() ) continue;
+        if ( !ordered[i]->paired_permutations_6.empty() ) continue;
+        
+        if ( ordered[i]->skip ) continue;
+
+        std::vector<const std::string *> keys = { &ordered[i]->key };
+        for (const swapped_string & swap : swaps[i]) {
+            keys.push_back(&swap.key);
+        }
+
+        for (size_t j : later_positions_with_keys(positions, keys, i)) {
 
             if ( ordered[j]->skip ) continue;
 
-            int n_permute;
-            bool strings_same = compare_strings(ordered[i], ordered[j], n_permute);
+            int n_permute = n_permute_of[i] + n_permute_of[j];
+            bool strings_same = ordered[i]->key == ordered[j]->key;
 
             // now that we've identified some permutations, it is possible for strings to be the same without swaps
             if (strings_same) {
@@ -856,24 +950,14 @@ void consolidate_permutations_non_summed(
             std::string permutation_2;
 
             // try swapping non-summed labels
-            for (size_t id1 = 0; id1 < labels.size(); id1++) {
-                if ( find_idx[id1] != 1 ) continue;
-                for (size_t id2 = id1 + 1; id2 < labels.size(); id2++) {
-                    if ( find_idx[id2] != 1 ) continue;
-
-                    std::shared_ptr<pq_string> newguy = std::make_shared<pq_string>(*ordered[i]);
-                    swap_two_labels(newguy, labels[id1], labels[id2]);
-                    //newguy->sort();
-
-                    strings_same = compare_strings(ordered[j], newguy, n_permute);
-
-                    if ( strings_same ) {
-                        permutation_1 = labels[id1];
-                        permutation_2 = labels[id2];
-                        break;
-                    }
+            for (const swapped_string & swap : swaps[i]) {
+                strings_same = swap.key == ordered[j]->key;
+                if ( strings_same ) {
+                    n_permute = n_permute_of[j] + swap.n_permute;
+                    permutation_1 = labels[swap.id1];
+                    permutation_2 = labels[swap.id2];
+                    break;
                 }
-                if ( strings_same ) break;
             }
 
             if ( !strings_same ) continue;
@@ -1079,9 +1163,34 @@ void consolidate_paired_permutations_non_summed(
         n_permutation_type = 3;
     }
 
-    // look for n-fold permutations
+    // the label swaps that compare_strings_with_swapped_summed_and_nonsummed_labels() tries for
+    // a string depend on nothing but the string itself: for each set of summed labels (none,
+    // occupied, virtual), each variant of the string with two of those labels swapped, and each
+    // permutation of its three ov pairs, in the order they are tried. they are made for all
+    // strings concurrently, and only their keys are kept. the strings are then visited in order,
+    // exactly as in the pairwise search, but only alongside the later strings with one of those
+    // keys, which are the only ones the search could match. the equations therefore do not
+    // depend on the number of threads.
+    struct permuted_string {
+        std::string key;
+        int n_permute;
+    };
+    struct paired_candidates {
+        bool searched = false;
+        std::vector<std::string> found_occ;
+        std::vector<std::string> found_vir;
+        // [set of summed labels][variant][permutation type]
+        std::vector<std::vector<std::vector<permuted_string> > > variants;
+    };
+
+    std::vector<int> n_permute_of(ordered.size(), 0);
+    std::vector<paired_candidates> candidates(ordered.size());
+
+    #pragma omp parallel for schedule(dynamic) default(none) shared(ordered, occ_labels, vir_labels, n_permutation_type, n_permute_of, candidates)
     for (size_t i = 0; i < ordered.size(); i++) {
 
+        n_permute_of[i] = permutation_count(*ordered[i]);
+
         if ( ordered[i]->skip ) continue;
 
         // not sure if this logic works with existing permutation operators ... skip those for now
@@ -1128,11 +1237,100 @@ void consolidate_paired_permutations_non_summed(
         // this function only works for swapping exactly three ov pairs
         if ( found_occ.size() != 3 || found_vir.size() != 3 ) continue;
 
-        // ov pairs to swap
-        std::vector<std::vector<std::string>> pairs;
-        pairs.push_back({found_occ[0], found_vir[0]});
-        pairs.push_back({found_occ[1], found_vir[1]});
-        pairs.push_back({found_occ[2], found_vir[2]});
+        paired_candidates & mine = candidates[i];
+        mine.searched = true;
+
+        // variants of the string with (at most) two summed labels swapped
+        std::vector<std::vector<std::shared_ptr<pq_string> > > variants(3);
+        variants[0].push_back(ordered[i]);
+        for (size_t set = 1; set < 3; set++) {
+            const std::vector<std::string> & summed = set == 1 ? found_summed_occ : found_summed_vir;
+            for (size_t id1 = 0; id1 < summed.size(); id1++) {
+                for (size_t id2 = id1 + 1; id2 < summed.size(); id2++) {
+                    std::shared_ptr<pq_string> newguy = std::make_shared<pq_string>(*ordered[i]);
+                    swap_two_labels(newguy, summed[id1], summed[id2]);
+                    variants[set].push_back(newguy);
+                }
+            }
+        }
+
+        // each with the three ov pairs permuted
+        const std::string & o1 = found_occ[0], & o2 = found_occ[1], & o3 = found_occ[2];
+        const std::string & v1 = found_vir[0], & v2 = found_vir[1], & v3 = found_vir[2];
+
+        mine.variants.resize(3);
+        for (size_t set = 0; set < 3; set++) {
+            for (const std::shared_ptr<pq_string> & variant : variants[set]) {
+                std::vector<permuted_string> permuted;
+                for (int permutation_type = 0; permutation_type < n_permutation_type; permutation_type++) {
+
+                    std::shared_ptr<pq_string> newguy = std::make_shared<pq_string>(*variant);
+
+                    if ( permutation_type == 0 ) {
+
+                        // 1 <-> 2
+                        swap_two_labels(newguy, o1, o2);
+                        swap_two_labels(newguy, v1, v2);
+
+                    }else if ( permutation_type == 1 ) {
+
+                        // 1 <-> 3
+                        swap_two_labels(newguy, o1, o3);
+                        swap_two_labels(newguy, v1, v3);
+
+                    }else if ( permutation_type == 2 ) {
+
+                        // 2 <-> 3
+                        swap_two_labels(newguy, o2, o3);
+                        swap_two_labels(newguy, v2, v3);
+
+                    }else if ( permutation_type == 3 ) {
+
+                        // only relevant for 6-fold permutations:
+
+                        // 1 <-> 2
+                        swap_two_labels(newguy, o1, o2);
+                        swap_two_labels(newguy, v1, v2);
+
+                        // 1 <-> 3
+                        swap_two_labels(newguy, o1, o3);
+                        swap_two_labels(newguy, v1, v3);
+
+                    }else if ( permutation_type == 4 ) {
+
+                        // only relevant for 6-fold permutations:
+
+                        // 1 <-> 2
+                        swap_two_labels(newguy, o1, o2);
+                        swap_two_labels(newguy, v1, v2);
+
+                        // 2 <-> 3
+                        swap_two_labels(newguy, o2, o3);
+                        swap_two_labels(newguy, v2, v3);
+
+                    }
+
+                    permuted.push_back({newguy->key, permutation_count(*newguy)});
+                }
+                mine.variants[set].push_back(std::move(permuted));
+            }
+        }
+
+        mine.found_occ = std::move(found_occ);
+        mine.found_vir = std::move(found_vir);
+    }
+
+    std::unordered_map<std::string, std::vector<size_t> > positions = positions_by_key(ordered);
+
+    // look for n-fold permutations
+    for (size_t i = 0; i < ordered.size(); i++) {
+
+        if ( ordered[i]->skip ) continue;
+        if ( !candidates[i].searched ) continue;
+
+        const std::vector<std::string> & found_occ = candidates[i].found_occ;
+        const std::vector<std::string> & found_vir = candidates[i].found_vir;
+        const std::vector<std::vector<std::vector<permuted_string> > > & variants = candidates[i].variants;
 
         // which labels are involve in the permutation?
         std::vector<size_t> my_permutations;
@@ -1140,38 +1338,58 @@ void consolidate_paired_permutations_non_summed(
         // which pairs are swapped ( 12, 13, 23 ) ... this affects how we label 3-fold permutations
         std::vector<bool> permutation_types = { false, false, false };
 
+        std::vector<const std::string *> keys;
+        for (const auto & set : variants) {
+            for (const auto & variant : set) {
+                for (const permuted_string & permuted : variant) {
+                    keys.push_back(&permuted.key);
+                }
+            }
+        }
+
         // loop over other strings
-        for (size_t j = i+1; j < ordered.size(); j++) {
+        for (size_t j : later_positions_with_keys(positions, keys, i)) {
 
             if ( ordered[j]->skip ) continue;
 
             // not sure if this logic works with existing permutation operators ... skip those for now
             if ( !ordered[j]->permutations.empty() ) continue;
-            if ( !ordered[i]->paired_permutations_2.empty() ) continue;
-            if ( !ordered[i]->paired_permutations_3.empty() ) continue;
-            if ( !ordered[i]->paired_permutations_6.empty() ) continue;
-
-            int n_permute;
-            bool strings_same = compare_strings(ordered[i],ordered[j],n_permute);
 
+            // for each set of summed labels, the first variant that matches string j with any
+            // permutation of the ov pairs decides; it is a paired permutation if the factors agree
             bool found_paired_permutation = false;
-            std::vector<std::vector<std::vector<std::string> > > labels;
-            labels.emplace_back();
-            labels.push_back({found_summed_occ});
-            labels.push_back({found_summed_vir});
-            for (const std::vector<std::vector<std::string>> & label : labels) {
-                compare_strings_with_swapped_summed_and_nonsummed_labels(label,
-                                                                         pairs, 
-                                                                         0, 
-                                                                         ordered[i], 
-                                                                         ordered[j], 
-                                                                         j, 
-                                                                         my_permutations, 
-                                                                         permutation_types, 
-                                                                         n_permutation_type, 
-                                                                         n_permute, 
-                                                                         strings_same, 
-                                                                         found_paired_permutation);
+            for (const auto & set : variants) {
+                for (const auto & variant : set) {
+
+                    int found_permutation_type = -1;
+                    for (size_t permutation_type = 0; permutation_type < variant.size(); permutation_type++) {
+                        if ( variant[permutation_type].key == ordered[j]->key ) {
+                            found_permutation_type = (int)permutation_type;
+                            break;
+                        }
+                    }
+                    if ( found_permutation_type < 0 ) continue;
+
+                    int n_permute = n_permute_of[j] + variant[found_permutation_type].n_permute;
+
+                    double factor_i = ordered[i]->factor * ordered[i]->sign;
+                    double factor_j = ordered[j]->factor * ordered[j]->sign;
+
+                    double combined_factor = factor_i - factor_j * pow(-1.0,n_permute);
+
+                    // if factors are identical, then this is a paired permutation
+                    if ( fabs(combined_factor) < 1e-12 ) {
+
+                        // keep track of which term this is
+                        my_permutations.push_back(j);
+
+                        found_paired_permutation = true;
+
+                        // keep track of which labels were swapped (for 3-fold)
+                        permutation_types[found_permutation_type] = true;
+                    }
+                    break;
+                }
                 if ( found_paired_permutation ) break;
             }
         }
@@ -1224,56 +1442,40 @@ void consolidate_paired_permutations_non_summed(
     }
 }
 
+// sort the operators in symbol[first, last) by the first character of their labels,
+// keeping the order of operators with the same first character, and flip the sign
+// for an odd permutation
+static void alphabetize_operators(pq_string &pq_str, size_t first, size_t last) {
+
+    auto key = [](const std::string & label) { return (int)label.c_str()[0]; };
+
+    // the parity of the permutation is that of the number of out-of-order pairs
+    size_t inversions = 0;
+    for (size_t i = first; i < last; i++) {
+        for (size_t j = i + 1; j < last; j++) {
+            if ( key(pq_str.symbol[j]) < key(pq_str.symbol[i]) ) inversions++;
+        }
+    }
+    if ( inversions == 0 ) return;
+
+    std::stable_sort(pq_str.symbol.begin() + (long)first, pq_str.symbol.begin() + (long)last,
+                     [&key](const std::string & a, const std::string & b) { return key(a) < key(b); });
+
+    if ( inversions % 2 == 1 ) pq_str.sign = -pq_str.sign;
+}
+
 /// alphabetize operators to simplify string comparisons (for true vacuum only)
 void alphabetize(std::vector<std::shared_ptr<pq_string> > &ordered) {
 
-    // alphabetize string
+    // alphabetize string: creation operators, then annihilation operators
     for (std::shared_ptr<pq_string> & pq_str : ordered) {
 
-        // creation
-        bool not_alphabetized = false;
-        do {
-            not_alphabetized = false;
-            int ndagger = 0;
-            for (size_t j = 0; j < pq_str->symbol.size(); j++) {
-                if ( pq_str->is_dagger[j] ) ndagger++;
-            }
-            for (int j = 0; j < ndagger-1; j++) {
-                int val1 = pq_str->symbol[j].c_str()[0];
-                int val2 = pq_str->symbol[j + 1].c_str()[0];
-                if ( val2 < val1 ) {
-                    std::string dum = pq_str->symbol[j];
-                    pq_str->symbol[j] = pq_str->symbol[j + 1];
-                    pq_str->symbol[j + 1] = dum;
-                    pq_str->sign = -pq_str->sign;
-                    not_alphabetized = true;
-                    j = pq_str->symbol.size() + 1;
-                    not_alphabetized = true;
-                }
-            }
-        }while(not_alphabetized);
-        // annihilation
-        not_alphabetized = false;
-        do {
-            not_alphabetized = false;
-            int ndagger = 0;
-            for (size_t j = 0; j < pq_str->symbol.size(); j++) {
-                if ( pq_str->is_dagger[j] ) ndagger++;
-            }
-            for (int j = ndagger; j < (int)pq_str->symbol.size() - 1; j++) {
-                int val1 = pq_str->symbol[j].c_str()[0];
-                int val2 = pq_str->symbol[j + 1].c_str()[0];
-                if ( val2 < val1 ) {
-                    std::string dum = pq_str->symbol[j];
-                    pq_str->symbol[j] = pq_str->symbol[j + 1];
-                    pq_str->symbol[j + 1] = dum;
-                    pq_str->sign = -pq_str->sign;
-                    not_alphabetized = true;
-                    j = pq_str->symbol.size() + 1;
-                    not_alphabetized = true;
-                }
-            }
-        }while(not_alphabetized);
+        size_t ndagger = 0;
+        for (size_t j = 0; j < pq_str->symbol.size(); j++) {
+            if ( pq_str->is_dagger[j] ) ndagger++;
+        }
+        alphabetize_operators(*pq_str, 0, ndagger);
+        alphabetize_operators(*pq_str, ndagger, pq_str->symbol.size());
     }
         
     // alphabetize deltas
@@ -1645,6 +1847,8 @@ void gobble_deltas(std::shared_ptr<pq_string> &in) {
 // bring a new string to normal order and add to list of normal ordered strings (fermi vacuum)
 void add_new_string_true_vacuum(const std::vector<std::shared_ptr<pq_string>> &in, std::vector<std::shared_ptr<pq_string> > &ordered, int print_level, bool find_paired_permutations, bool keep_operators){
 
+    // strings already in the list were alphabetized when they were added
+    std::vector< std::shared_ptr<pq_string> > new_strings;
 
     for (auto & my_string: in ) {
 
@@ -1655,6 +1859,9 @@ void add_new_string_true_vacuum(const std::vector<std::shared_ptr<pq_string>> &i
             my_string->print();
         }
 
+        // strings without bosons are expanded directly
+        if ( normal_order_true_vacuum_fermions(my_string, new_strings) ) continue;
+
         // rearrange strings
         std::vector< std::shared_ptr<pq_string> > tmp;
         tmp.push_back(my_string);
@@ -1674,13 +1881,15 @@ void add_new_string_true_vacuum(const std::vector<std::shared_ptr<pq_string>> &i
         }while(!done_rearranging);
 
         for (const std::shared_ptr<pq_string> & pq_str : tmp) {
-            ordered.push_back(pq_str);
+            new_strings.push_back(pq_str);
         }
         tmp.clear();
     }
 
     // alphabetize
-    alphabetize(ordered);
+    alphabetize(new_strings);
+
+    ordered.insert(ordered.end(), new_strings.begin(), new_strings.end());
 }
 
 // expand general labels, p -> o, v
@@ -1724,6 +1933,103 @@ bool expand_general_labels(const std::shared_ptr<pq_string> & in, std::vector<st
     return true;
 }
 
+// expand all general labels, p -> o, v
+void expand_all_general_labels(const std::shared_ptr<pq_string> & in, std::vector<std::shared_ptr<pq_string> > & list, int & occ_label_count, int & vir_label_count) {
+
+    // each round of expand_general_labels splits the first general label left in
+    // "string" (the operators are not relabeled along with the tensors), so round r
+    // always splits the r-th general label of the original string
+    std::vector<size_t> general;
+    for (size_t i = 0; i < in->string.size(); i++) {
+        std::string me_nostar = in->string[i];
+        removeStar(me_nostar);
+        if ( !is_occ(me_nostar) && !is_vir(me_nostar) ) general.push_back(i);
+    }
+
+    // the rounds also advance the label counts once more when they find nothing left to split
+    int first_occ_label = occ_label_count;
+    int first_vir_label = vir_label_count;
+    occ_label_count += (int)general.size() + 1;
+    vir_label_count += (int)general.size() + 1;
+
+    if ( general.empty() ) {
+        list.push_back(in);
+        return;
+    }
+
+    // string c of the 2^n splits takes the virtual label in round r if bit n-1-r of
+    // c is set, which is the order the rounds produce them in. every split is
+    // built straight from the input string, so they can be built concurrently.
+    const size_t n_rounds = general.size();
+    const size_t n_splits = (size_t)1 << n_rounds;
+    std::vector<std::shared_ptr<pq_string> > splits(n_splits);
+
+    #pragma omp parallel for schedule(static) if(n_splits >= 64) default(none) shared(in, general, splits, n_rounds, n_splits, first_occ_label, first_vir_label)
+    for (size_t c = 0; c < n_splits; c++) {
+
+        std::shared_ptr<pq_string> newguy = std::make_shared<pq_string>(in.get(), true);
+        newguy->string = in->string;
+
+        for (size_t r = 0; r < n_rounds; r++) {
+
+            std::string me_nostar = in->string[general[r]];
+            std::string maybe_a_star = "";
+            if ( me_nostar.find('*') != std::string::npos ) {
+                maybe_a_star = "*";
+                removeStar(me_nostar);
+            }
+
+            bool virtual_label = (c >> (n_rounds - 1 - r)) & 1;
+            std::string label = virtual_label ? "v" + std::to_string(first_vir_label + (int)r + 1)
+                                              : "o" + std::to_string(first_occ_label + (int)r + 1);
+
+            newguy->string[general[r]] = label + maybe_a_star;
+            replace_index_everywhere(newguy, me_nostar, label);
+        }
+
+        splits[c] = newguy;
+    }
+
+    list.insert(list.end(), splits.begin(), splits.end());
+}
+
+// add_new_string_fermi_vacuum() discards strings with unequal numbers of quasiparticle creators and
+// annihilators (fermions or bosons), and is_normal_order() marks as skipped any string whose rightmost
+// fermion operator is a quasiparticle annihilator or whose leftmost one is a quasiparticle creator
+bool fermi_vacuum_sandwich_survives(const pq_string & left, const pq_string & center, const pq_string & right) {
+
+    int n_fermions = 0, n_fermion_creators = 0;
+    int n_bosons = 0, n_boson_creators = 0;
+    for (const pq_string * piece : {&left, &center, &right}) {
+        n_fermions += (int)piece->is_dagger_fermi.size();
+        for (bool dagger : piece->is_dagger_fermi) {
+            if ( dagger ) n_fermion_creators++;
+        }
+        n_bosons += (int)piece->is_boson_dagger.size();
+        for (bool dagger : piece->is_boson_dagger) {
+            if ( dagger ) n_boson_creators++;
+        }
+    }
+    if ( 2 * n_fermion_creators != n_fermions ) return false;
+    if ( 2 * n_boson_creators != n_bosons ) return false;
+
+    if ( n_fermions < 2 ) return true;
+
+    bool is_dagger_left = false, is_dagger_right = false;
+    for (const pq_string * piece : {&left, &center, &right}) {
+        if ( piece->is_dagger_fermi.empty() ) continue;
+        is_dagger_left = piece->is_dagger_fermi.front();
+        break;
+    }
+    for (const pq_string * piece : {&right, &center, &left}) {
+        if ( piece->is_dagger_fermi.empty() ) continue;
+        is_dagger_right = piece->is_dagger_fermi.back();
+        break;
+    }
+
+    return is_dagger_right && !is_dagger_left;
+}
+
 // bring a new string to normal order and add to list of normal ordered strings (fermi vacuum)
 void add_new_string_fermi_vacuum(const std::vector<std::shared_ptr<pq_string>> &in, std::vector<std::shared_ptr<pq_string> > &ordered, int print_level, bool find_paired_permutations, bool keep_operators) {
         
@@ -157,6 +157,13 @@ void removeSpaces(std::string &x);
 /// expand general labels, p -> o,v
 bool expand_general_labels(const std::shared_ptr<pq_string> & in, std::vector<std::shared_ptr<pq_string> > & list, int occ_label_count, int vir_label_count);
 
+/// expand every general label in a string, p -> o,v, giving the same strings (in the same order) as repeated calls
+/// to expand_general_labels. the label counts are advanced past the labels that were used
+void expand_all_general_labels(const std::shared_ptr<pq_string> & in, std::vector<std::shared_ptr<pq_string> > & list, int & occ_label_count, int & vir_label_count);
+
+/// can the string made by appending left, center, and right have a nonzero fermi-vacuum expectation value?
+bool fermi_vacuum_sandwich_survives(const pq_string & left, const pq_string & center, const pq_string & right);
+
 }
 
 #endif 
@@ -27,6 +27,8 @@
 #include <string>
 #include <vector>
 #include <iostream>
+#include <map>
+#include <unordered_map>
 
 #include "term.h"
 
@@ -38,6 +40,22 @@ namespace pdaggerq {
     struct TermHash;
     struct TermEqual;
 
+    /**
+     * Change in the scaling of a term from substituting a candidate intermediate.
+     * It only depends on the left-hand side and linkage of the term, which are kept alive
+     * so that their addresses cannot be reused for another term while the result is cached.
+     */
+    struct term_substitution {
+        VertexPtr lhs_;
+        LinkagePtr linkage_;
+        bool compatible_ = false; // whether the term can contain the candidate
+        bool made_sub_ = false; // whether the candidate was substituted into the term
+        scaling_map flop_diff_, mem_diff_; // change in the scaling of the term
+    };
+
+    /// results of substituting one candidate, by the address of each term's left-hand side and linkage
+    typedef std::map<pair<const Vertex*, const Linkage*>, term_substitution> substitution_cache;
+
     /**
      * Equation class
      * Represents an equation in the form of a vector of terms
@@ -54,6 +72,8 @@ namespace pdaggerq {
         scaling_map flop_map_; // map of flop scaling with linkage occurrence in equation
         scaling_map mem_map_; // map of memory scaling with linkage occurrence in equation
 
+        std::unordered_map<string, vector<size_t>> term_index_; // positions of the terms containing each vertex name
+
     public:
         static inline size_t nthreads_ = 1; // number of threads to use when substituting
         static inline bool permuted_merge_ = false; // whether to merge terms with permutations
@@ -242,18 +262,29 @@ namespace pdaggerq {
          */
         size_t substitute(const LinkagePtr &linkage, bool allow_equality);
 
+        /**
+         * index the terms by the names of their vertices for test_substitute.
+         * must be called again after the terms change.
+         */
+        void index_terms();
+
         /**
          * test a linkage substituted into the equation
          * @param linkage linkage to substitute
          * @param test_flop_map reference to flop scaling map that collects the flop scaling of the substitution
+         * @param cache results for this linkage from the last test; reused for terms that have not changed
+         * @param next_cache collects the results of this test
          * @return number of substitutions
          */
-        size_t test_substitute(const MutableLinkagePtr &linkage, scaling_map &test_flop_map, scaling_map &test_mem_map, bool allow_equality);
+        size_t test_substitute(const MutableLinkagePtr &linkage, scaling_map &test_flop_map, scaling_map &test_mem_map,
+                               bool allow_equality, const substitution_cache &cache, substitution_cache &next_cache);
 
         /**
          * collect all possible linkages from all terms
+         * @param max_depth maximum depth of the linkages
+         * @param compute_all whether to collect the linkages of all terms or just the ones in modified terms
          */
-        linkage_set make_all_links(bool compute_all = true);
+        linkage_set make_all_links(size_t max_depth, bool compute_all = true);
 
         /**
          * substitute scalars into the equation
@@ -24,7 +24,9 @@
 #ifndef PDAGGERQ_linkage_H
 #define PDAGGERQ_linkage_H
 
+#include <atomic>
 #include <cstdint>
+#include <list>
 #include <set>
 #include <unordered_set>
 #include <memory>
@@ -129,12 +131,36 @@ namespace pdaggerq {
 
         size_t depth_ = 0; // cached depth of the linkage tree
         size_t hash_ = 0; // cached hash of base_name_
+        size_t structure_key_ = 0; // cached printer-independent ordering key (see Vertex::structure_key)
+        size_t label_key_ = 0; // cached ordering key including line labels (see Vertex::label_key)
 
         mutable std::mutex mtx_; // mutex for thread safety
         mutable vertex_vector all_vert_; // all vertices from linkages (mutable to allow for lazy evaluation)
         mutable vertex_vector link_vector_; // all non-intermediate vertices from linkages
         mutable linkage_vector permutations_; // all permutations of the linkage
 
+        /// accounting of the cached vectors against max_cache_bytes_ (guarded by cache_mtx_)
+        mutable size_t cache_bytes_ = 0; // bytes held by the cached vectors of this linkage
+        mutable std::atomic<bool> in_cache_{false}; // whether the linkage is in the cache list
+        mutable std::atomic<bool> cache_used_{false}; // whether the cache was used since it was stored or last checked
+        mutable std::list<const Linkage*>::iterator cache_pos_; // position in the cache list
+
+        static inline std::mutex cache_mtx_; // mutex for the cache list
+        static inline std::list<const Linkage*> cache_list_; // linkages with cached vectors (most recently stored first)
+        static inline size_t cache_total_bytes_ = 0; // bytes held by all cached vectors
+
+        /**
+         * estimate the bytes held by the cached vectors (caller must hold mtx_)
+         * @return bytes held by all_vert_, link_vector_ and permutations_
+         */
+        size_t cached_bytes() const;
+
+        /**
+         * update the bytes held by the cached vectors of this linkage and evict the caches of the least
+         * recently stored linkages while all caches exceed max_cache_bytes_ (must not hold any mtx_)
+         */
+        void account_cache() const;
+
     public:
         long id_ = -1; // id of the linkage (default to -1 if not set)
         bool addition_ = false; // whether the linkage is an addition; else it is a contraction
@@ -220,7 +246,7 @@ namespace pdaggerq {
         /**
          * Destructor
          */
-        ~Linkage() override = default;
+        ~Linkage() override;
 
         /**
          * Copy constructor
@@ -402,6 +428,15 @@ namespace pdaggerq {
          */
          static inline bool cache_elements_ = true; // whether to cache/store the vertices and permutations of the linkage (mutable to allow for lazy evaluation)
          static inline size_t cache_depth_ = 16; // max permutations to cache/store. beyond this depth, permutations will not be cached and will be regenerated each time (mutable to allow for lazy evaluation)
+
+        /**
+         * limit on the bytes held by the cached vertices and permutations of all linkages
+         * (-1 for no limit). Caches are evicted in order of storage, skipping caches that were used since.
+         */
+        static inline size_t max_cache_bytes_ = static_cast<size_t>(-1l);
+        static inline std::atomic<size_t> cache_hits_{0}, cache_misses_{0}, cache_evictions_{0}; // statistics (with a limit)
+        static bool cache_bounded() { return max_cache_bytes_ != static_cast<size_t>(-1l); }
+        static size_t cache_size() { std::lock_guard<std::mutex> lock(cache_mtx_); return cache_total_bytes_; }
         linkage_vector permutations(bool regenerate = false) const;
 
         /**
@@ -410,6 +445,16 @@ namespace pdaggerq {
          */
         LinkagePtr best_permutation() const;
 
+        /**
+         * Return the best binary contraction tree of the vertices in a product, found by dynamic programming
+         * over subsets of the vertices. Each subset keeps the cheapest tree by the same comparison
+         * best_permutation() uses, so the result is optimal over every tree, not only over permutations().
+         * Falls back to best_permutation() for additions, constants, or too many vertices.
+         * @return best contraction tree of the linkage
+         */
+        LinkagePtr best_contraction_tree() const;
+        static inline size_t max_contraction_tree_size_ = 12; // largest product searched by best_contraction_tree()
+
         /**
          * Return all subgraphs of the linkage
          * @param max_depth maximum depth of subgraphs returned
@@ -435,6 +480,19 @@ namespace pdaggerq {
 
         size_t cached_hash() const { return hash_; }
 
+        size_t structure_key() const override { return structure_key_; }
+        size_t label_key() const override { return label_key_; }
+
+        /**
+         * Canonical order of linkages: by label_key, then by the fully expanded string if the keys collide.
+         * Used wherever one of several equivalent linkages is chosen, so that the choice does not depend on
+         * the order in which they were found.
+         */
+        static bool canonical_less(const Linkage &a, const Linkage &b) {
+            if (a.label_key_ != b.label_key_) return a.label_key_ < b.label_key_;
+            return a.tot_str(true) < b.tot_str(true);
+        }
+
         /**
          * Make a series of linkages from vertices into a single linkage
          * @param op_vec list of vertices
@@ -596,6 +654,9 @@ namespace pdaggerq {
     // define cast function from Vertex pointers to Linkage pointers
     static Linkage *as_link(Vertex *vertex) { return dynamic_cast<Linkage *>(vertex); }
 
+    // reference to a vertex that is known to be linked (as_link without copying the shared pointer)
+    static const Linkage &link_ref(const VertexPtr &vertex) { return static_cast<const Linkage &>(*vertex); }
+
 } // pdaggerq
 
 #endif //PDAGGERQ_linkage_H
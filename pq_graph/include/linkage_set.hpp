@@ -24,6 +24,7 @@
 #ifndef PDAGGERQ_LINKAGE_SET_HPP
 #define PDAGGERQ_LINKAGE_SET_HPP
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <functional>
 #include <unordered_set>
@@ -60,27 +61,99 @@ namespace pdaggerq {
     // struct for parallel linkage set operations with deterministic iteration order
     class linkage_set {
 
-        mutable std::mutex mtx_; // mutex for thread-safe mutations
         typedef std::unordered_set<LinkagePtr, LinkageHash, LinkageEqual> linkage_container;
-        linkage_container linkages_; // hash set for O(1) dedup/lookup
+
+        // linkages are spread over shards by hash, so that threads inserting into the same set rarely
+        // wait on each other and merges and differences can work on all shards in parallel
+        static constexpr size_t num_shards_ = 64;
+        static constexpr size_t parallel_size_ = 4096; // smallest set worth processing in parallel
+        struct shard {
+            mutable std::mutex mtx_; // mutex for thread-safe mutations of this shard
+            linkage_container linkages_; // hash set for O(1) dedup/lookup
+        };
+        std::array<shard, num_shards_> shards_;
+        std::atomic<size_t> size_{0}; // number of linkages in all shards (kept with each change of a shard)
+
+        mutable std::mutex sort_mtx_; // mutex for rebuilding sorted_
         mutable linkage_vector sorted_; // sorted cache for deterministic iteration
         mutable std::atomic<bool> dirty_{false}; // true when sorted_ needs rebuilding
 
-        // rebuilds sorted_ from linkages_; caller must hold mtx_
+        static size_t shard_index(const LinkagePtr &linkage) {
+            // use the high bits of the mixed hash; the containers use the low bits for their buckets
+            return (linkage->cached_hash() * 0x9E3779B97F4A7C15ull) >> 58;
+        }
+        shard &shard_of(const LinkagePtr &linkage) { return shards_[shard_index(linkage)]; }
+        const shard &shard_of(const LinkagePtr &linkage) const { return shards_[shard_index(linkage)]; }
+
+        // account for a shard that changed from `before` to `after` linkages; caller holds the shard's mtx_
+        void resize_(size_t before, size_t after) {
+            if (after > before) size_.fetch_add(after - before, std::memory_order_relaxed);
+            else size_.fetch_sub(before - after, std::memory_order_relaxed);
+        }
+
+        // apply a function to each pair of matching shards, in parallel for large sets. Caller holds no locks.
+        template<typename F>
+        void for_each_shard(const linkage_set &other, F &&f) {
+            bool run_parallel = size() + other.size() >= parallel_size_;
+#pragma omp parallel for schedule(dynamic) if(run_parallel) default(none) shared(other, f)
+            for (size_t s = 0; s < num_shards_; ++s) {
+                linkage_container &linkages = shards_[s].linkages_;
+                if (this == &other) {
+                    std::lock_guard<std::mutex> lock(shards_[s].mtx_);
+                    size_t before = linkages.size();
+                    f(linkages, linkages);
+                    resize_(before, linkages.size());
+                } else {
+                    std::scoped_lock lock(shards_[s].mtx_, other.shards_[s].mtx_);
+                    size_t before = linkages.size();
+                    f(linkages, other.shards_[s].linkages_);
+                    resize_(before, linkages.size());
+                }
+            }
+        }
+
+        // rebuilds sorted_ from the shards; caller must hold sort_mtx_
         void do_sort_() const {
-            sorted_.clear();
-            sorted_.reserve(linkages_.size());
-            for (const auto &link : linkages_)
-                sorted_.push_back(link);
-            std::sort(sorted_.begin(), sorted_.end(), [](const LinkagePtr &a, const LinkagePtr &b) {
+            // order by the cached structural key; the name is only compared if two keys collide
+            auto by_key = [](const LinkagePtr &a, const LinkagePtr &b) {
+                size_t ka = a->structure_key(), kb = b->structure_key();
+                if (ka != kb) return ka < kb;
                 return a->base_name() < b->base_name();
-            });
+            };
+
+            // sort each shard in parallel
+            std::array<size_t, num_shards_ + 1> offsets{};
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::lock_guard<std::mutex> lock(shards_[s].mtx_);
+                offsets[s + 1] = offsets[s] + shards_[s].linkages_.size();
+            }
+            sorted_.assign(offsets[num_shards_], nullptr);
+
+            bool run_parallel = sorted_.size() >= parallel_size_;
+#pragma omp parallel for schedule(dynamic) if(run_parallel) default(none) shared(offsets, by_key)
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::lock_guard<std::mutex> lock(shards_[s].mtx_);
+                auto out = sorted_.begin() + (long) offsets[s];
+                std::copy(shards_[s].linkages_.begin(), shards_[s].linkages_.end(), out);
+                std::sort(out, sorted_.begin() + (long) offsets[s + 1], by_key);
+            }
+
+            // merge neighbouring runs until one is left (the runs of each round are merged in parallel)
+            for (size_t width = 1; width < num_shards_; width *= 2) {
+#pragma omp parallel for schedule(dynamic) if(run_parallel) default(none) shared(offsets, by_key, width)
+                for (size_t s = 0; s < num_shards_; s += 2 * width) {
+                    if (s + width >= num_shards_) continue;
+                    size_t last = std::min(s + 2 * width, num_shards_);
+                    std::inplace_merge(sorted_.begin() + (long) offsets[s], sorted_.begin() + (long) offsets[s + width],
+                                       sorted_.begin() + (long) offsets[last], by_key);
+                }
+            }
             dirty_.store(false, std::memory_order_release);
         }
 
-        // acquires mtx_ and rebuilds sorted_ if dirty
+        // acquires sort_mtx_ and rebuilds sorted_ if dirty
         void rebuild_sorted_() const {
-            std::lock_guard<std::mutex> lock(mtx_);
+            std::lock_guard<std::mutex> lock(sort_mtx_);
             if (!dirty_.load(std::memory_order_relaxed)) return;
             do_sort_();
         }
@@ -90,43 +163,60 @@ namespace pdaggerq {
         // only in their generic labels collide, and a plain unordered_set keeps whichever
         // was inserted FIRST -- which, under the parallel candidate generation, depends on
         // thread scheduling and makes the surviving labeling (and thus the generated code)
-        // nondeterministic. Keeping the lexicographically-smallest tot_str makes the survivor
-        // order-independent. Returns true if the set changed. Caller must hold mtx_.
-        bool insert_canonical_(const LinkagePtr &lk) {
-            auto result = linkages_.insert(lk);
+        // nondeterministic. Keeping the first in Linkage::canonical_less (a cached, printer-independent
+        // key of the labelled structure, then the fully expanded string) makes the survivor
+        // order-independent. Returns true if the set changed. Caller must hold the shard's mtx_.
+        static bool insert_canonical_(linkage_container &linkages, const LinkagePtr &lk) {
+            auto result = linkages.insert(lk);
             if (result.second) return true;
-            if (lk->tot_str(true) < (*result.first)->tot_str(true)) {
-                linkages_.erase(result.first);
-                linkages_.insert(lk);
+            if (Linkage::canonical_less(*lk, **result.first)) {
+                linkages.erase(result.first);
+                linkages.insert(lk);
                 return true;
             }
             return false;
         }
 
+        void copy_shards(const linkage_set &other) {
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::lock_guard<std::mutex> lock(other.shards_[s].mtx_);
+                shards_[s].linkages_ = other.shards_[s].linkages_;
+                size_.fetch_add(shards_[s].linkages_.size(), std::memory_order_relaxed);
+            }
+        }
+
     public:
         typedef linkage_vector::const_iterator const_iterator;
 
-        linkage_set() : linkages_(256) {}
+        linkage_set() = default;
 
-        explicit linkage_set(size_t size) : linkages_(size) {}
+        explicit linkage_set(size_t size) { reserve(size); }
 
         linkage_set(const linkage_set &other){
-            std::lock_guard<std::mutex> lock(other.mtx_);
-            linkages_ = other.linkages_;
+            copy_shards(other);
             dirty_.store(true, std::memory_order_relaxed);
         }
 
         linkage_set(linkage_set &&other) noexcept {
-            std::lock_guard<std::mutex> lock(other.mtx_);
-            linkages_ = std::move(other.linkages_);
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::lock_guard<std::mutex> lock(other.shards_[s].mtx_);
+                shards_[s].linkages_ = std::move(other.shards_[s].linkages_);
+                other.shards_[s].linkages_.clear();
+            }
+            size_.store(other.size_.exchange(0));
+            std::lock_guard<std::mutex> lock(other.sort_mtx_);
             sorted_ = std::move(other.sorted_);
             dirty_.store(other.dirty_.load(std::memory_order_relaxed), std::memory_order_relaxed);
         }
 
         linkage_set &operator=(const linkage_set &other){
             if (this == &other) return *this;
-            std::scoped_lock lock(mtx_, other.mtx_);
-            linkages_ = other.linkages_;
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::scoped_lock lock(shards_[s].mtx_, other.shards_[s].mtx_);
+                resize_(shards_[s].linkages_.size(), other.shards_[s].linkages_.size());
+                shards_[s].linkages_ = other.shards_[s].linkages_;
+            }
+            std::lock_guard<std::mutex> lock(sort_mtx_);
             sorted_.clear();
             dirty_.store(true, std::memory_order_relaxed);
             return *this;
@@ -134,8 +224,13 @@ namespace pdaggerq {
 
         linkage_set &operator=(linkage_set &&other) noexcept{
             if (this == &other) return *this;
-            std::scoped_lock lock(mtx_, other.mtx_);
-            linkages_ = std::move(other.linkages_);
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::scoped_lock lock(shards_[s].mtx_, other.shards_[s].mtx_);
+                shards_[s].linkages_ = std::move(other.shards_[s].linkages_);
+                other.shards_[s].linkages_.clear();
+            }
+            size_.store(other.size_.exchange(0));
+            std::scoped_lock lock(sort_mtx_, other.sort_mtx_);
             sorted_ = std::move(other.sorted_);
             dirty_.store(other.dirty_.load(std::memory_order_relaxed), std::memory_order_relaxed);
             return *this;
@@ -144,63 +239,81 @@ namespace pdaggerq {
         ~linkage_set() = default;
 
         auto insert(const VertexPtr &linkage) {
-            std::lock_guard<std::mutex> lock(mtx_);
             auto lk = as_link(linkage);
+            shard &sh = shard_of(lk);
+            std::lock_guard<std::mutex> lock(sh.mtx_);
             // capture result BEFORE any canonical swap so the returned iterator stays valid
-            auto result = linkages_.insert(lk);
+            auto result = sh.linkages_.insert(lk);
             if (result.second) {
+                size_.fetch_add(1, std::memory_order_relaxed);
                 dirty_.store(true, std::memory_order_release);
-            } else if (lk->tot_str(true) < (*result.first)->tot_str(true)) {
-                linkages_.erase(result.first);
-                result.first = linkages_.insert(lk).first;
+            } else if (Linkage::canonical_less(*lk, **result.first)) {
+                sh.linkages_.erase(result.first);
+                result.first = sh.linkages_.insert(lk).first;
                 dirty_.store(true, std::memory_order_release);
             }
             return result;
         }
 
         void insert(const typename linkage_vector::const_iterator &begin, const typename linkage_vector::const_iterator &end) {
-            std::lock_guard<std::mutex> lock(mtx_);
             bool changed = false;
-            for (auto it = begin; it != end; ++it) changed |= insert_canonical_(*it);
+            for (auto it = begin; it != end; ++it) {
+                shard &sh = shard_of(*it);
+                std::lock_guard<std::mutex> lock(sh.mtx_);
+                size_t before = sh.linkages_.size();
+                changed |= insert_canonical_(sh.linkages_, *it);
+                resize_(before, sh.linkages_.size());
+            }
             if (changed) dirty_.store(true, std::memory_order_release);
         }
         void insert(const typename vertex_vector::const_iterator &begin, const typename vertex_vector::const_iterator &end) {
-            std::lock_guard<std::mutex> lock(mtx_);
             bool changed = false;
-            for (auto it = begin; it != end; ++it) changed |= insert_canonical_(as_link(*it));
+            for (auto it = begin; it != end; ++it) {
+                LinkagePtr lk = as_link(*it);
+                shard &sh = shard_of(lk);
+                std::lock_guard<std::mutex> lock(sh.mtx_);
+                size_t before = sh.linkages_.size();
+                changed |= insert_canonical_(sh.linkages_, lk);
+                resize_(before, sh.linkages_.size());
+            }
             if (changed) dirty_.store(true, std::memory_order_release);
         }
 
         size_t count(const LinkagePtr &linkage) const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            return linkages_.count(linkage);
+            const shard &sh = shard_of(linkage);
+            std::lock_guard<std::mutex> lock(sh.mtx_);
+            return sh.linkages_.count(linkage);
         }
 
         bool contains(const LinkagePtr &linkage) const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            return linkages_.count(linkage) > 0;
+            return count(linkage) > 0;
         }
 
+        // number of linkages, without locking the shards (exact once concurrent changes are done)
         size_t size() const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            return linkages_.size();
+            return size_.load(std::memory_order_relaxed);
         }
 
         void clear() {
-            std::lock_guard<std::mutex> lock(mtx_);
-            linkages_.clear();
+            for (auto &sh : shards_) {
+                std::lock_guard<std::mutex> lock(sh.mtx_);
+                resize_(sh.linkages_.size(), 0);
+                sh.linkages_.clear();
+            }
+            std::lock_guard<std::mutex> lock(sort_mtx_);
             sorted_.clear();
             dirty_.store(false, std::memory_order_relaxed);
         }
 
         void reserve(size_t n_ops) {
-            std::lock_guard<std::mutex> lock(mtx_);
-            linkages_.reserve(n_ops);
+            for (auto &sh : shards_) {
+                std::lock_guard<std::mutex> lock(sh.mtx_);
+                sh.linkages_.reserve(n_ops / num_shards_ + 1);
+            }
         }
 
         bool empty() const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            return linkages_.empty();
+            return size() == 0;
         }
 
         const_iterator begin() const {
@@ -217,13 +330,10 @@ namespace pdaggerq {
 
         // find element in sorted iteration order; only use in serial/critical contexts
         const_iterator find(const LinkagePtr &linkage) const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            if (dirty_.load(std::memory_order_relaxed))
-                do_sort_();
-            if (linkages_.count(linkage) == 0)
-                return sorted_.cend();
+            if (count(linkage) == 0)
+                return end();
             LinkageEqual eq;
-            return std::find_if(sorted_.cbegin(), sorted_.cend(),
+            return std::find_if(begin(), end(),
                 [&](const LinkagePtr &elem) { return eq(elem, linkage); });
         }
 
@@ -243,51 +353,62 @@ namespace pdaggerq {
         }
 
         linkage_set operator+(const linkage_set &other) const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            linkage_set new_set;
-            new_set.linkages_ = linkages_;
-            for (const auto &linkage: other.linkages_) new_set.linkages_.insert(linkage);
-            new_set.dirty_.store(true, std::memory_order_relaxed);
+            linkage_set new_set(*this);
+            new_set.for_each_shard(other, [](linkage_container &linkages, const linkage_container &other_linkages) {
+                for (const auto &linkage: other_linkages) linkages.insert(linkage);
+            });
             return new_set;
         }
 
         linkage_set operator-(const linkage_set &other) const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            linkage_set new_set;
-            new_set.linkages_ = linkages_;
-            for (const auto &linkage: other.linkages_) {
-                new_set.linkages_.erase(linkage);
-            }
-            new_set.dirty_.store(true, std::memory_order_relaxed);
+            linkage_set new_set(*this);
+            new_set -= other;
             return new_set;
         }
 
         linkage_set &operator+=(const linkage_set &other) {
-            std::scoped_lock lock(mtx_, other.mtx_);
-            bool changed = false;
-            for (const auto &lk : other.linkages_) changed |= insert_canonical_(lk);
+            if (this == &other) return *this;
+            std::atomic<bool> changed{false};
+            for_each_shard(other, [&changed](linkage_container &linkages, const linkage_container &other_linkages) {
+                bool shard_changed = false;
+                for (const auto &lk : other_linkages) shard_changed |= insert_canonical_(linkages, lk);
+                if (shard_changed) changed.store(true, std::memory_order_relaxed);
+            });
             if (changed) dirty_.store(true, std::memory_order_release);
             return *this;
         }
 
         linkage_set &operator-=(const linkage_set &other) {
-            std::lock_guard<std::mutex> lock(mtx_);
-            for (const auto &linkage: other.linkages_)
-                linkages_.erase(linkage);
+            if (this == &other) {
+                clear();
+                return *this;
+            }
+            for_each_shard(other, [](linkage_container &linkages, const linkage_container &other_linkages) {
+                if (linkages.empty()) return;
+                for (const auto &linkage: other_linkages)
+                    linkages.erase(linkage);
+            });
             dirty_.store(true, std::memory_order_release);
             return *this;
         }
 
         size_t erase(const LinkagePtr &linkage) {
-            std::lock_guard<std::mutex> lock(mtx_);
-            size_t result = linkages_.erase(linkage);
-            if (result > 0) dirty_.store(true, std::memory_order_release);
+            shard &sh = shard_of(linkage);
+            std::lock_guard<std::mutex> lock(sh.mtx_);
+            size_t result = sh.linkages_.erase(linkage);
+            if (result > 0) {
+                size_.fetch_sub(result, std::memory_order_relaxed);
+                dirty_.store(true, std::memory_order_release);
+            }
             return result;
         }
 
         bool operator==(const linkage_set &other) const {
-            std::lock_guard<std::mutex> lock(mtx_);
-            return linkages_ == other.linkages_;
+            for (size_t s = 0; s < num_shards_; ++s) {
+                std::scoped_lock lock(shards_[s].mtx_, other.shards_[s].mtx_);
+                if (shards_[s].linkages_ != other.shards_[s].linkages_) return false;
+            }
+            return true;
         }
 
     }; // class linkage_set
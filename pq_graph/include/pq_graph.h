@@ -30,6 +30,7 @@
 #pragma GCC diagnostic pop
 
 
+#include <chrono>
 #include <string>
 #include <vector>
 #include <fstream>
@@ -41,8 +42,13 @@
 
 using std::ofstream;
 
+namespace pq_runtime { class Tensor; } // dense tensors of the runtime (runtime/pq_runtime.hpp)
+
 namespace pdaggerq {
 
+    /// tensors of the equations by name and block ("" for a tensor without blocks)
+    typedef map<string, map<string, pq_runtime::Tensor>> tensor_map;
+
     class PQGraph; // forward declaration
     class PQGraph {
         map<string, Equation> equations_; // equations to be optimized
@@ -127,9 +133,43 @@ namespace pdaggerq {
         bool batched_ = false;
         size_t batch_size_ = 10; // number of substitutions to apply in each batch
 
+        /**
+         * whether to keep the queue of candidate substitutions between passes
+         *   false (default): every candidate is tested again after each substitution (exact greedy selection)
+         *   true: only the best queued candidate is tested again, until it stays the best. Much faster,
+         *         but may pick a different candidate when a substitution makes another one more beneficial.
+         */
+        bool lazy_greedy_ = false;
+
+        /**
+         * number of substitution sequences kept by the beam search
+         *   1 (default): greedy substitution
+         *   k > 1: branch on the k best candidates of each kept graph and keep the k graphs
+         *          with the best scaling after a lookahead of beam_depth_ greedy substitutions.
+         */
+        size_t beam_width_ = 1;
+        size_t beam_depth_ = 2; // number of greedy substitutions to look ahead when ranking beams
+
+        size_t max_subs_ = static_cast<size_t>(-1l); // maximum number of substitutions in a call to substitute
+        size_t skip_best_ = 0; // number of best candidates to skip for the first substitution
+        size_t num_subs_made_ = 0; // number of substitutions made by the last call to substitute
+
         /// maximum number of temporary rhs (-1 for no limit by overflow)
         size_t max_temps_ = static_cast<size_t>(-1l);
 
+        /**
+         * limits on the substitutions made by optimize(). Once reached, optimize() stops substituting,
+         * cleans up the equations and keeps the intermediates found so far. The time budget covers all
+         * passes of optimize(); the rounds of the scalar pass do not count towards max_rounds_.
+         */
+        double time_budget_ = -1; // maximum time in seconds (-1 for no limit)
+        size_t max_rounds_ = static_cast<size_t>(-1l); // maximum number of intermediate substitution rounds (-1 for no limit)
+
+        std::chrono::steady_clock::time_point optimize_start_{}; // start of optimize() (zero outside of it)
+        size_t num_rounds_ = 0; // number of intermediate substitution rounds made by optimize()
+        vector<pair<string, size_t>> pass_rounds_; // substitution rounds made by each pass of optimize()
+        string stop_reason_; // limit that stopped the substitutions early (empty if none)
+
         /// whether to decompose ERIs into their Cholesky or density-fitted form
         bool decompose_eri_ = false;
 
@@ -139,6 +179,9 @@ namespace pdaggerq {
         /// whether the equations have any sigma vectors
         bool has_sigma_vecs_ = false;
 
+        /// dependency graph of the statements of the last printed output
+        mutable vector<pair<string, vector<size_t>>> dependency_graph_;
+
     public:
 
         // default constructor
@@ -262,12 +305,48 @@ namespace pdaggerq {
          */
         void substitute(bool format_sigma, bool only_scalars);
 
+        /**
+         * check if the time budget of optimize() has run out
+         * @return true if the time budget is exceeded
+         */
+        bool past_deadline() const;
+
+        /**
+         * check if optimize() should stop substituting (records the limit that was reached)
+         * @param count_rounds whether the maximum number of rounds applies (not to the scalar pass)
+         * @return true if the time budget or the maximum number of rounds is exceeded
+         */
+        bool out_of_budget(bool count_rounds);
+
+        /**
+         * Substitute common linkages with a beam search over substitution sequences
+         * @param format_sigma whether to only substitute intermediates without sigma vectors
+         */
+        void beam_substitute(bool format_sigma);
+
+        /**
+         * Test a candidate intermediate in all equations
+         * @param orig_linkage candidate linkage
+         * @param cache results of the last test of the candidate (updated)
+         * @param ignore_linkages linkages that are not tested
+         * @param ignores collects candidates that can never be substituted
+         * @param format_sigma whether to only substitute intermediates without sigma vectors
+         * @param only_scalars whether to only substitute scalar intermediates
+         * @param allow_equality allow equality of scaling
+         * @return scaling of the graph after the substitution with the linkage to substitute (null if none was made)
+         */
+        pair<pair<scaling_map, scaling_map>, MutableLinkagePtr> test_candidate(
+                const LinkagePtr &orig_linkage, substitution_cache &cache, const linkage_set &ignore_linkages,
+                linkage_vector &ignores, bool format_sigma, bool only_scalars, bool allow_equality);
+
 
         /**
          * collect all possible linkages from all equations (remove none)
          * @param recompute whether to recompute all linkages or just the ones in modified terms
+         * @param max_depth maximum depth of the linkages (Term::max_depth_ is only read, since the branches
+         *                  of the beam search generate linkages concurrently)
          */
-        void make_all_links(bool recompute);
+        void make_all_links(bool recompute, size_t max_depth);
 
         /**
          * Forget the linkage history within all linkages to free memory from lazy evaluation
@@ -295,6 +374,23 @@ namespace pdaggerq {
          */
         void write_dot(std::string &filepath);
 
+        /**
+         * dependency graph of the statements that evaluate the equations (as grouped into tasks)
+         * @param print_type type of print (c++ or python)
+         * @return printed code of each statement in evaluation order, with the statements it depends on
+         */
+        vector<pair<string, vector<size_t>>> dependency_graph(const string &print_type) const;
+
+        /**
+         * evaluate the equations in memory with the kernels of the tensor runtime (without printing code).
+         * Intermediates are computed before their first use and freed after their last use.
+         * @param inputs tensors of the rhs by name and block (e.g. eri["oovv"], t1[""])
+         * @param conditions terms with a condition set to false are skipped (all terms are evaluated by default)
+         * @param row_major whether the input and output tensors are stored with the last index fastest
+         * @return tensors of the lhs of each equation by name and block
+         */
+        tensor_map evaluate(const tensor_map &inputs, const map<string, bool> &conditions = {}, bool row_major = false) const;
+
         /**
          * adds a tmp to saved_linkages_ and adds to equations
          * @param precon tmp to add
@@ -323,6 +419,20 @@ namespace pdaggerq {
          */
         size_t prune(bool keep_single_use = true);
 
+        /**
+         * replace temps by their contractions in all terms and remove their declarations
+         * @param to_remove temps to remove (their declarations must have a null lhs)
+         * @param title line printed before the removed temps
+         */
+        void remove_temps(const linkage_set &to_remove, const string &title);
+
+        /**
+         * remove the temps above max_shape that cannot be built and used in batches (Term::batch_lines),
+         * e.g. because a later substitution made one of their uses build another temp
+         * @return number of temps removed
+         */
+        size_t expand_unbatchable();
+
         /**
          * reindex the intermediates in the equations
          */
@@ -1,6 +1,9 @@
 #pragma once
+#include <map>
 #include "code_printer.h"
 
+using std::map;
+
 namespace pdaggerq {
 
 class BLASPrinter final : public CodePrinter {
@@ -19,7 +22,7 @@ public:
 
     string allocate(const string& name)             const override;
     string deallocate(const string& name)           const override;
-    string perm_delete(const string& name)          const override { return deallocate(name); }
+    string perm_delete(const string& name)          const override { return ""; } // freed with its scratch scope
     string condition_open(const set<string>& conds) const override { return ""; }
 
     string format_name(const Vertex* v)              const override;
@@ -35,16 +38,61 @@ public:
         const VertexPtr& right) const override { return left->str() + " + " + right->str(); }
 
     string format_declarations(const set<string>& names) const override;
+
+    // Pooled intermediates are acquired from and returned to their buffer instead of calloc/free.
+    void   assign_buffers(const BufferPlan& plan) const override { buffers_ = plan; }
+    string pool_buffer(const string& temp) const override { return c_pool_buffer(buffers_, scratch_prefix(), temp); }
+    string format_buffer_pool()    const override { return c_buffer_pool(buffers_, scratch_prefix()); }
+    string format_buffer_release() const override { return c_buffer_release(buffers_, scratch_prefix(), padding(1)); }
+
+    // The temporaries of a term (binarized and permuted intermediates) live in a block around its statements.
+    string scratch_scope(const vector<pair<string, line_vector>>& temps, const string& statements) const override {
+        return c_scratch_scope(*this, temps, statements);
+    }
+
+    // With the task_parallel option, the statements of an output run as OpenMP tasks.
+    string task_region_open()  const override { return c_task_region_open(padding(1)); }
+    string task_region_close() const override { return c_task_region_close(padding(1)); }
+    string format_task(const vector<string>& lines, const TaskDepends& depends) const override {
+        return c_task(lines, depends, padding(2), padding(1));
+    }
+
+    // Intermediates above max_shape are built and used one slice at a time in a batch loop.
+    string batch_open(const string& temp, const line_vector& lines) const override {
+        return c_batch_open(*this, temp, lines);
+    }
+    string batch_size(const string& temp, const line_vector& slice) const override {
+        return c_batch_size(*this, temp, slice);
+    }
+    string batch_reset(const string& temp) const override { return c_batch_reset(temp); }
+    string batch_close() const override { return "}"; }
+
     string format_term(const Term& t) const override;
 
     string dim_name(char type) const override;
 
     string scratch_prefix(char type = 't') const override { return "work_"; }
 
+    // Choose the stored index order of every intermediate so that as many
+    // binary contractions as possible map onto a transpose-free DGEMM.
+    void plan(const vector<const Term*>& terms) const override;
+
+    // Lines of a tensor in the order it is stored (the planned layout for intermediates).
+    line_vector stored_lines(const VertexPtr& v) const;
+
 private:
     BLASPrinter() = default;
 
     string dgemm_call(const Term& t) const;
+
+    // Stored lines of a tensor of a term. In a batch loop, the lines it fixes are labelled by their
+    // loop variable; the batched intermediate stores one slice without them.
+    line_vector term_lines(const Term& t, const VertexPtr& v) const;
+
+    // planned layout of each intermediate: stored position -> position in its lines
+    mutable map<string, vector<size_t>> layouts_;
+
+    mutable BufferPlan buffers_; // buffer pool of the output being printed
 };
 
 } // namespace pdaggerq
@@ -28,17 +28,47 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include <utility>
 
 #include "../term.h"
 
 using std::string;
 using std::vector;
 using std::set;
+using std::map;
+using std::pair;
 
 namespace pdaggerq {
 
+// Assignment of intermediates to a pool of reusable buffers. Intermediates whose
+// live ranges (allocation to last use) do not overlap share a buffer.
+struct BufferPlan {
+    map<string, size_t> buffer_of;        // intermediate name -> buffer index
+    vector<vector<string>> occupants;     // intermediates of each buffer, in order of allocation
+    vector<double> capacity;              // estimated elements of each buffer
+
+    double live_peak = 0;   // estimated peak elements of all live intermediates
+    double pool_size = 0;   // estimated elements of all buffers
+    double nocc = 0, nvirt = 0; // dimension sizes of the estimate
+
+    bool empty() const { return occupants.empty(); }
+};
+
+// Tensors touched by a statement that runs as a task, by kind of access. Accumulations
+// into the same tensor commute, so they only exclude each other (mutexinoutset).
+struct TaskDepends {
+    set<string> in;     // read
+    set<string> out;    // (re)initialized without being read
+    set<string> inout;  // read and written
+    set<string> mutex;  // accumulated into
+
+    bool empty() const { return in.empty() && out.empty() && inout.empty() && mutex.empty(); }
+};
+
 // Abstract syntax backend — one instance per output language.
-// All methods are stateless; concrete classes are singletons.
+// All methods are stateless apart from plan() and assign_buffers(), which let a
+// backend record choices for the output being printed; concrete classes are singletons.
 class CodePrinter {
 public:
     virtual ~CodePrinter() = default;
@@ -78,6 +108,41 @@ public:
     // Format a complete term into a target language specific syntax.
     virtual string format_term(const Term& t) const;
 
+    // Called with every term of an output before any of them is formatted.
+    virtual void plan(const vector<const Term*>& terms) const {}
+
+    // Called with the buffer pool of an output before its allocations are formatted
+    // (an empty plan allocates every intermediate on its own).
+    virtual void assign_buffers(const BufferPlan& plan) const {}
+
+    // Name of the pool buffer that temp is acquired from and returned to ("" if it is not pooled).
+    virtual string pool_buffer(const string& temp) const { return ""; }
+
+    // Emit the declarations of the buffer pool and its release after the last use.
+    virtual string format_buffer_pool()    const { return ""; }
+    virtual string format_buffer_release() const { return ""; }
+
+    // Open a loop over batch lines (labelled by their loop variables) in which temp is built and used
+    // one slice at a time; size sets the size of temp to one slice (before it is allocated), and reset
+    // zeroes the slice. Backends that cannot batch return "".
+    virtual string batch_open(const string& temp, const line_vector& lines) const { return ""; }
+    virtual string batch_size(const string& temp, const line_vector& slice) const { return ""; }
+    virtual string batch_reset(const string& temp) const { return ""; }
+    virtual string batch_close() const { return ""; }
+
+    // Wrap the statements of a single term in the scope of the temporaries it creates (its binarized and
+    // permuted intermediates, by name and lines). Backends that manage memory declare, allocate and free
+    // them here; the others assign them like any tensor and return the statements unchanged.
+    virtual string scratch_scope(const vector<pair<string, line_vector>>& temps, const string& statements) const {
+        return statements;
+    }
+
+    // Open and close the region in which the statements of an output run as concurrent tasks, and wrap
+    // the lines of one statement in a task. Backends without a task-parallel schedule return "".
+    virtual string task_region_open()  const { return ""; }
+    virtual string task_region_close() const { return ""; }
+    virtual string format_task(const vector<string>& lines, const TaskDepends& depends) const { return ""; }
+
     // ── Structural formatters ───────────────────────────────────────────
 
     // Emit declaration lines for a set of base names.
@@ -111,6 +176,41 @@ public:
     // Wrap a raw term string with padding and newline continuations.
     virtual string format_term_line(const string& term_str, int indent) const;
 };
+
+// ── Buffer pool statements shared by the C backends (blas, loop) ────────
+//
+// Pooled intermediates point into a buffer of the pool that grows to its
+// largest occupant on first use; releasing an intermediate keeps the buffer.
+
+// "" if the intermediate is not pooled
+string c_pool_buffer(const BufferPlan& plan, const string& prefix, const string& name);
+string c_pool_acquire(const BufferPlan& plan, const string& prefix, const string& name);
+string c_pool_release(const BufferPlan& plan, const string& prefix, const string& name);
+
+string c_buffer_pool(const BufferPlan& plan, const string& prefix);
+string c_buffer_release(const BufferPlan& plan, const string& prefix, const string& pad);
+
+// ── OpenMP tasks shared by the C backends (blas, loop) ─────────────────
+
+string c_task_region_open(const string& pad);
+string c_task_region_close(const string& pad);
+
+// ── Batch loops shared by the C backends (blas, loop) ──────────────────
+
+// loops over the batch lines that open the block of one slice; the size variable of a batched
+// intermediate is set to the elements of a slice before it is allocated
+string c_batch_open(const CodePrinter& printer, const string& temp, const line_vector& lines);
+string c_batch_size(const CodePrinter& printer, const string& temp, const line_vector& slice);
+string c_batch_reset(const string& temp);
+
+// ── Term temporaries shared by the C backends (blas, loop) ─────────────
+
+// a block that callocs each temporary (sized by the dim_name of its lines), runs the statements one level deeper and frees them
+string c_scratch_scope(const CodePrinter& printer, const vector<pair<string, line_vector>>& temps, const string& statements);
+
+// the task is padded with pad and its lines with pad + indent, as to_strings() of an Equation
+string c_task(const vector<string>& lines, const TaskDepends& depends, const string& pad, const string& indent);
+
 // The concrete printer implementations are now defined in separate headers
 // (tamm_printer.h and einsum_printer.h). They provide the actual formatting logic
 // for TAMM C++ code and Python einsum expressions, respectively.
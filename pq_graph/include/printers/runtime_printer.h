@@ -0,0 +1,27 @@
+#pragma once
+#include "tiledarray_printer.h"
+
+namespace pdaggerq {
+
+/**
+ * Printer for the header-only tensor runtime in pq_graph/runtime/pq_runtime.hpp.
+ * The runtime accepts the labelled-tensor syntax of TiledArray, so only storage management and
+ * declarations differ; the generated code compiles with the runtime header alone (plus BLAS, optionally).
+ */
+class RuntimePrinter final : public TiledArrayPrinter {
+public:
+    static const RuntimePrinter& instance() {
+        static RuntimePrinter inst;
+        return inst;
+    }
+
+    string deallocate(const string& name)  const override;
+    string perm_delete(const string& name) const override;
+
+    string format_declarations(const set<string>& names) const override;
+
+private:
+    RuntimePrinter() = default;
+};
+
+} // namespace pdaggerq
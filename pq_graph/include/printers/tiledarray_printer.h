@@ -3,7 +3,7 @@
 
 namespace pdaggerq {
 
-class TiledArrayPrinter final : public CodePrinter {
+class TiledArrayPrinter : public CodePrinter {
 public:
     static const TiledArrayPrinter& instance() {
         static TiledArrayPrinter inst;
@@ -26,7 +26,7 @@ public:
         const vertex_vector& operators,
         const line_vector&   output_lines) const override;
 
-private:
+protected:
     TiledArrayPrinter() = default;
 };
 
@@ -30,6 +30,7 @@
 #include <stdexcept>
 #include <clocale>
 #include <sstream>
+#include <cmath>
 
 #include "shape.hpp"
 
@@ -59,18 +60,20 @@ namespace pdaggerq {
 
     /**
      * Class to store a sorted map of number of virtuals and occupieds in a linkage paired with occurrence
-     * The map is sorted by (o + v)^2 + v
+     * The map is sorted by descending scaling (scale_metric). It is stored as a flat vector of pairs, since
+     * maps hold only a handful of shapes and are added, subtracted and compared far more often than searched.
      */
     struct scaling_map {
 
-        map<shape, long int, scale_metric> map_; // map of (v, o) to occurrence
+        typedef vector<pair<shape, long int>> container;
+        container map_; // sorted pairs of (v, o) and occurrence
 
         /**
          * Constructors
          */
         explicit scaling_map() = default;
         explicit scaling_map(const vector<shape>& shapes) {
-            for (const shape &shape : shapes) map_[shape]++;
+            for (const shape &shape : shapes) (*this)[shape]++;
         }
 
         scaling_map(const scaling_map &other) = default;
@@ -93,7 +96,10 @@ namespace pdaggerq {
          * @return reference to the occurrence of the shape
          */
         long int &operator[](const shape &vopair) {
-            return map_[vopair]; // add if not in map (default value is 0). return reference to value
+            auto it = position(vopair);
+            if (it == map_.end() || it->first != vopair)
+                it = map_.insert(it, {vopair, 0}); // add if not in map (default value is 0)
+            return it->second; // return reference to value
         }
 
         /**
@@ -102,14 +108,59 @@ namespace pdaggerq {
          * @return reference to the occurrence of the shape
          */
         const long int &operator[](const shape &vopair) const {
-            auto it = map_.find(vopair);
-            if (it == map_.end()){
+            auto it = position(vopair);
+            if (it == map_.end() || it->first != vopair){
                 static long int zero = 0;
                 return zero; // return 0 if not in map
             }
             return it->second; // return value if in map
         }
 
+        /**
+         * Get the position of a shape in the map, or of the first entry with a lower scaling
+         * @param vopair pair of virtuals and occupieds
+         * @return iterator to the position
+         */
+        container::iterator position(const shape &vopair) {
+            return std::lower_bound(map_.begin(), map_.end(), vopair, [](const auto &entry, const shape &scale) {
+                return scale_metric()(entry.first, scale);
+            });
+        }
+        container::const_iterator position(const shape &vopair) const {
+            return const_cast<scaling_map *>(this)->position(vopair);
+        }
+
+        /**
+         * Merge two sorted maps into a new map, adding the occurrences of other scaled by sign
+         * @param this_map first map
+         * @param other_map second map
+         * @param sign 1 to add the maps, -1 to subtract other_map
+         * @return merged map
+         */
+        static scaling_map merge(const scaling_map &this_map, const scaling_map &other_map, long int sign) {
+            scaling_map result;
+            result.map_.reserve(this_map.size() + other_map.size());
+
+            auto this_it = this_map.map_.begin(), this_end = this_map.map_.end();
+            auto other_it = other_map.map_.begin(), other_end = other_map.map_.end();
+            while (this_it != this_end && other_it != other_end) {
+                if (this_it->first == other_it->first) {
+                    result.map_.emplace_back(this_it->first, this_it->second + sign * other_it->second);
+                    ++this_it; ++other_it;
+                } else if (scale_metric()(this_it->first, other_it->first)) {
+                    result.map_.push_back(*this_it++);
+                } else {
+                    result.map_.emplace_back(other_it->first, sign * other_it->second);
+                    ++other_it;
+                }
+            }
+            result.map_.insert(result.map_.end(), this_it, this_end);
+            for (; other_it != other_end; ++other_it)
+                result.map_.emplace_back(other_it->first, sign * other_it->second);
+
+            return result;
+        }
+
         /**
          * Get begin iterator of the map
          * @return begin iterator
@@ -181,11 +232,25 @@ namespace pdaggerq {
          */
         void clear() { map_.clear(); }
 
+        /**
+         * Estimate the cost of the map from the dimension sizes (see shape::size)
+         * @return sum of the sizes of all shapes weighted by their occurrence
+         */
+        double cost() const {
+            double result = 0;
+            for (const auto &[scale, count]: map_)
+                result += (double) count * scale.size();
+            return result;
+        }
+
         /// initialize values for making comparison
         constexpr static int this_better = 1;
         constexpr static int this_same = 0;
         constexpr static int this_worse = -1;
 
+        /// compare maps by their estimated cost for the dimension sizes before their asymptotic scaling
+        static inline bool numeric_cost_ = false;
+
         /**
          * Compare scaling maps to determine best scaling term
          * @param this_map prior_links scaling map
@@ -197,9 +262,17 @@ namespace pdaggerq {
          *      If the first scaling in the map is the same, the second scaling is compared and so on.
          *      The first scaling that is different determines the winner.
          *      If all scaling is the same, the maps are considered equal and false is returned.
+         *      With numeric_cost_, the estimated costs are compared first and the scaling only breaks ties.
          */
         static int compare_scaling(const scaling_map& this_map, const scaling_map &other_map) {
 
+            if (numeric_cost_) {
+                double this_cost = this_map.cost(), other_cost = other_map.cost();
+                double tolerance = 1e-12 * std::max(std::fabs(this_cost), std::fabs(other_cost));
+                if (this_cost < other_cost - tolerance) return this_better;
+                if (this_cost > other_cost + tolerance) return this_worse;
+            }
+
             // initialize this_map iterators
             auto this_begin = this_map.begin();
             auto this_it = this_begin;
@@ -210,10 +283,6 @@ namespace pdaggerq {
             auto other_it = other_begin;
             auto other_end = other_map.end();
 
-            // check if either map is at the end
-            bool this_at_end = this_it == this_end;
-            bool other_at_end = other_it == other_end;
-
             // iterate over scaling maps
             do {
 
@@ -221,8 +290,13 @@ namespace pdaggerq {
                 while ( this_it !=  this_end &&  this_it->second == 0 ) this_it++;
                 while (other_it != other_end && other_it->second == 0 ) other_it++;
 
-                if ( this_at_end && !other_at_end) return this_better; // this is cheaper (other has more scalings)
-                if (!this_at_end &&  other_at_end) return this_worse; // this is more expensive (this has more scalings)
+                // check if either map is at the end
+                bool this_at_end = this_it == this_end;
+                bool other_at_end = other_it == other_end;
+
+                // the map with more scalings is more expensive, unless they occur a negative number of times
+                if ( this_at_end && !other_at_end) return other_it->second < 0 ? this_worse : this_better;
+                if (!this_at_end &&  other_at_end) return  this_it->second < 0 ? this_better : this_worse;
                 if (this_at_end  &&  other_at_end) return this_same; // this is the same (equal scalings)
 
                 // else compare current scaling
@@ -327,10 +401,7 @@ namespace pdaggerq {
          * @return new map with the sum of the two maps
          */
         scaling_map operator+(const scaling_map &other) const {
-            scaling_map result = *this;
-            for (const auto & [scale, count] : other.map_)
-                result[scale] += count; // add other map
-            return result;
+            return merge(*this, other, 1); // add other map
         }
 
         /**
@@ -339,11 +410,7 @@ namespace pdaggerq {
          * @return new map with the difference of the two maps
          */
         scaling_map operator-(const scaling_map &other) const {
-            scaling_map result = *this;
-            for (const auto & [scale, count] : other.map_)
-                result[scale] -= count; // subtract other map
-
-            return result;
+            return merge(*this, other, -1); // subtract other map
         }
 
         /**
@@ -352,8 +419,8 @@ namespace pdaggerq {
          * @return this map with the sum of the two maps
          */
         inline scaling_map& operator+=(const scaling_map &other) {
-            for (const auto & [scale, count] : other.map_)
-                map_[scale] += count; // add other map
+            if (!add_in_place(other, 1))
+                *this = merge(*this, other, 1); // add other map
             return *this;
         }
 
@@ -363,11 +430,36 @@ namespace pdaggerq {
          * @return this map with the difference of the two maps
          */
         inline scaling_map& operator-=(const scaling_map &other) {
-            for (const auto & [scale, count] : other.map_)
-                map_[scale] -= count; // subtract other map
+            if (!add_in_place(other, -1))
+                *this = merge(*this, other, -1); // subtract other map
             return *this;
         }
 
+        /**
+         * Add the occurrences of other scaled by sign without reallocating, if every shape of other is in this map
+         * @param other other scaling_map
+         * @param sign 1 to add, -1 to subtract
+         * @return true if the maps were added
+         */
+        bool add_in_place(const scaling_map &other, long int sign) {
+            if (other.size() > size()) return false;
+
+            // both maps are sorted, so every shape of other must appear in order
+            auto this_it = map_.begin(), this_end = map_.end();
+            for (const auto &[scale, count] : other.map_) {
+                while (this_it != this_end && this_it->first != scale) ++this_it;
+                if (this_it == this_end) return false;
+                ++this_it;
+            }
+
+            this_it = map_.begin();
+            for (const auto &[scale, count] : other.map_) {
+                while (this_it->first != scale) ++this_it;
+                (this_it++)->second += sign * count;
+            }
+            return true;
+        }
+
         /**
          * set any negative values to zero
          */
@@ -384,12 +476,7 @@ namespace pdaggerq {
             // create copies that ignore alpha/beta differences
             scaling_map no_spin_map;
             for (const auto & [scale, count] : map_) {
-                shape new_shape = scale;
-                new_shape.va_ = new_shape.v_; new_shape.oa_ = new_shape.o_;
-                new_shape.vb_ = 0; new_shape.ob_ = 0;
-
-                new_shape.a_ = new_shape.n_;
-                new_shape.b_ = 0;
+                shape new_shape(scale.o(), 0, scale.v(), 0, scale.L(), scale.Q());
                 no_spin_map[new_shape] += count;
             }
             return no_spin_map;
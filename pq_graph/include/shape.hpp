@@ -39,16 +39,38 @@ struct shape {
     static inline size_t nocc_  = 0;
     static inline size_t nvirt_ = 0;
 
-    uint_fast8_t n_ = 0; // number of lines
+    // optional dimension sizes for the cost estimate (0: derived from nocc_ and nvirt_).
+    // lines without spin are counted as beta lines.
+    static inline size_t nocc_a_  = 0, nocc_b_  = 0;
+    static inline size_t nvirt_a_ = 0, nvirt_b_ = 0;
+    static inline size_t naux_    = 0; // size of a density (Q) index
+    static inline size_t nroots_  = 10; // number of roots in a sigma-vector build (L index)
+
+    /// line counts packed into one word, one byte per lane. Sums like o() and a() are derived from the lanes,
+    /// so adding, copying and comparing shapes for equality are single integer operations.
+    enum lane : unsigned { oa_lane = 0, ob_lane, va_lane, vb_lane, L_lane, Q_lane, n_lane };
+    uint64_t bits_ = 0;
+
+    uint_fast8_t get(lane l) const { return (uint_fast8_t) (bits_ >> (8 * l)); }
+    void set(lane l, uint_fast8_t count) {
+        bits_ = (bits_ & ~(0xFFull << (8 * l))) | (uint64_t) (uint8_t) count << (8 * l);
+    }
+    void increment(lane l) { bits_ += 1ull << (8 * l); }
+    void decrement(lane l) { bits_ -= 1ull << (8 * l); }
+
+    uint_fast8_t n() const { return get(n_lane); } // number of lines
 
-    //TODO: split this into two variables (oa, ob, va, vb); use a function to get their sum.
-    uint_fast8_t oa_ = 0, ob_ = 0;
-    uint_fast8_t va_ = 0, vb_ = 0;
-    uint_fast8_t  o_ = 0,  v_ = 0;
-    uint_fast8_t  a_ = 0,  b_ = 0;
+    uint_fast8_t oa() const { return get(oa_lane); }
+    uint_fast8_t ob() const { return get(ob_lane); }
+    uint_fast8_t va() const { return get(va_lane); }
+    uint_fast8_t vb() const { return get(vb_lane); }
+    uint_fast8_t o() const { return (uint8_t) (oa() + ob()); }
+    uint_fast8_t v() const { return (uint8_t) (va() + vb()); }
+    uint_fast8_t a() const { return (uint8_t) (oa() + va()); }
+    uint_fast8_t b() const { return (uint8_t) (ob() + vb()); }
 
-    uint_fast8_t L_ = 0; // sigma index
-    uint_fast8_t Q_ = 0; // density index
+    uint_fast8_t L() const { return get(L_lane); } // sigma index
+    uint_fast8_t Q() const { return get(Q_lane); } // density index
 
 
     // default constructors and assignments
@@ -64,161 +86,147 @@ struct shape {
             *this += line;
     }
 
-    void operator+=(const shape & other) {
-        n_  += other.n_;
-        L_  += other.L_;
-        Q_  += other.Q_;
+    /**
+     * Construct a shape from its line counts
+     * @param oa number of alpha (or active) occupied lines
+     * @param ob number of beta (or unblocked) occupied lines
+     * @param va number of alpha (or active) virtual lines
+     * @param vb number of beta (or unblocked) virtual lines
+     * @param L number of sigma lines
+     * @param Q number of density lines
+     */
+    shape(uint_fast8_t oa, uint_fast8_t ob, uint_fast8_t va, uint_fast8_t vb, uint_fast8_t L = 0, uint_fast8_t Q = 0) {
+        set(oa_lane, oa); set(ob_lane, ob);
+        set(va_lane, va); set(vb_lane, vb);
+        set(L_lane, L); set(Q_lane, Q);
+        set(n_lane, oa + ob + va + vb + L + Q);
+    }
 
-        oa_ += other.oa_; ob_ += other.ob_;
-        va_ += other.va_; vb_ += other.vb_;
-        o_  = oa_ + ob_; v_  = va_ + vb_;
-        a_  = oa_ + va_; b_  = ob_ + vb_;
+    void operator+=(const shape & other) {
+        // lanes never carry into each other (a shape has far fewer than 256 lines)
+        bits_ += other.bits_;
     }
 
     void operator-=(const shape & other) {
-        oa_  = (oa_  < other.oa_)  ? 0 : oa_  - other.oa_;
-        ob_  = (ob_  < other.ob_)  ? 0 : ob_  - other.ob_;
-        va_  = (va_  < other.va_)  ? 0 : va_  - other.va_;
-        vb_  = (vb_  < other.vb_)  ? 0 : vb_  - other.vb_;
-
-        L_ = (L_ < other.L_) ? 0 : L_ - other.L_;
-        Q_ = (Q_ < other.Q_) ? 0 : Q_ - other.Q_;
-
-        o_ = oa_ + ob_; v_ = va_ + vb_;
-        a_ = oa_ + va_; b_ = ob_ + vb_;
-
-        n_ = (o_ + v_) + L_ + Q_;
+        // saturating subtraction of each count
+        for (lane l : {oa_lane, ob_lane, va_lane, vb_lane, L_lane, Q_lane}) {
+            uint_fast8_t count = get(l), other_count = other.get(l);
+            set(l, count < other_count ? 0 : count - other_count);
+        }
+        set(n_lane, (o() + v()) + L() + Q());
     }
 
     void operator+=(const pdaggerq::Line &line) {
-        ++n_; // increment number of lines
+        increment(n_lane); // increment number of lines
 
-        if (line.sig_) { ++L_; return; } // sigma
-        if (line.den_) { ++Q_; return; } // density
+        if (line.sig_) { increment(L_lane); return; } // sigma
+        if (line.den_) { increment(Q_lane); return; } // density
 
-        if (line.o_) { // occupied
-            if (line.a_) ++oa_;
-            else ++ob_; // default for no-spin is beta
-        } else { // virtual
-            if (line.a_) ++va_;
-            else ++vb_; // default for no-spin is beta
-        }
-        o_ = oa_ + ob_; v_ = va_ + vb_;
-        a_ = oa_ + va_; b_ = ob_ + vb_;
+        if (line.o_) increment(line.a_ ? oa_lane : ob_lane); // occupied (default for no-spin is beta)
+        else         increment(line.a_ ? va_lane : vb_lane); // virtual (default for no-spin is beta)
     }
     void operator-=(const pdaggerq::Line &line) {
-        if (n_ != 0) --n_; // decrement number of lines
+        if (n() != 0) decrement(n_lane); // decrement number of lines
         else return; // do nothing if no lines
 
-        if (line.sig_ && L_ != 0) { --L_; return; } // sigma
-        if (line.den_ && Q_ != 0) { --Q_; return; } // density
+        if (line.sig_ && L() != 0) { decrement(L_lane); return; } // sigma
+        if (line.den_ && Q() != 0) { decrement(Q_lane); return; } // density
 
-        if (line.o_ && o_ != 0) { // occupied
-            if (line.a_ && oa_ != 0) --oa_;
-            else if (ob_ != 0) --ob_; // default for no-spin is beta
-        } else if (v_ != 0) { // virtual
-            if (line.a_ && va_ != 0) --va_;
-            else if (vb_ != 0) --vb_; // default for no-spin is beta
+        if (line.o_ && o() != 0) { // occupied
+            if (line.a_ && oa() != 0) decrement(oa_lane);
+            else if (ob() != 0) decrement(ob_lane); // default for no-spin is beta
+        } else if (v() != 0) { // virtual
+            if (line.a_ && va() != 0) decrement(va_lane);
+            else if (vb() != 0) decrement(vb_lane); // default for no-spin is beta
         }
-        o_ = oa_ + ob_; v_ = va_ + vb_;
-        a_ = oa_ + va_; b_ = ob_ + vb_;
     }
 
     bool operator==(const shape & other) const {
-        return  n_ == other.n_
-            &&  a_ == other.a_  &&  b_ == other.b_
-            &&  o_ == other.o_  &&  v_ == other.v_
-            && oa_ == other.oa_ && ob_ == other.ob_
-            && va_ == other.va_ && vb_ == other.vb_
-            &&  L_ == other.L_  &&  Q_ == other.Q_;
+        return bits_ == other.bits_;
     }
     bool operator!=(const shape & other) const {
-        return !(*this == other);
+        return bits_ != other.bits_;
     }
 
     string str() const {
-        if (n_ == 0)
+        if (n() == 0)
             return "0"; // scalar contraction has no lines
 
         string result;
-        result.reserve(n_);
+        result.reserve(n());
 
         result += 'o';
-        result += std::to_string(o_);
+        result += std::to_string(o());
 
         result += 'v';
-        result += std::to_string(v_);
+        result += std::to_string(v());
 
-        if (L_ > 0) {
+        if (L() > 0) {
             result += 'L';
-            result += std::to_string(L_);
+            result += std::to_string(L());
         }
-        if (Q_ > 0) {
+        if (Q() > 0) {
             result += 'Q';
-            result += std::to_string(Q_);
+            result += std::to_string(Q());
         }
         return result;
     }
-    bool operator<(const shape &other) const {
+    /**
+     * Estimate the number of elements spanned by the lines of this shape from the dimension sizes
+     * @return product of the sizes of all lines (0 if nocc_ or nvirt_ is not set)
+     */
+    double size() const {
+        if (nocc_ == 0 || nvirt_ == 0) return 0;
 
-        if (nvirt_ != 0 && nocc_ != 0) {
-            // For non-zero numbers of virtual or occupied orbitals, use the below algorithm
-            double this_size  = std::pow(nocc_, o_) * std::pow(nvirt_, v_);
-            double other_size = std::pow(nocc_, other.o_) * std::pow(nvirt_, other.v_);
+        double noa = nocc_a_  ? nocc_a_  : nocc_, nob = nocc_b_  ? nocc_b_  : nocc_;
+        double nva = nvirt_a_ ? nvirt_a_ : nvirt_, nvb = nvirt_b_ ? nvirt_b_ : nvirt_;
+        double result = std::pow(noa, oa()) * std::pow(nob, ob()) * std::pow(nva, va()) * std::pow(nvb, vb());
 
-            // Cholesky vectors are typically ~5 times the number of basis functions, so we approximate the scaling accordingly
-            if (Q_ > 0) this_size *= std::pow(5*(nocc_ + nvirt_), Q_);
-            if (other.Q_ > 0) other_size *= std::pow(5*(nocc_ + nvirt_), other.Q_);
+        // Cholesky vectors are typically ~5 times the number of basis functions, so we approximate the scaling accordingly
+        if (Q() > 0) result *= std::pow(naux_ ? naux_ : 5*(nocc_ + nvirt_), Q());
 
-            // This contraction is repeated M times for each root and k times for each iteration
-            // we approximate k as 30 and assume M = 10 for the number of roots
-            size_t nroot = 10; // make this a user parameter?
-            if (L_ > 0) this_size *= 30 * std::pow(nroot, L_);
-            if (other.L_ > 0) other_size *= 30 * std::pow(nroot, other.L_);
+        // This contraction is repeated M times for each root and k times for each iteration
+        // we approximate k as 30
+        if (L() > 0) result *= 30 * std::pow(nroots_, L());
 
-            double diff = this_size - other_size;
-            if (std::fabs(diff) > 1e-8) return this_size < other_size;
-        }
-
-        // For arbitrary numbers of occupied and virtual orbitals, below algorithm is used
-
-        // Compare total scaling (L+Q+v+o)
-        uint_fast8_t total = n_, other_total = other.n_;
-        if (total != other_total) return total < other_total;
-
-        /// compare totals of properties
+        return result;
+    }
 
-        // disregard occupied lines (L+Q+v)
-        total -= o_, other_total -= other.o_;
-        if (total != other_total) return total < other_total;
+    /**
+     * Key for the asymptotic ordering of shapes. From the most significant byte: the total number of lines,
+     * the lines that are not occupied, the lines that are neither occupied nor virtual, the sigma lines, the
+     * density lines, then the beta virtual and beta occupied lines. The remaining counts follow from these.
+     */
+    uint64_t order_key() const {
+        uint8_t total = n(), no_occ = total - o(), no_vir = no_occ - v();
+        return (uint64_t) total << 48 | (uint64_t) no_occ << 40 | (uint64_t) no_vir << 32
+             | (uint64_t) L() << 24 | (uint64_t) Q() << 16 | (uint64_t) vb() << 8 | (uint64_t) ob();
+    }
 
-        // disregard virtual lines (L+Q)
-        total -= v_; other_total -= other.v_;
-        if (total != other_total) return total < other_total;
+    bool operator<(const shape &other) const {
+        if (bits_ == other.bits_) return false;
 
-        /// compare individual properties
-        if (L_ != other.L_) return L_ < other.L_;
-        if (Q_ != other.Q_) return Q_ < other.Q_;
-        if (v_ != other.v_) return v_ < other.v_;
-        if (o_ != other.o_) return o_ < other.o_;
+        if (nvirt_ != 0 && nocc_ != 0) {
+            // For non-zero numbers of virtual or occupied orbitals, use the below algorithm
+            double this_size  = size();
+            double other_size = other.size();
 
-        // Compare individual spin components (alpha spins will be considered first)
-        if (vb_ != other.vb_) return vb_ < other.vb_;
-        if (ob_ != other.ob_) return ob_ < other.ob_;
+            double diff = this_size - other_size;
+            if (std::fabs(diff) > 1e-12 * std::max(this_size, other_size)) return this_size < other_size;
+        }
 
-        // scaling is equal
-        return false;
+        // For arbitrary numbers of occupied and virtual orbitals, compare the total scaling (L+Q+v+o),
+        // then L+Q+v, L+Q, and the individual properties (alpha spins will be considered first)
+        return order_key() < other.order_key();
     }
     bool operator>( const shape & other) const {
         return other < *this;
     }
     bool operator<=(const shape & other) const {
-        if (*this == other) return true;
-        return *this < other;
+        return !(other < *this);
     }
     bool operator>=(const shape & other) const {
-        if (*this == other) return true;
-        return other < *this;
+        return !(*this < other);
     }
 
     shape operator+(const shape & other) const {
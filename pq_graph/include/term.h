@@ -75,12 +75,18 @@ namespace pdaggerq {
         bool generated_linkages_ = false; // flag for if term has generated linkages (default is false)
         bool is_assignment_ = false; // true if the term is an assignment (default is false, using +=)
         string print_override_; // string to override print function
+        map<string, string> batch_labels_; // labels fixed by an enclosing batch loop -> loop variable
+        string batch_temp_; // intermediate stored as one slice per iteration of the enclosing batch loop
         static inline bool print_comments_ = true; // print comments in term string
         static inline bool deallocate_ = true; // deallocate temporary variables
+        static inline bool buffer_pool_ = true; // share buffers between temporaries with disjoint lifetimes
+        static inline bool task_parallel_ = false; // evaluate independent statements as concurrent tasks
         static inline bool binarize_ = false; // flag for whether to binarize terms
 
         static inline size_t max_depth_ = -1; // maximum number of rhs in a linkage (no limit by default)
         static inline shape max_shape_; // maximum shape of a linkage
+        static inline size_t max_batch_lines_ = 0; // lines an intermediate above max_shape_ may be batched over
+        static inline size_t loop_tile_ = 32; // tile size of virtual loops in contractions of the loop printer (0: no tiling)
 
         typedef map<string, vector<string>> condition_map;
         static inline condition_map mapped_conditions_{}; // map of conditionals to their relevant operators
@@ -100,6 +106,11 @@ namespace pdaggerq {
         void expand_rhs(const VertexPtr &term_link); // expand rhs of term using a linkage
         void expand_rhs(){ expand_rhs(term_linkage()); } // uses term_linkage
 
+        /**
+         * merge constant operands of the rhs into the coefficient and drop empty vertices
+         */
+        void merge_constants();
+
         /**
          * Constructor
          * @param name name of the assignment vertex
@@ -427,6 +438,13 @@ namespace pdaggerq {
          */
         string str() const;
 
+        /**
+         * Create string representation of the term, numbering its binarized intermediates from count
+         * @param count number of the next intermediate; nested terms continue it so that names do not collide
+         * @return string representation of the term
+         */
+        string str(int &count) const;
+
         string operator+(const string &other) const{ return str() + other; }
         friend string operator+(const string &other, const Term &term){ return other + term.str(); }
         friend ostream &operator<<(ostream &os, const Term &term){
@@ -478,8 +496,29 @@ namespace pdaggerq {
 
         /**
          * collect all possible linkages from all equations
+         * @param max_depth maximum depth of the linkages
+         */
+        linkage_set make_all_links(size_t max_depth) const;
+
+        /**
+         * Choose lines of an intermediate to batch over, such that one slice of the intermediate is within
+         * max_shape_. Virtual lines are batched over first; at most max_batch_lines_ are chosen.
+         * @param lines external lines of the intermediate
+         * @param candidates lines that may be batched over (external lines of every use of the intermediate)
+         * @return lines to batch over; empty if the intermediate is within max_shape_ or no choice fits
+         */
+        static line_vector choose_batch_lines(const line_vector &lines, const line_vector &candidates);
+
+        /**
+         * Choose lines to build and use an intermediate above max_shape_ in batches over. Each use must
+         * accumulate into an output (not a tmp) under the same conditions as the build, with the intermediate
+         * as an operand of its own (not within a product that is binarized); the batch lines are lines of the
+         * intermediate that are output lines of every use.
+         * @param build the term that builds the intermediate (its lhs)
+         * @param uses the terms that use the intermediate
+         * @return lines to batch over (of the lhs of build); empty if the intermediate cannot be batched
          */
-        linkage_set make_all_links() const;
+        static line_vector batch_lines(const Term &build, const vector<const Term *> &uses);
 
         /**
          * Get the ids of all intermediate vertices within the term
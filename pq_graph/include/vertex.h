@@ -447,6 +447,34 @@ namespace pdaggerq {
          */
         virtual bool equivalent(const Vertex &other) const;
 
+        /**
+         * Printer-independent ordering key of the vertex structure: the name, the kinds of lines and,
+         * for linkages, the shape of the tree. Line labels are ignored.
+         * @return structural key
+         */
+        virtual size_t structure_key() const;
+
+        /**
+         * Printer-independent ordering key that also encodes the line labels. Used to pick a canonical
+         * representative among structurally equal vertices.
+         * @return labelled key
+         */
+        virtual size_t label_key() const;
+
+        /**
+         * combine a value into a running ordering key
+         * @param seed the key so far
+         * @param value value to add
+         * @return new key
+         */
+        static constexpr size_t mix_key(size_t seed, size_t value) {
+            // splitmix64 finalizer, so the key depends on the order the values were added in
+            uint64_t x = seed ^ (value + 0x9E3779B97F4A7C15ull + (seed << 6) + (seed >> 2));
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+            return x ^ (x >> 31);
+        }
+
 
         /// virtual functions for inherited Linkage class (refer to linkage.h for more information
 
@@ -0,0 +1,561 @@
+//
+// pdaggerq - A code for bringing strings of creation / annihilation operators to normal order.
+// Filename: pq_runtime.hpp
+// Copyright (C) 2020 A. Eugene DePrince III
+//
+// Author: A. Eugene DePrince III <adeprince@fsu.edu>
+// Maintainer: DePrince group
+//
+// This file is part of the pdaggerq package.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#ifndef PDAGGERQ_PQ_RUNTIME_HPP
+#define PDAGGERQ_PQ_RUNTIME_HPP
+
+/**
+ * Header-only tensor runtime for the code of the "runtime" printer of pq_graph.
+ *
+ * Tensors are dense and stored in column-major order (the first index is the fastest). Equations are
+ * written with labelled tensors, as in
+ *
+ *     rt2("a,b,i,j") += 0.5 * eri["vvvv"]("a,b,c,d") * t2("c,d,i,j");
+ *
+ * Products are evaluated pairwise from the left, as printed. A contraction permutes its operands when
+ * needed and calls dgemm: from the BLAS library when PQ_RUNTIME_BLAS is defined (link against any BLAS),
+ * otherwise from a built-in kernel. Contractions that are not matrix products (e.g. with indices shared
+ * by both operands and the output) use a direct loop. All kernels are threaded with OpenMP if enabled.
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace pq_runtime {
+
+#ifdef PQ_RUNTIME_BLAS
+extern "C" void dgemm_(const char *transa, const char *transb, const int *m, const int *n, const int *k,
+                       const double *alpha, const double *a, const int *lda, const double *b, const int *ldb,
+                       const double *beta, double *c, const int *ldc);
+#endif
+
+class Tensor;
+class LabeledTensor;
+class Expr;
+
+using TensorMap = std::map<std::string, Tensor>;
+using ScalarMap = std::map<std::string, double>;
+using labels_t  = std::vector<std::string>;
+
+/// split "a,b,i,j" into its labels
+inline labels_t split_labels(const std::string &labels) {
+    labels_t out;
+    std::string label;
+    for (char c : labels) {
+        if (c == ',') { out.push_back(label); label.clear(); }
+        else if (c != ' ') label += c;
+    }
+    if (!label.empty() || !out.empty()) out.push_back(label);
+    return out;
+}
+
+/// dense tensor with column-major storage; a default-constructed tensor has no storage yet
+class Tensor {
+public:
+    Tensor() = default;
+    explicit Tensor(std::vector<size_t> dims, double value = 0.0) : dims_(std::move(dims)) {
+        data_.assign(elements(dims_), value);
+    }
+
+    /// tensor on storage that it does not own (e.g. an array of the caller); copies share the storage
+    static Tensor view(double *data, std::vector<size_t> dims) {
+        Tensor tensor;
+        tensor.dims_ = std::move(dims);
+        tensor.view_ = data;
+        return tensor;
+    }
+
+    static size_t elements(const std::vector<size_t> &dims) {
+        size_t n = 1;
+        for (size_t d : dims) n *= d;
+        return n;
+    }
+
+    const std::vector<size_t> &dims() const { return dims_; }
+    size_t rank() const { return dims_.size(); }
+    size_t size() const { return view_ ? elements(dims_) : data_.size(); }
+    bool allocated() const { return view_ || !data_.empty(); }
+
+    double *data() { return view_ ? view_ : data_.data(); }
+    const double *data() const { return view_ ? view_ : data_.data(); }
+    double &operator[](size_t i) { return data()[i]; }
+    double operator[](size_t i) const { return data()[i]; }
+
+    /// release the storage
+    void reset() { std::vector<double>().swap(data_); dims_.clear(); view_ = nullptr; }
+
+    /// set all elements to zero
+    void zero() { std::fill(data(), data() + size(), 0.0); }
+
+    /// label the indices for an expression
+    LabeledTensor operator()(const std::string &labels);
+
+private:
+    std::vector<size_t> dims_;
+    std::vector<double> data_;
+    double *view_ = nullptr; // storage of a view
+};
+
+// ── Kernels ─────────────────────────────────────────────────────────────────
+
+/// y = beta * y + alpha * x
+inline void accumulate(size_t n, double alpha, const double *x, double beta, double *y) {
+    if (beta == 0.0) {
+        #pragma omp parallel for simd schedule(static) if (n > 32768)
+        for (size_t i = 0; i < n; ++i) y[i] = alpha * x[i];
+    } else if (beta == 1.0) {
+        #pragma omp parallel for simd schedule(static) if (n > 32768)
+        for (size_t i = 0; i < n; ++i) y[i] += alpha * x[i];
+    } else {
+        #pragma omp parallel for simd schedule(static) if (n > 32768)
+        for (size_t i = 0; i < n; ++i) y[i] = beta * y[i] + alpha * x[i];
+    }
+}
+
+/// column-major C = beta * C + alpha * op(A) * op(B), with op(X) = X or X^T as for dgemm
+inline void gemm(char transa, char transb, size_t m, size_t n, size_t k, double alpha,
+                 const double *a, size_t lda, const double *b, size_t ldb, double beta, double *c, size_t ldc) {
+    if (m == 0 || n == 0) return;
+#ifdef PQ_RUNTIME_BLAS
+    int im = (int) m, in = (int) n, ik = (int) k, ilda = (int) std::max<size_t>(lda, 1),
+        ildb = (int) std::max<size_t>(ldb, 1), ildc = (int) std::max<size_t>(ldc, 1);
+    dgemm_(&transa, &transb, &im, &in, &ik, &alpha, a, &ilda, b, &ildb, &beta, c, &ildc);
+#else
+    // built-in kernel: transposed operands are copied, then columns of C are shared between threads
+    std::vector<double> at, bt;
+    if (transa == 'T') {
+        at.resize(m * k);
+        for (size_t p = 0; p < k; ++p)
+            for (size_t i = 0; i < m; ++i) at[i + p * m] = a[p + i * lda];
+        a = at.data(); lda = m;
+    }
+    if (transb == 'T') {
+        bt.resize(k * n);
+        for (size_t j = 0; j < n; ++j)
+            for (size_t p = 0; p < k; ++p) bt[p + j * k] = b[j + p * ldb];
+        b = bt.data(); ldb = k;
+    }
+
+    const size_t kb = 256; // block of the inner dimension kept in cache
+    #pragma omp parallel for schedule(static) if (m * n * k > 32768)
+    for (size_t j = 0; j < n; ++j) {
+        double *cj = c + j * ldc;
+        if (beta == 0.0) std::fill(cj, cj + m, 0.0);
+        else if (beta != 1.0) for (size_t i = 0; i < m; ++i) cj[i] *= beta;
+        for (size_t p0 = 0; p0 < k; p0 += kb) {
+            size_t p1 = std::min(k, p0 + kb);
+            for (size_t p = p0; p < p1; ++p) {
+                double bpj = alpha * b[p + j * ldb];
+                const double *ap = a + p * lda;
+                #pragma omp simd
+                for (size_t i = 0; i < m; ++i) cj[i] += ap[i] * bpj;
+            }
+        }
+    }
+#endif
+}
+
+namespace detail {
+
+    inline size_t position(const labels_t &labels, const std::string &label) {
+        return (size_t) (std::find(labels.begin(), labels.end(), label) - labels.begin());
+    }
+
+    inline bool contains(const labels_t &labels, const std::string &label) {
+        return position(labels, label) < labels.size();
+    }
+
+    inline bool distinct(const labels_t &labels) {
+        for (size_t i = 0; i < labels.size(); ++i)
+            for (size_t j = i + 1; j < labels.size(); ++j)
+                if (labels[i] == labels[j]) return false;
+        return true;
+    }
+
+    /// dimension of each label in the operands (which must agree)
+    inline std::map<std::string, size_t> label_dims(const std::vector<std::pair<const Tensor *, labels_t>> &operands) {
+        std::map<std::string, size_t> dims;
+        for (const auto &[tensor, labels] : operands) {
+            if (labels.size() != tensor->rank())
+                throw std::invalid_argument("pq_runtime: labels do not match the rank of a tensor");
+            for (size_t p = 0; p < labels.size(); ++p) {
+                auto [it, inserted] = dims.emplace(labels[p], tensor->dims()[p]);
+                if (!inserted && it->second != tensor->dims()[p])
+                    throw std::invalid_argument("pq_runtime: dimensions of label " + labels[p] + " do not match");
+            }
+        }
+        return dims;
+    }
+
+    /// stride of each label in a tensor (summed over repeated labels; 0 if absent)
+    inline std::vector<size_t> strides(const Tensor &tensor, const labels_t &labels, const labels_t &loop) {
+        std::vector<size_t> out(loop.size(), 0);
+        size_t stride = 1;
+        for (size_t p = 0; p < labels.size(); ++p) {
+            out[position(loop, labels[p])] += stride;
+            stride *= tensor.dims()[p];
+        }
+        return out;
+    }
+
+} // namespace detail
+
+/// dst(dst_labels) = beta * dst + alpha * src(src_labels), with dst allocated and the same labels in any order
+inline void permute(double alpha, const Tensor &src, const labels_t &src_labels,
+                    double beta, Tensor &dst, const labels_t &dst_labels) {
+    if (src_labels == dst_labels) {
+        accumulate(dst.size(), alpha, src.data(), beta, dst.data());
+        return;
+    }
+
+    // the first index of dst is contiguous: loop over it innermost for each of the outer indices
+    const size_t rank = dst_labels.size();
+    std::vector<size_t> src_stride = detail::strides(src, src_labels, dst_labels);
+    const size_t inner = dst.dims()[0], stride0 = src_stride[0];
+    const size_t outer = dst.size() / std::max<size_t>(inner, 1);
+
+    #pragma omp parallel for schedule(static) if (dst.size() > 32768)
+    for (size_t o = 0; o < outer; ++o) {
+        size_t rem = o, offset = 0;
+        for (size_t p = 1; p < rank; ++p) {
+            offset += (rem % dst.dims()[p]) * src_stride[p];
+            rem /= dst.dims()[p];
+        }
+        const double *s = src.data() + offset;
+        double *d = dst.data() + o * inner;
+        if (beta == 0.0) {
+            #pragma omp simd
+            for (size_t i = 0; i < inner; ++i) d[i] = alpha * s[i * stride0];
+        } else {
+            #pragma omp simd
+            for (size_t i = 0; i < inner; ++i) d[i] = beta * d[i] + alpha * s[i * stride0];
+        }
+    }
+}
+
+/// contraction by direct loops over the elements of C and the summed labels (any labels)
+inline void contract_loops(double alpha, const Tensor &a, const labels_t &la, const Tensor &b, const labels_t &lb,
+                           double beta, Tensor &c, const labels_t &lc, const std::map<std::string, size_t> &dims) {
+    labels_t summed;
+    for (const labels_t *labels : {&la, &lb})
+        for (const std::string &l : *labels)
+            if (!detail::contains(lc, l) && !detail::contains(summed, l)) summed.push_back(l);
+
+    labels_t loop;
+    for (const std::string &l : lc)
+        if (!detail::contains(loop, l)) loop.push_back(l);
+    const size_t nfree = loop.size();
+    loop.insert(loop.end(), summed.begin(), summed.end());
+
+    std::vector<size_t> extent(loop.size());
+    for (size_t p = 0; p < loop.size(); ++p) extent[p] = dims.at(loop[p]);
+    std::vector<size_t> sa = detail::strides(a, la, loop), sb = detail::strides(b, lb, loop), sc = detail::strides(c, lc, loop);
+
+    size_t nsum = 1, nout = 1;
+    for (size_t p = 0; p < loop.size(); ++p) (p < nfree ? nout : nsum) *= extent[p];
+
+    const double *ad = a.data(), *bd = b.data();
+    double *cd = c.data();
+    #pragma omp parallel for schedule(static) if (nout * nsum > 32768)
+    for (size_t o = 0; o < nout; ++o) {
+        size_t rem = o, oa = 0, ob = 0, oc = 0;
+        for (size_t p = 0; p < nfree; ++p) {
+            size_t i = rem % extent[p];
+            rem /= extent[p];
+            oa += i * sa[p]; ob += i * sb[p]; oc += i * sc[p];
+        }
+        double sum = 0.0;
+        for (size_t s = 0; s < nsum; ++s) {
+            size_t srem = s, sa_off = oa, sb_off = ob;
+            for (size_t p = nfree; p < loop.size(); ++p) {
+                size_t i = srem % extent[p];
+                srem /= extent[p];
+                sa_off += i * sa[p]; sb_off += i * sb[p];
+            }
+            sum += ad[sa_off] * bd[sb_off];
+        }
+        cd[oc] = (beta == 0.0 ? 0.0 : beta * cd[oc]) + alpha * sum;
+    }
+}
+
+/**
+ * c(lc) = beta * c + alpha * a(la) * b(lb), summing over the labels that are not in lc.
+ * c is allocated from the dimensions of a and b if it has no storage.
+ * Matrix products (every label in exactly two of a, b and c) are evaluated with gemm; the operands are
+ * permuted to matrices only if their labels are not already ordered as one.
+ */
+inline void contract(double alpha, const Tensor &a, const labels_t &la, const Tensor &b, const labels_t &lb,
+                     double beta, Tensor &c, const labels_t &lc) {
+    std::map<std::string, size_t> dims = detail::label_dims({{&a, la}, {&b, lb}});
+    if (!c.allocated()) {
+        std::vector<size_t> cdims;
+        for (const std::string &l : lc) {
+            if (!dims.count(l)) throw std::invalid_argument("pq_runtime: output label " + l + " is not in the operands");
+            cdims.push_back(dims[l]);
+        }
+        c = Tensor(cdims);
+        beta = 0.0;
+    }
+    detail::label_dims({{&a, la}, {&b, lb}, {&c, lc}});
+
+    // labels of the matrix product: m (a and c), n (b and c), k (a and b)
+    labels_t m, n, k;
+    bool matrix = detail::distinct(la) && detail::distinct(lb) && detail::distinct(lc);
+    for (const std::string &l : lc) {
+        bool in_a = detail::contains(la, l), in_b = detail::contains(lb, l);
+        if (in_a == in_b) matrix = false; // batch or broadcast label
+        else (in_a ? m : n).push_back(l);
+    }
+    for (const std::string &l : la) {
+        if (detail::contains(lc, l)) continue;
+        if (detail::contains(lb, l)) k.push_back(l);
+        else matrix = false; // summed over a alone
+    }
+    for (const std::string &l : lb)
+        if (!detail::contains(lc, l) && !detail::contains(la, l)) matrix = false;
+
+    if (!matrix) {
+        contract_loops(alpha, a, la, b, lb, beta, c, lc, dims);
+        return;
+    }
+
+    // c is [m n] or [n m]; in the latter case, compute c^T = b^T a^T with the roles of a and b swapped
+    labels_t mn = m, nm = n;
+    mn.insert(mn.end(), n.begin(), n.end());
+    nm.insert(nm.end(), m.begin(), m.end());
+    if (lc != mn && lc == nm) {
+        contract(alpha, b, lb, a, la, beta, c, lc);
+        return;
+    }
+
+    size_t M = 1, N = 1, K = 1;
+    for (const std::string &l : m) M *= dims[l];
+    for (const std::string &l : n) N *= dims[l];
+    for (const std::string &l : k) K *= dims[l];
+
+    // operands as matrices: use them in place if their labels are ordered as [m k], [k m], [k n] or [n k]
+    auto as_matrix = [&dims](const Tensor &x, const labels_t &lx, const labels_t &rows, const labels_t &cols,
+                             Tensor &copy, char &trans, const double *&data, size_t &ld) {
+        labels_t rc = rows, cr = cols;
+        rc.insert(rc.end(), cols.begin(), cols.end());
+        cr.insert(cr.end(), rows.begin(), rows.end());
+        size_t nrows = 1;
+        for (const std::string &l : rows) nrows *= dims.at(l);
+        size_t ncols = x.size() / std::max<size_t>(nrows, 1);
+        if (lx == rc) { trans = 'N'; data = x.data(); ld = nrows; return; }
+        if (lx == cr) { trans = 'T'; data = x.data(); ld = ncols; return; }
+        std::vector<size_t> cdims;
+        for (const std::string &l : rc) cdims.push_back(dims.at(l));
+        copy = Tensor(cdims);
+        permute(1.0, x, lx, 0.0, copy, rc);
+        trans = 'N'; data = copy.data(); ld = nrows;
+    };
+
+    // the order of k follows a where it can be used in place
+    labels_t ka = k;
+    std::sort(ka.begin(), ka.end(), [&la](const std::string &x, const std::string &y) {
+        return detail::position(la, x) < detail::position(la, y);
+    });
+
+    Tensor acopy, bcopy;
+    char ta, tb;
+    const double *ad, *bd;
+    size_t lda, ldb;
+    as_matrix(a, la, m, ka, acopy, ta, ad, lda);
+    as_matrix(b, lb, ka, n, bcopy, tb, bd, ldb);
+
+    if (lc == mn) {
+        gemm(ta, tb, M, N, K, alpha, ad, lda, bd, ldb, beta, c.data(), M);
+    } else {
+        Tensor product({M * N});
+        gemm(ta, tb, M, N, K, 1.0, ad, lda, bd, ldb, 0.0, product.data(), M);
+        std::vector<size_t> pdims;
+        for (const std::string &l : mn) pdims.push_back(dims[l]);
+        Tensor shaped(pdims);
+        std::copy(product.data(), product.data() + product.size(), shaped.data());
+        permute(alpha, shaped, mn, beta, c, lc);
+    }
+}
+
+// ── Expressions ─────────────────────────────────────────────────────────────
+
+/// scaled tensor, product or sum of labelled tensors; evaluated when assigned to a labelled tensor
+class Expr {
+public:
+    enum Kind { leaf, product, sum };
+
+    Kind kind = leaf;
+    double scale = 1.0;
+    Tensor *tensor = nullptr; // leaf
+    labels_t labels;          // leaf
+    std::shared_ptr<const Expr> left, right;
+
+    /// all labels of the leaves
+    labels_t all_labels() const {
+        if (kind == leaf) return labels;
+        labels_t out = left->all_labels();
+        for (const std::string &l : right->all_labels())
+            if (!detail::contains(out, l)) out.push_back(l);
+        return out;
+    }
+};
+
+inline Expr combine(Expr::Kind kind, const Expr &x, const Expr &y) {
+    Expr e;
+    e.kind = kind;
+    e.left = std::make_shared<const Expr>(x);
+    e.right = std::make_shared<const Expr>(y);
+    return e;
+}
+
+inline Expr operator*(const Expr &x, const Expr &y) { return combine(Expr::product, x, y); }
+inline Expr operator+(const Expr &x, const Expr &y) { return combine(Expr::sum, x, y); }
+inline Expr operator*(double s, const Expr &x) { Expr e = x; e.scale *= s; return e; }
+inline Expr operator*(const Expr &x, double s) { return s * x; }
+inline Expr operator-(const Expr &x) { return -1.0 * x; }
+inline Expr operator-(const Expr &x, const Expr &y) { return x + (-y); }
+
+namespace detail {
+
+    /// evaluated expression: a tensor (owned or not) with its labels and a scale
+    struct Value {
+        std::shared_ptr<Tensor> owned;
+        const Tensor *tensor = nullptr;
+        labels_t labels;
+        double scale = 1.0;
+    };
+
+    /**
+     * Evaluate an expression, keeping the labels that are needed outside of it (the others are summed).
+     * @param e expression
+     * @param needed labels of the output and of the other operands
+     */
+    inline Value evaluate(const Expr &e, const labels_t &needed) {
+        Value v;
+        if (e.kind == Expr::leaf) {
+            if (!e.tensor->allocated() && e.tensor->rank() == 0 && !e.labels.empty())
+                throw std::invalid_argument("pq_runtime: a tensor in an expression has no storage");
+            v.tensor = e.tensor;
+            v.labels = e.labels;
+            v.scale = e.scale;
+            return v;
+        }
+
+        // the operands of a product keep the labels they share; the terms of a sum only keep those needed outside
+        // of it (a label of one term may be summed within another)
+        labels_t left_needed = needed, right_needed = needed;
+        if (e.kind == Expr::product) {
+            for (const std::string &l : e.right->all_labels()) left_needed.push_back(l);
+            for (const std::string &l : e.left->all_labels()) right_needed.push_back(l);
+        }
+        Value x = evaluate(*e.left, left_needed), y = evaluate(*e.right, right_needed);
+
+        v.owned = std::make_shared<Tensor>();
+        v.tensor = v.owned.get();
+        if (e.kind == Expr::product) {
+            for (const labels_t *labels : {&x.labels, &y.labels})
+                for (const std::string &l : *labels)
+                    if (contains(needed, l) && !contains(v.labels, l)) v.labels.push_back(l);
+            contract(e.scale * x.scale * y.scale, *x.tensor, x.labels, *y.tensor, y.labels, 0.0, *v.owned, v.labels);
+        } else {
+            if (x.labels.size() != y.labels.size())
+                throw std::invalid_argument("pq_runtime: terms of a sum have different labels");
+            *v.owned = Tensor(x.tensor->dims());
+            v.labels = x.labels;
+            accumulate(v.owned->size(), e.scale * x.scale, x.tensor->data(), 0.0, v.owned->data());
+            permute(e.scale * y.scale, *y.tensor, y.labels, 1.0, *v.owned, v.labels);
+        }
+        return v;
+    }
+
+    /// dst(labels) = beta * dst + e
+    inline void assign(Tensor &dst, const labels_t &labels, const Expr &e, double beta) {
+        if (e.kind == Expr::product) {
+            // contract the operands directly into the output
+            Value x = evaluate(*e.left, [&] { labels_t l = labels; for (auto &r : e.right->all_labels()) l.push_back(r); return l; }());
+            Value y = evaluate(*e.right, [&] { labels_t l = labels; for (auto &r : e.left->all_labels()) l.push_back(r); return l; }());
+            contract(e.scale * x.scale * y.scale, *x.tensor, x.labels, *y.tensor, y.labels, beta, dst, labels);
+            return;
+        }
+
+        Value v = evaluate(e, labels);
+        if (!dst.allocated()) {
+            std::vector<size_t> dims;
+            for (const std::string &l : labels)
+                dims.push_back(v.tensor->dims()[position(v.labels, l)]);
+            dst = Tensor(dims);
+            beta = 0.0;
+        }
+        permute(v.scale, *v.tensor, v.labels, beta, dst, labels);
+    }
+
+} // namespace detail
+
+/// tensor with labelled indices, the target of an assignment or a leaf of an expression
+class LabeledTensor {
+public:
+    LabeledTensor(Tensor &tensor, labels_t labels) : tensor_(tensor), labels_(std::move(labels)) {}
+
+    operator Expr() const {
+        Expr e;
+        e.tensor = &tensor_;
+        e.labels = labels_;
+        return e;
+    }
+
+    LabeledTensor &operator=(const Expr &e)  { detail::assign(tensor_, labels_, e, 0.0); return *this; }
+    LabeledTensor &operator+=(const Expr &e) { detail::assign(tensor_, labels_, e, 1.0); return *this; }
+    LabeledTensor &operator-=(const Expr &e) { detail::assign(tensor_, labels_, -e, 1.0); return *this; }
+    LabeledTensor &operator=(const LabeledTensor &other) { return *this = Expr(other); }
+
+private:
+    Tensor &tensor_;
+    labels_t labels_;
+};
+
+inline LabeledTensor Tensor::operator()(const std::string &labels) {
+    return {*this, split_labels(labels)};
+}
+
+inline Expr operator*(const LabeledTensor &x, const LabeledTensor &y) { return Expr(x) * Expr(y); }
+inline Expr operator+(const LabeledTensor &x, const LabeledTensor &y) { return Expr(x) + Expr(y); }
+inline Expr operator-(const LabeledTensor &x, const LabeledTensor &y) { return Expr(x) - Expr(y); }
+inline Expr operator*(double s, const LabeledTensor &x) { return s * Expr(x); }
+inline Expr operator*(const LabeledTensor &x, double s) { return s * Expr(x); }
+inline Expr operator-(const LabeledTensor &x) { return -Expr(x); }
+
+/// full contraction of two expressions with the same labels
+inline double dot(const Expr &x, const Expr &y) {
+    Tensor result;
+    detail::assign(result, {}, x * y, 0.0);
+    return result[0];
+}
+
+} // namespace pq_runtime
+
+#endif // PDAGGERQ_PQ_RUNTIME_HPP
@@ -133,7 +133,100 @@ size_t PQGraph::prune(bool keep_single_use) {
         to_remove.insert(temp);
     }
 
-    // remove all terms with lhs set to nullptr if any are found
+    remove_temps(to_remove, "Removing unused temps:");
+
+    // get all terms in the equations
+    vector<Term*> all_terms; all_terms.reserve(10*equations_.size());
+    for (auto &[name, eq]: equations_) {
+        for (auto &term: eq.terms()) {
+            all_terms.push_back(&term);
+        }
+    }
+
+    if (opt_level_ >= 6) {
+        for (Term *term_ptr: all_terms) {
+            Term &term = *term_ptr;
+            // factor the term linkage
+            MutableLinkagePtr term_link = as_link(term.term_linkage()->shallow());
+            if (!term_link->is_temp()) continue;
+            else term_link->factor();
+
+            term.expand_rhs(term_link);
+            term.reorder(true);
+        }
+    }
+
+    size_t num_removed_total = num_removed;
+    while (num_removed > 0) {
+        num_removed = prune(keep_single_use); // recursively prune until no more temps are removed
+        num_removed_total += num_removed;
+    }
+
+    return num_removed_total;
+}
+
+size_t PQGraph::expand_unbatchable() {
+
+    if (Term::max_batch_lines_ == 0)
+        return 0; // temps above max_shape are only made to be batched
+
+    print_guard guard;
+    if (print_level_ < 2) {
+        guard.lock();
+    }
+
+    vector<Term*> all_terms;
+    for (auto &[name, eq]: equations_) {
+        for (auto &term: eq.terms()) {
+            all_terms.push_back(&term);
+        }
+    }
+
+    // get the temps above max_shape by their type and id
+    map<pair<string, long>, LinkagePtr> oversized;
+    for (Term *term: all_terms) {
+        if (!term->lhs()->is_temp() || !(term->lhs()->shape_ > Term::max_shape_)) continue;
+        LinkagePtr temp = as_link(term->lhs());
+        oversized.emplace(make_pair(temp->type(), temp->id()), temp);
+    }
+
+    // a temp is kept if it has one build and all of its uses can be batched. the uses may have changed since the
+    // temp was made: a later substitution can move one into the build of another temp.
+    linkage_set to_remove;
+    for (const auto &[key, temp]: oversized) {
+        const Term *build = nullptr;
+        size_t num_builds = 0;
+        vector<const Term*> uses;
+        for (const Term *term: all_terms) {
+            if (term->lhs()->same_temp(temp)) {
+                build = term;
+                ++num_builds;
+            } else if (term->term_ids(temp->type()).count(temp->id()))
+                uses.push_back(term);
+        }
+        if (num_builds == 1 && !Term::batch_lines(*build, uses).empty()) continue;
+        to_remove.insert(temp);
+    }
+    if (to_remove.empty()) return 0;
+
+    // mark the declarations for removal
+    for (Term *term: all_terms) {
+        if (!term->lhs()->is_temp()) continue;
+        for (const auto &temp: to_remove) {
+            if (term->lhs()->same_temp(temp)) {
+                term->lhs() = nullptr;
+                break;
+            }
+        }
+    }
+
+    remove_temps(to_remove, "Removing temps above max_shape that cannot be built in batches:");
+    return to_remove.size();
+}
+
+void PQGraph::remove_temps(const linkage_set &to_remove, const string &title) {
+
+    // remove the declarations of the temps, which the caller marked with a null lhs
     vector<string> eq_keys_for_removal = get_equation_keys();
 #pragma omp parallel for schedule(guided) default(none) shared(equations_, eq_keys_for_removal)
     for (const auto &name : eq_keys_for_removal) {
@@ -163,7 +256,7 @@ size_t PQGraph::prune(bool keep_single_use) {
         }
     }
 
-    if (num_removed > 0) {
+    if (!to_remove.empty()) {
 
         // sort to_remove by decreasing id
         linkage_vector sorted_to_remove;
@@ -190,7 +283,7 @@ size_t PQGraph::prune(bool keep_single_use) {
             return make_pair(vertex, made_replacement);
         };
 
-        cout << "Removing unused temps:" << endl;
+        cout << title << endl;
         for (auto & temp : sorted_to_remove) {
             cout << "    " << temp->str() << endl;
         }
@@ -262,27 +355,6 @@ size_t PQGraph::prune(bool keep_single_use) {
         // overwrite saved_linkages
         cout << endl; // print newline after all removals
     }
-
-    if (opt_level_ >= 6) {
-        for (Term *term_ptr: all_terms) {
-            Term &term = *term_ptr;
-            // factor the term linkage
-            MutableLinkagePtr term_link = as_link(term.term_linkage()->shallow());
-            if (!term_link->is_temp()) continue;
-            else term_link->factor();
-
-            term.expand_rhs(term_link);
-            term.reorder(true);
-        }
-    }
-
-    size_t num_removed_total = num_removed;
-    while (num_removed > 0) {
-        num_removed = prune(keep_single_use); // recursively prune until no more temps are removed
-        num_removed_total += num_removed;
-    }
-
-    return num_removed_total;
 }
 
 pair<set<Term *>, set<Term*>> PQGraph::get_matching_terms(const LinkagePtr &intermediate) {
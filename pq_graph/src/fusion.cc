@@ -246,8 +246,9 @@ struct LinkMerger {
             vector<size_t> order(all_links.size());
             std::iota(order.begin(), order.end(), 0);
             std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
-                const string sa = all_links[a]->tot_str(true), sb = all_links[b]->tot_str(true);
-                return sa != sb ? sa < sb : all_links[a]->id() < all_links[b]->id();
+                if (Linkage::canonical_less(*all_links[a], *all_links[b])) return true;
+                if (Linkage::canonical_less(*all_links[b], *all_links[a])) return false;
+                return all_links[a]->id() < all_links[b]->id();
             });
             linkage_vector links_sorted; links_sorted.reserve(all_links.size());
             vector<vector<LinkInfo>> infos_sorted; infos_sorted.reserve(all_infos.size());
@@ -388,8 +389,9 @@ struct LinkMerger {
         for (auto &entry : link_merge_map_) {
             std::stable_sort(entry.second.begin(), entry.second.end(),
                              [](const LinkagePtr &a, const LinkagePtr &b) {
-                const string sa = a->tot_str(true), sb = b->tot_str(true);
-                return sa != sb ? sa < sb : a->id() < b->id();
+                if (Linkage::canonical_less(*a, *b)) return true;
+                if (Linkage::canonical_less(*b, *a)) return false;
+                return a->id() < b->id();
             });
         }
     }
@@ -565,8 +567,9 @@ struct LinkMerger {
         merge_targets.reserve(link_merge_map_.size());
         for (auto &entry : link_merge_map_) merge_targets.push_back(entry.first);
         std::sort(merge_targets.begin(), merge_targets.end(), [](const LinkagePtr &a, const LinkagePtr &b) {
-            const string sa = a->tot_str(true), sb = b->tot_str(true);
-            return sa != sb ? sa < sb : a->id() < b->id();
+            if (Linkage::canonical_less(*a, *b)) return true;
+            if (Linkage::canonical_less(*b, *a)) return false;
+            return a->id() < b->id();
         });
 
         // debug instrument for bisecting invalid merges (edeprince3/pdaggerq#114):
@@ -0,0 +1,326 @@
+//
+// pdaggerq - A code for bringing strings of creation / annihilation operators to normal order.
+// Filename: graph_evaluation.cc
+// Copyright (C) 2020 A. Eugene DePrince III
+//
+// Author: A. Eugene DePrince III <adeprince@fsu.edu>
+// Maintainer: DePrince group
+//
+// This file is part of the pdaggerq package.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+
+#include "../include/pq_graph.h"
+#include "../include/term.h"
+#include "../runtime/pq_runtime.hpp"
+
+using std::string, std::vector, std::map, std::set, std::pair, std::shared_ptr, std::make_shared,
+      std::to_string, std::invalid_argument;
+
+namespace pdaggerq {
+
+    namespace {
+
+        using pq_runtime::Tensor;
+        using pq_runtime::labels_t;
+
+        /// labels of the stored indices of a vertex (trial indices are stored only with use_trial_index)
+        labels_t line_labels(const line_vector &lines, bool reverse) {
+            labels_t labels;
+            for (const Line &line : lines)
+                if (!line.sig_ || Vertex::use_trial_index) labels.push_back(line.label_);
+            if (reverse) std::reverse(labels.begin(), labels.end());
+            return labels;
+        }
+
+        /// name and block of a tensor, as the printers index it (e.g. eri["oovv"], t1["aa"] or t2)
+        pair<string, string> tensor_key(const Vertex &vertex) {
+            if (vertex.rank() == 0) return {vertex.base_name(), ""};
+            if (vertex.vertex_type() == 'v') return {vertex.base_name(), vertex.dimstring()};
+            if (vertex.vertex_type() == 'a' && vertex.has_blks()) return {vertex.base_name(), vertex.blk_string()};
+            return {vertex.base_name(), ""};
+        }
+
+        /// name of an intermediate (scalar, shared operator or temp), independent of the printer
+        string temp_key(const Linkage &link) {
+            return link.type() + to_string(link.id()) + "_" + link.dimstring();
+        }
+
+        /// evaluated operand: a tensor (owned or not) with its labels and a scale
+        struct Operand {
+            shared_ptr<Tensor> owned;
+            const Tensor *tensor = nullptr;
+            labels_t labels;
+            double scale = 1.0;
+        };
+
+        /// tensor with the dimensions of an operand, ordered by the given labels
+        Tensor shaped(const Operand &operand, const labels_t &labels) {
+            vector<size_t> dims;
+            for (const string &label : labels) {
+                auto pos = std::find(operand.labels.begin(), operand.labels.end(), label);
+                if (pos == operand.labels.end())
+                    throw invalid_argument("evaluate: label " + label + " is not in the evaluated term");
+                dims.push_back(operand.tensor->dims()[pos - operand.labels.begin()]);
+            }
+            return Tensor(dims);
+        }
+
+        /**
+         * Evaluates the terms of the equations with the kernels of the tensor runtime. The rhs of each term is
+         * contracted pairwise in the order of its linkage; permutations of a term reuse its evaluated rhs.
+         * Intermediates are evaluated from their terms when first used and freed after their last use.
+         */
+        class GraphEvaluator {
+        public:
+            GraphEvaluator(const map<string, Equation> &equations, const tensor_map &inputs,
+                           const map<string, bool> &conditions, bool row_major)
+                    : inputs_(inputs), conditions_(conditions), row_major_(row_major) {
+
+                for (const auto &[name, equation] : equations) {
+                    bool temp_equation = name == "temp" || name == "scalar" || name == "reused";
+                    for (const Term &term : equation) {
+                        if (skip(term)) continue;
+                        if (term.lhs()->is_temp())
+                            definitions_[temp_key(*as_link(term.lhs()))].push_back(&term);
+                        else if (!temp_equation)
+                            terms_.push_back(&term);
+                    }
+                }
+
+                // count the uses of each intermediate to free it after the last one
+                for (const Term *term : terms_)
+                    count(term->term_linkage());
+            }
+
+            tensor_map run() {
+                for (const Term *term : terms_) {
+                    auto [name, block] = tensor_key(*term->lhs());
+                    apply(*term, outputs_[name][block], line_labels(term->lhs()->lines(), row_major_));
+                }
+                return std::move(outputs_);
+            }
+
+        private:
+            const tensor_map &inputs_;
+            const map<string, bool> &conditions_;
+            bool row_major_;
+
+            map<string, vector<const Term *>> definitions_; // terms of each intermediate
+            vector<const Term *> terms_; // terms of the output equations
+            map<string, Tensor> temps_; // evaluated intermediates
+            map<string, size_t> uses_; // remaining uses of each intermediate
+            tensor_map outputs_;
+
+            /// whether a term has a condition that is set to false
+            bool skip(const Term &term) const {
+                for (const string &condition : term.conditions()) {
+                    auto it = conditions_.find(condition);
+                    if (it != conditions_.end() && !it->second) return true;
+                }
+                return false;
+            }
+
+            /// count the uses of the intermediates in a linkage (and in their terms when first used)
+            void count(const VertexPtr &node) {
+                if (!node || node->empty() || !node->is_linked()) return;
+                LinkagePtr link = as_link(node);
+                if (!link->is_temp()) {
+                    count(link->left());
+                    count(link->right());
+                    return;
+                }
+
+                string key = temp_key(*link);
+                if (uses_[key]++ > 0) return;
+                auto it = definitions_.find(key);
+                if (it == definitions_.end()) {
+                    count(link->left());
+                    count(link->right());
+                } else {
+                    for (const Term *term : it->second)
+                        count(term->term_linkage());
+                }
+            }
+
+            /// release the intermediates of a linkage after their last use
+            void release(const VertexPtr &node) {
+                if (!node || node->empty() || !node->is_linked()) return;
+                LinkagePtr link = as_link(node);
+                if (!link->is_temp()) {
+                    release(link->left());
+                    release(link->right());
+                    return;
+                }
+
+                string key = temp_key(*link);
+                auto it = uses_.find(key);
+                if (it != uses_.end() && it->second > 0 && --it->second == 0)
+                    temps_.erase(key);
+            }
+
+            /// find an input tensor (or an output that was already evaluated)
+            const Tensor &input(const Vertex &vertex) const {
+                auto [name, block] = tensor_key(vertex);
+                for (const tensor_map *tensors : {&inputs_, &outputs_}) {
+                    auto it = tensors->find(name);
+                    if (it == tensors->end()) continue;
+                    auto blk = it->second.find(block);
+                    if (blk != it->second.end() && blk->second.allocated()) return blk->second;
+                }
+                throw invalid_argument("evaluate: missing tensor " + name + (block.empty() ? "" : "[\"" + block + "\"]"));
+            }
+
+            /// evaluate an intermediate from its terms when it is first used
+            const Tensor &temp(const LinkagePtr &link) {
+                string key = temp_key(*link);
+                auto it = temps_.find(key);
+                if (it != temps_.end()) return it->second;
+
+                Tensor &value = temps_[key];
+                auto def = definitions_.find(key);
+                if (def == definitions_.end()) {
+                    // no terms: evaluate the contraction of the intermediate itself
+                    Operand result = combine(link);
+                    labels_t labels = line_labels(link->lines(), false);
+                    value = shaped(result, labels);
+                    pq_runtime::permute(result.scale, *result.tensor, result.labels, 0.0, value, labels);
+                } else {
+                    for (const Term *term : def->second)
+                        apply(*term, value, line_labels(term->lhs()->lines(), false));
+                }
+                return value;
+            }
+
+            /// evaluate a vertex of a linkage
+            Operand operand(const VertexPtr &node) {
+                if (!node->is_linked()) {
+                    Operand result;
+                    result.tensor = &input(*node);
+                    result.labels = line_labels(node->lines(), row_major_);
+                    if (result.labels.size() != result.tensor->rank())
+                        throw invalid_argument("evaluate: tensor " + node->name() + " has rank " + to_string(result.tensor->rank())
+                                               + " instead of " + to_string(result.labels.size()));
+                    return result;
+                }
+
+                LinkagePtr link = as_link(node);
+                if (!link->is_temp()) return combine(link);
+
+                Operand result;
+                result.tensor = &temp(link);
+                result.labels = line_labels(link->lines(), false);
+                return result;
+            }
+
+            /// evaluate the contraction or addition of the vertices of a linkage
+            Operand combine(const LinkagePtr &link) {
+                const VertexPtr &left = link->left(), &right = link->right();
+
+                // a single vertex, possibly with a constant factor
+                if (left->empty() || left->is_constant()) {
+                    Operand result = operand(right);
+                    if (!left->empty()) result.scale *= left->value();
+                    return result;
+                }
+                if (right->empty() || right->is_constant()) {
+                    Operand result = operand(left);
+                    if (!right->empty()) result.scale *= right->value();
+                    return result;
+                }
+
+                Operand x = operand(left), y = operand(right);
+                Operand result;
+                result.owned = make_shared<Tensor>();
+                result.tensor = result.owned.get();
+                result.labels = line_labels(link->lines(), false);
+
+                if (link->is_addition()) {
+                    *result.owned = shaped(x, result.labels);
+                    pq_runtime::permute(x.scale, *x.tensor, x.labels, 0.0, *result.owned, result.labels);
+                    pq_runtime::permute(y.scale, *y.tensor, y.labels, 1.0, *result.owned, result.labels);
+                } else {
+                    pq_runtime::contract(x.scale * y.scale, *x.tensor, x.labels, *y.tensor, y.labels,
+                                         0.0, *result.owned, result.labels);
+                }
+                return result;
+            }
+
+            /// dst(labels) (+)= coefficient * rhs of a term, for each of its permutations
+            void apply(const Term &term, Tensor &dst, const labels_t &labels) {
+                const LinkagePtr &tree = term.term_linkage();
+                if (tree->empty()) return;
+
+                double beta = term.is_assignment_ || !dst.allocated() ? 0.0 : 1.0;
+                if (term.perm_type() == 0 && !tree->is_temp() && !tree->is_addition()
+                    && !tree->left()->empty() && !tree->left()->is_constant()
+                    && !tree->right()->empty() && !tree->right()->is_constant()) {
+                    // contract the last pair directly into dst
+                    Operand x = operand(tree->left()), y = operand(tree->right());
+                    if (beta == 0.0) dst.reset();
+                    pq_runtime::contract(term.coefficient_ * x.scale * y.scale, *x.tensor, x.labels,
+                                         *y.tensor, y.labels, beta, dst, labels);
+                    release(tree);
+                    return;
+                }
+
+                Operand value = operand(tree);
+                if (!dst.allocated()) dst = shaped(value, labels);
+
+                if (term.perm_type() == 0) {
+                    pq_runtime::permute(term.coefficient_ * value.scale, *value.tensor, value.labels, beta, dst, labels);
+                } else {
+                    // the permutations of the term swap the labels of its lhs: permute the labels of the rhs alike
+                    Term lhs_term = term.shallow();
+                    lhs_term.rhs() = {term.lhs()};
+                    labels_t lhs_labels = line_labels(term.lhs()->lines(), false);
+                    for (const Term &perm : lhs_term.expand_perms()) {
+                        labels_t perm_labels = line_labels(perm.rhs().front()->lines(), false);
+                        labels_t src_labels = value.labels;
+                        for (string &label : src_labels) {
+                            auto pos = std::find(lhs_labels.begin(), lhs_labels.end(), label);
+                            if (pos != lhs_labels.end()) label = perm_labels[pos - lhs_labels.begin()];
+                        }
+                        pq_runtime::permute(perm.coefficient_ * value.scale, *value.tensor, src_labels, beta, dst, labels);
+                        beta = 1.0;
+                    }
+                }
+                release(tree);
+            }
+        };
+
+    } // namespace
+
+    tensor_map PQGraph::evaluate(const tensor_map &inputs, const map<string, bool> &conditions, bool row_major) const {
+
+        // evaluate the assembled equations (as printed)
+        PQGraph copy;
+        const PQGraph *graph = this;
+        if (!is_assembled_) {
+            copy = clone();
+            copy.assemble();
+            graph = &copy;
+        }
+
+        GraphEvaluator evaluator(graph->equations_, inputs, conditions, row_major);
+        return evaluator.run();
+    }
+
+} // pdaggerq
@@ -21,6 +21,7 @@
 //  limitations under the License.
 //
 
+#include <cctype>
 #include <cmath>
 #include <map>
 #include <algorithm>
@@ -47,6 +48,436 @@ using std::ostream, std::string, std::vector, std::map, std::unordered_map, std:
 
 namespace pdaggerq {
 
+    namespace {
+
+        /// estimated number of stored elements of an intermediate (nocc = 10, nvirt = 50 when not given)
+        double stored_elements(const line_vector &lines) {
+            double nocc  = shape::nocc_  ? (double) shape::nocc_  : 10;
+            double nvirt = shape::nvirt_ ? (double) shape::nvirt_ : 50;
+
+            double size = 1;
+            for (const Line &line : lines) {
+                if (line.sig_) {
+                    if (Vertex::use_trial_index) size *= (double) shape::nroots_;
+                } else if (line.den_) size *= shape::naux_ ? (double) shape::naux_ : 5 * (nocc + nvirt);
+                else size *= line.o_ ? nocc : nvirt;
+            }
+            return size;
+        }
+
+        /**
+         * Assign intermediates to a pool of reusable buffers from their live ranges in the evaluated terms.
+         * An intermediate is live from its allocation to its deallocation (or last use); intermediates whose
+         * ranges do not overlap may share a buffer. Largest first, each intermediate takes the smallest buffer
+         * without an overlapping occupant, so buffers are sized by their first occupant and never grow.
+         * @param terms evaluated terms, including the allocation statements
+         * @param pooled intermediates to assign (those with an allocation statement)
+         * @param slices stored lines of the batched intermediates
+         * @return the buffer plan with the estimated peak memory
+         */
+        BufferPlan plan_buffers(const vector<Term> &terms, const set<string> &pooled,
+                                const map<string, line_vector> &slices) {
+            BufferPlan plan;
+            plan.nocc  = shape::nocc_  ? (double) shape::nocc_  : 10;
+            plan.nvirt = shape::nvirt_ ? (double) shape::nvirt_ : 50;
+
+            // intermediates by id, from the terms that define them
+            map<long, LinkagePtr> temps;
+            for (const Term &term : terms) {
+                if (!term.lhs()->is_temp()) continue;
+                LinkagePtr temp = as_link(term.lhs());
+                if (pooled.count(temp->str(true, false))) temps.emplace(temp->id(), temp);
+            }
+
+            // live range of each intermediate: first and last position where it is used
+            map<long, pair<size_t, size_t>> ranges;
+            auto use = [&ranges, &temps](long id, size_t pos) {
+                if (!temps.count(id)) return;
+                auto [it, inserted] = ranges.emplace(id, make_pair(pos, pos));
+                if (!inserted) it->second.second = pos;
+            };
+            for (size_t i = 0; i < terms.size(); ++i) {
+                const Term &term = terms[i];
+                if (!term.print_override_.empty()) {
+                    // (de)allocation statements only use their lhs
+                    if (term.lhs()->is_temp()) use(as_link(term.lhs())->id(), i);
+                    continue;
+                }
+                for (long id : term.term_ids("temp")) use(id, i);
+            }
+            if (ranges.empty()) return plan;
+
+            struct interval { string name; size_t first, last; double size; };
+            vector<interval> intervals;
+            for (const auto &[id, range] : ranges) {
+                const LinkagePtr &temp = temps[id];
+                string name = temp->str(true, false);
+                auto slice = slices.find(name);
+                intervals.push_back({name, range.first, range.second,
+                                     stored_elements(slice != slices.end() ? slice->second : temp->lines())});
+            }
+
+            // peak of live intermediates: the lower bound for any assignment
+            vector<double> live(terms.size() + 1, 0.0);
+            for (const auto &range : intervals) {
+                live[range.first] += range.size;
+                live[range.last + 1] -= range.size;
+            }
+            double current = 0;
+            for (double delta : live) {
+                current += delta;
+                plan.live_peak = max(plan.live_peak, current);
+            }
+
+            std::stable_sort(intervals.begin(), intervals.end(), [](const interval &a, const interval &b) {
+                return a.size > b.size;
+            });
+
+            vector<vector<const interval *>> buffers;
+            for (const interval &range : intervals) {
+                long best = -1;
+                for (size_t k = 0; k < buffers.size(); ++k) {
+                    bool overlaps = false;
+                    for (const interval *other : buffers[k]) {
+                        if (range.first <= other->last && other->first <= range.last) { overlaps = true; break; }
+                    }
+                    if (overlaps) continue;
+                    if (best < 0 || plan.capacity[k] < plan.capacity[best]) best = (long) k;
+                }
+                if (best < 0) {
+                    best = (long) buffers.size();
+                    buffers.emplace_back();
+                    plan.capacity.push_back(range.size);
+                }
+                buffers[best].push_back(&range);
+                plan.buffer_of[range.name] = best;
+            }
+
+            for (size_t k = 0; k < buffers.size(); ++k) {
+                std::sort(buffers[k].begin(), buffers[k].end(), [](const interval *a, const interval *b) {
+                    return a->first < b->first;
+                });
+                vector<string> names;
+                for (const interval *range : buffers[k]) names.push_back(range->name);
+                plan.occupants.push_back(names);
+                plan.pool_size += plan.capacity[k];
+            }
+
+            return plan;
+        }
+
+
+        /**
+         * Build and use the intermediates above max_shape_ in batches over lines they share with the outputs
+         * of all their uses. The uses are moved next to the build and wrapped with it in a batch loop, in
+         * which the intermediate stores one slice (the uses must follow Term::batch_lines). A use with
+         * permutations accumulates into its own permutation intermediate in the loop, which is permuted into
+         * the output after the loop. An intermediate that is not batched (the backend cannot batch) is built
+         * whole, after a warning comment in the code.
+         * @param terms evaluated terms with the builds and allocations of the tmps
+         * @param names declared names; gets the permutation intermediates
+         * @param printer backend of the output
+         * @return stored lines of each batched intermediate, by name
+         */
+        map<string, line_vector> batch_intermediates(vector<Term> &terms, set<string> &names, const CodePrinter *printer) {
+            map<string, line_vector> slices;
+            if (Term::max_batch_lines_ == 0) return slices;
+
+            vector<LinkagePtr> oversized;
+            for (const Term &term : terms) {
+                if (!term.print_override_.empty() || !term.lhs()->is_temp()) continue;
+                LinkagePtr temp = as_link(term.lhs());
+                if (temp->shape_ > Term::max_shape_) oversized.push_back(temp);
+            }
+
+            size_t perm_count = 0;
+            for (const LinkagePtr &temp : oversized) {
+                string name = temp->str(true, false);
+                long id = temp->id();
+
+                // find the allocation, the build and the uses of the intermediate
+                long alloc = -1, build = -1;
+                vector<size_t> uses;
+                bool batchable = true;
+                for (size_t i = 0; i < terms.size(); ++i) {
+                    const Term &term = terms[i];
+                    if (!term.print_override_.empty()) {
+                        if (term.lhs()->same_temp(temp)) alloc = (long) i;
+                        continue;
+                    }
+                    if (term.lhs()->same_temp(temp)) {
+                        batchable &= build < 0;
+                        build = (long) i;
+                    } else if (term.term_ids(temp->type()).count(id))
+                        uses.push_back(i);
+                }
+                batchable &= build >= 0 && !uses.empty() && (size_t) build < uses.front();
+                if (batchable) batchable = terms[build].batch_labels_.empty();
+
+                // lines to batch over, by the rules by which optimize() keeps the intermediate
+                line_vector lines = batchable ? terms[build].lhs()->lines() : line_vector(), batch;
+                vector<line_vector> use_lines; // lines of the intermediate in each use
+                if (batchable) {
+                    vector<const Term *> use_terms;
+                    for (size_t i : uses) {
+                        use_terms.push_back(&terms[i]);
+                        for (const auto &op : terms[i].rhs())
+                            if (op->is_temp() && op->same_temp(temp)) use_lines.push_back(op->lines());
+                    }
+                    batch = Term::batch_lines(terms[build], use_terms);
+                }
+
+                // loop variable of each batch line
+                line_vector loop_lines, slice;
+                map<size_t, string> loop_vars; // position in lines -> loop variable
+                for (size_t p = 0; p < lines.size(); ++p) {
+                    if (std::find(batch.begin(), batch.end(), lines[p]) == batch.end()) {
+                        slice.push_back(lines[p]);
+                        continue;
+                    }
+                    Line loop_line = lines[p];
+                    loop_line.label_ = "batch_" + lines[p].label_;
+                    loop_lines.push_back(loop_line);
+                    loop_vars[p] = loop_line.label_;
+                }
+
+                // a backend that cannot batch builds the intermediate whole, and says so in the code
+                string open = batch.empty() ? "" : printer->batch_open(name, loop_lines);
+                if (open.empty()) {
+                    string note = name + " is above max_shape and is built whole"
+                                + (batch.empty() ? " (its uses cannot be batched)" : " (this backend does not batch)");
+                    cout << "WARNING: " << note << endl;
+                    if (build >= 0) {
+                        Term note_term = terms[build];
+                        note_term.print_override_ = printer->comment_prefix() + " WARNING: " + note;
+                        terms.insert(terms.begin() + build, note_term);
+                    }
+                    continue;
+                }
+
+                // annotate the build and the uses with the loop variables of their batch lines
+                Term &build_term = terms[build];
+                for (const auto &[p, var] : loop_vars)
+                    build_term.batch_labels_[lines[p].label_] = var;
+                build_term.batch_temp_ = name;
+                for (size_t u = 0; u < uses.size(); ++u) {
+                    Term &use = terms[uses[u]];
+                    for (const auto &[p, var] : loop_vars)
+                        use.batch_labels_[use_lines[u][p].label_] = var;
+                    use.batch_temp_ = name;
+                }
+
+                // split the uses with permutations: accumulate into a permutation intermediate in the loop,
+                // then permute it into the output after the loop
+                vector<Term> loop_uses, perm_allocs, perm_adds, perm_frees;
+                for (size_t i : uses) {
+                    const Term &use = terms[i];
+                    if (use.term_perms().empty() || use.perm_type() == 0) {
+                        loop_uses.push_back(use);
+                        continue;
+                    }
+
+                    MutableVertexPtr perm_vertex = use.lhs()->clone();
+                    perm_vertex->vertex_type_ = 'p';
+                    perm_vertex->sort();
+                    perm_vertex->update_name(printer->scratch_prefix() + "_batch" + to_string(++perm_count));
+                    names.insert(perm_vertex->str());
+
+                    Term perm_add = use;
+                    perm_add.batch_labels_.clear();
+                    perm_add.batch_temp_.clear();
+                    perm_add.comments().clear();
+                    perm_add.rhs() = {perm_vertex};
+                    perm_add.coefficient_ = use.coefficient_ > 0 ? 1 : -1;
+                    perm_add.compute_scaling(true);
+                    perm_adds.push_back(perm_add);
+
+                    Term perm_term = use;
+                    perm_term.lhs() = perm_vertex;
+                    perm_term.reset_perm();
+                    perm_term.coefficient_ = fabs(use.coefficient_);
+                    loop_uses.push_back(perm_term);
+
+                    if (Term::deallocate_) {
+                        Term allocation = perm_add;
+                        allocation.lhs() = perm_vertex;
+                        allocation.print_override_ = printer->allocate(perm_vertex->str());
+                        if (!allocation.print_override_.empty()) perm_allocs.push_back(allocation);
+                        allocation.print_override_ = printer->deallocate(perm_vertex->str());
+                        if (!allocation.print_override_.empty()) perm_frees.push_back(allocation);
+                    }
+                }
+
+                // group: slice size, allocations, open, reset, build, uses, close, permuted uses (at the position
+                // of the last use)
+                vector<Term> group;
+                Term size_term = build_term;
+                size_term.batch_labels_.clear();
+                size_term.print_override_ = printer->batch_size(name, slice);
+                if (!size_term.print_override_.empty()) group.push_back(size_term);
+                if (alloc >= 0) group.push_back(terms[alloc]);
+                group.insert(group.end(), perm_allocs.begin(), perm_allocs.end());
+                Term open_term = build_term;
+                open_term.print_override_ = open;
+                open_term.batch_labels_.clear();
+                group.push_back(open_term);
+                Term reset_term = build_term;
+                reset_term.print_override_ = printer->batch_reset(name);
+                group.push_back(reset_term);
+                group.push_back(build_term);
+                group.insert(group.end(), loop_uses.begin(), loop_uses.end());
+                Term close_term = open_term;
+                close_term.print_override_ = printer->batch_close();
+                group.push_back(close_term);
+                group.insert(group.end(), perm_adds.begin(), perm_adds.end());
+                group.insert(group.end(), perm_frees.begin(), perm_frees.end());
+
+                set<size_t> moved(uses.begin(), uses.end());
+                moved.insert((size_t) build);
+                if (alloc >= 0) moved.insert((size_t) alloc);
+
+                vector<Term> regrouped;
+                regrouped.reserve(terms.size() + 4);
+                for (size_t i = 0; i < terms.size(); ++i) {
+                    if (i == uses.back()) regrouped.insert(regrouped.end(), group.begin(), group.end());
+                    else if (!moved.count(i)) regrouped.push_back(terms[i]);
+                }
+                terms = std::move(regrouped);
+                slices[name] = slice;
+            }
+
+            return slices;
+        }
+
+        /// statements that run as one task, with the tensors they touch and the tasks they wait for
+        struct Task {
+            vector<string> lines; // printed statements
+            TaskDepends depends;
+            vector<size_t> after; // earlier tasks this task depends on
+        };
+
+        /**
+         * Group the evaluated terms into tasks and find their dependencies. Each statement is a task, except
+         * that a batch loop is one task with everything it contains. Tensors are named as printed. A term
+         * reads its rhs and accumulates into its lhs unless it is an assignment; an allocation initializes
+         * its tmp and any other statement override reads and writes it. The allocation and the release of a
+         * pooled tmp also read and write its buffer of the pool (CodePrinter::pool_buffer), which orders them
+         * against the tmps that share the buffer. Only tensors that some task writes are dependencies, and
+         * only if another task also accesses them; tasks are ordered as by OpenMP depend clauses.
+         * @param terms evaluated terms in order
+         * @param format_eq equation used to print the terms of a task
+         * @param printer backend of the output
+         * @return tasks in evaluation order
+         */
+        vector<Task> make_tasks(const vector<Term> &terms, Equation &format_eq, const CodePrinter *printer) {
+            enum access { read, init, update, accumulate };
+            auto merge = [](map<string, access> &accesses, const string &name, access mode) {
+                auto [it, inserted] = accesses.emplace(name, mode);
+                if (!inserted && it->second != mode) it->second = update;
+            };
+            auto name_of = [](const VertexPtr &vertex) {
+                return vertex->is_temp() ? as_link(vertex)->str(true, false) : vertex->str();
+            };
+            // an operand that is a product or a sum is printed with its factors (in a scratch scope), so it
+            // reads the tensors and tmps it is made of
+            auto read_operand = [&](map<string, access> &accesses, const VertexPtr &op, auto &&self) -> void {
+                if (op->is_linked() && !op->is_temp()) {
+                    self(accesses, as_link(op)->left(), self);
+                    self(accesses, as_link(op)->right(), self);
+                } else if (!op->empty() && !op->is_constant())
+                    merge(accesses, name_of(op), read);
+            };
+
+            vector<Task> tasks;
+            vector<map<string, access>> task_accesses;
+            set<string> written;
+            map<string, size_t> users; // number of tasks that access each name
+            for (size_t i = 0; i < terms.size(); ++i) {
+                // a batch loop runs from its opening statement to its closing statement
+                size_t last = i;
+                if (i + 1 < terms.size() && terms[i].batch_labels_.empty() && !terms[i + 1].batch_labels_.empty()) {
+                    last = i + 1;
+                    while (last < terms.size() && !terms[last].batch_labels_.empty()) ++last;
+                    last = min(last, terms.size() - 1);
+                }
+                vector<Term> task_terms(terms.begin() + (long) i, terms.begin() + (long) last + 1);
+                i = last;
+
+                map<string, access> accesses;
+                for (const Term &term : task_terms) {
+                    string lhs = name_of(term.lhs());
+                    if (!term.print_override_.empty()) {
+                        bool allocates = term.print_override_ == printer->allocate(lhs);
+                        merge(accesses, lhs, allocates ? init : update);
+                        string pool = printer->pool_buffer(lhs);
+                        if (!pool.empty() && (allocates || term.print_override_ == printer->deallocate(lhs)))
+                            merge(accesses, pool, update);
+                        continue;
+                    }
+                    for (const VertexPtr &op : term.rhs())
+                        read_operand(accesses, op, read_operand);
+                    merge(accesses, lhs, term.is_assignment_ ? init : accumulate);
+                }
+
+                format_eq.terms() = task_terms;
+                Task task;
+                task.lines = format_eq.to_strings();
+
+                for (const auto &[name, mode] : accesses) {
+                    if (mode != read) written.insert(name);
+                    ++users[name];
+                }
+                tasks.push_back(std::move(task));
+                task_accesses.push_back(std::move(accesses));
+            }
+
+            // order the tasks by their accesses: readers wait for the last writers, writers wait for the
+            // readers and writers before them, and consecutive accumulations only wait for what came before
+            struct history { vector<size_t> writers, readers, before; bool accumulating = false; };
+            map<string, history> histories;
+            for (size_t t = 0; t < tasks.size(); ++t) {
+                Task &task = tasks[t];
+                set<size_t> after;
+                for (const auto &[name, mode] : task_accesses[t]) {
+                    if (!written.count(name) || users[name] < 2) continue; // never changes or is not shared
+                    history &h = histories[name];
+                    switch (mode) {
+                        case read:
+                            task.depends.in.insert(name);
+                            after.insert(h.writers.begin(), h.writers.end());
+                            h.readers.push_back(t);
+                            h.accumulating = false;
+                            break;
+                        case accumulate:
+                            task.depends.mutex.insert(name);
+                            if (!h.accumulating) {
+                                h.before = h.writers;
+                                h.before.insert(h.before.end(), h.readers.begin(), h.readers.end());
+                                h.writers.clear();
+                                h.readers.clear();
+                                h.accumulating = true;
+                            }
+                            after.insert(h.before.begin(), h.before.end());
+                            h.writers.push_back(t);
+                            break;
+                        default:
+                            (mode == init ? task.depends.out : task.depends.inout).insert(name);
+                            after.insert(h.writers.begin(), h.writers.end());
+                            after.insert(h.readers.begin(), h.readers.end());
+                            h.writers = {t};
+                            h.readers.clear();
+                            h.accumulating = false;
+                            break;
+                    }
+                }
+                task.after.assign(after.begin(), after.end());
+            }
+
+            return tasks;
+        }
+
+    } // namespace
+
     string PQGraph::str(const string &print_type) const {
 
         Vertex::set_printer(print_type);        
@@ -142,10 +573,15 @@ namespace pdaggerq {
             }
         }
 
-        // declare a map for each base name
-        sout << printer->format_named_section(" Declarations ", false);
-        sout << printer->format_declarations(names);
-        sout << endl;
+        // let the backend plan the output from all terms (e.g. the storage layout of intermediates)
+        vector<const Term *> plan_terms;
+        for (const auto &[eq_name, equation] : copy.equations_)
+            for (const auto &term : equation.terms())
+                plan_terms.push_back(&term);
+        printer->plan(plan_terms);
+
+        // declare a map for each base name (after the intermediates are batched, which may add names)
+        std::streampos declarations_pos = sout.tellp();
 
         // add scalar terms to the beginning of the equation
 
@@ -154,6 +590,31 @@ namespace pdaggerq {
         merged_eq.rearrange("temp"); // sort tmps in merged equation
         all_terms = merged_eq.terms(); // get sorted terms
 
+        // scalars are assigned before the equations that use them; when the printer allocates
+        // intermediates, allocate each before its first assignment and free it after the equations
+        vector<string> scalar_names;
+        auto allocate_scalars = [&scalar_names, &printer](Equation &eq) {
+            if (!Term::deallocate_) return;
+
+            vector<Term> terms;
+            for (const Term &term : eq) {
+                if (term.lhs()->is_temp()) {
+                    string name = as_link(term.lhs())->str(true, false);
+                    string allocation = printer->allocate(name);
+                    bool first = std::find(scalar_names.begin(), scalar_names.end(), name) == scalar_names.end();
+                    if (first && !allocation.empty()) {
+                        Term allocate_term(term);
+                        allocate_term.comments() = {};
+                        allocate_term.print_override_ = allocation;
+                        terms.push_back(allocate_term);
+                        scalar_names.push_back(name);
+                    }
+                }
+                terms.push_back(term);
+            }
+            eq.terms() = terms;
+        };
+
         // print scalar declarations
         if (!copy.equations_["scalar"].empty()) {
             sout << printer->format_named_section(" Scalars ", false);
@@ -168,6 +629,7 @@ namespace pdaggerq {
 
             for (auto &term: copy.equations_["scalar"])
                 term.comments() = {}; // remove comments from scalars
+            allocate_scalars(copy.equations_["scalar"]);
 
             // print scalars
             sout << copy.equations_["scalar"] << endl;
@@ -276,6 +738,9 @@ namespace pdaggerq {
             }
         } while (found_any && ++attempts < copy.equations_["temp"].size());
 
+        // build and use tmps above max_shape in batches
+        map<string, line_vector> slices = batch_intermediates(all_terms, names, printer);
+
 
         // add a term to destroy the tmp after its last use
         auto make_destructor = [&printer](const Term &tempterm, const LinkagePtr &temp) -> Term {
@@ -322,6 +787,9 @@ namespace pdaggerq {
 
                 destroy_ids.insert(temp_id); // add tmp id to set
 
+                // a tmp last used in a batch loop is destroyed after the loop closes
+                while (!all_terms[i].batch_labels_.empty()) ++i;
+
                 // Create new term with tmp in the lhs and assign zero to the rhs
                 Term destruct_term = make_destructor(tempterm, temp);
 
@@ -370,22 +838,93 @@ namespace pdaggerq {
             cout << endl;
         }
 
+        // find the allocation statements of the tmps (position -> whether it allocates)
+        map<size_t, bool> allocations;
+        set<string> allocated;
+        for (size_t i = 0; i < all_terms.size(); ++i) {
+            const Term &term = all_terms[i];
+            if (term.print_override_.empty() || !term.lhs()->is_temp()) continue;
+
+            string name = as_link(term.lhs())->str(true, false);
+            if (term.print_override_ == printer->allocate(name)) {
+                allocations[i] = true;
+                allocated.insert(name);
+            } else if (term.print_override_ == printer->deallocate(name))
+                allocations[i] = false;
+        }
+
+        // share buffers between tmps with disjoint live ranges and reformat their allocations
+        BufferPlan buffer_plan;
+        if (Term::deallocate_ && Term::buffer_pool_ && !allocated.empty())
+            buffer_plan = plan_buffers(all_terms, allocated, slices);
+        printer->assign_buffers(buffer_plan);
+
+        for (const auto &[i, allocates] : allocations) {
+            string name = as_link(all_terms[i].lhs())->str(true, false);
+            all_terms[i].print_override_ = allocates ? printer->allocate(name) : printer->deallocate(name);
+        }
+
+        string buffer_pool = printer->format_buffer_pool();
+        if (!buffer_pool.empty()) {
+            sout << printer->format_named_section(" Buffer Pool ", false);
+            sout << buffer_pool << endl;
+        }
+
         sout << printer->format_named_section(" Evaluate Equations ", true);
 
-        // update terms in merged equation
-        merged_eq.terms() = all_terms;
+        // group the statements into tasks and find their dependencies
+        Equation format_eq = merged_eq;
+        vector<Task> tasks = make_tasks(all_terms, format_eq, printer);
+        dependency_graph_.clear();
+        for (const Task &task : tasks) {
+            string code;
+            for (const string &line : task.lines) code += line + "\n";
+            dependency_graph_.emplace_back(code, task.after);
+        }
+
+        string task_region = Term::task_parallel_ ? printer->task_region_open() : "";
+        if (!task_region.empty()) {
+            // run independent statements concurrently, in the order given by their dependencies
+            sout << task_region;
+            for (const Task &task : tasks)
+                sout << printer->format_task(task.lines, task.depends);
+            sout << printer->task_region_close() << endl;
+        } else {
+            // update terms in merged equation
+            merged_eq.terms() = all_terms;
+
+            // stream merged equation as string
+            sout << merged_eq << endl;
+        }
+
+        // free the scalars
+        for (const string &name : scalar_names)
+            sout << printer->padding(1) << printer->deallocate(name) << endl;
+        if (!scalar_names.empty()) sout << endl;
+
+        // release the buffer pool after the last use
+        string buffer_release = printer->format_buffer_release();
+        if (!buffer_release.empty())
+            sout << buffer_release << endl;
 
-        // stream merged equation as string
-        sout << merged_eq << endl;
+        // the printer is shared between outputs; do not keep this pool
+        printer->assign_buffers(BufferPlan());
 
         // add closing banner
         sout << printer->format_closing_banner();
 
-        // return string stream as string
-        return sout.str();
+        // return string stream as string, with the declarations
+        string declarations = printer->format_named_section(" Declarations ", false);
+        declarations += printer->format_declarations(names) + "\n";
+        return sout.str().insert((size_t) declarations_pos, declarations);
 
     }
 
+    vector<pair<string, vector<size_t>>> PQGraph::dependency_graph(const string &print_type) const {
+        str(print_type);
+        return dependency_graph_;
+    }
+
     void PQGraph::print(const string &print_type) const {
         // print output to stdout
         cout << this->str(print_type) << endl;
@@ -446,6 +985,7 @@ namespace pdaggerq {
             } // else do nothing
 
             int indent = !conditions.empty() ? 1 : 0;
+            if (!term.batch_labels_.empty()) ++indent; // inside a batch loop
 
             // if override is set, print override
             bool override = !term.print_override_.empty();
@@ -484,6 +1024,11 @@ namespace pdaggerq {
     }
 
     string Term::str() const {
+        int count = 1;
+        return str(count);
+    }
+
+    string Term::str(int &count) const {
 
         if (!print_override_.empty())
             // return print override if it exists for custom printing
@@ -558,7 +1103,8 @@ namespace pdaggerq {
             if (!perm_terms.empty())
                 output.pop_back(); // remove last newline character
 
-            return output;
+            if (perm_as_rhs) return output;
+            return Vertex::printer_->scratch_scope({{perm_vertex->name(), perm_vertex->lines()}}, output);
         }
 
         // if no permutations, continue with normal term printing
@@ -590,9 +1136,19 @@ namespace pdaggerq {
             // determine if binarization is still needed
             bool made_any_change = false;
             Term binarized_term = clone(); // copy of current term to modify
-            needs_binarization = binarized_term.rhs_.size() > 2;            
 
-            int count = 1;
+            // a single operand that is a product of several tensors is split into its factors
+            // (a constant factor, e.g. of 't2 * -2.000', scales the term instead)
+            if (binarized_term.rhs_.size() == 1 && binarized_term.rhs_[0]->is_expandable(true)) {
+                LinkagePtr link = as_link(binarized_term.rhs_[0]);
+                binarized_term.rhs_ = {link->left(), link->right()};
+                binarized_term.merge_constants();
+                binarized_term.compute_scaling(true);
+                made_any_change = true;
+            }
+            needs_binarization = binarized_term.rhs_.size() > 2;
+
+            vector<pair<string, line_vector>> temps; // intermediates created for this term
 
             // helper to create intermediate vertex/term and update binarized_term
             auto make_interm = [&](const std::vector<VertexPtr> &verts, size_t erase_pos, size_t erase_count, size_t insert_pos) {
@@ -605,6 +1161,8 @@ namespace pdaggerq {
                 interm_vertex->vertex_type_ = (char)count + '0';
                 interm_vertex->sort();
                 interm_vertex->update_name();
+                temps.emplace_back(interm_vertex->name(), interm_vertex->lines());
+                ++count;
 
                 Term interm_term = binarized_term;
                 interm_term.reset_perm();
@@ -616,7 +1174,7 @@ namespace pdaggerq {
                 interm_term.rhs_ = verts;
                 interm_term.compute_scaling(true);
 
-                output += interm_term.str();
+                output += interm_term.str(count); // nested terms continue the numbering
                 output += "\n";
 
                 for (size_t e = 0; e < erase_count; ++e)
@@ -625,7 +1183,6 @@ namespace pdaggerq {
                 binarized_term.compute_scaling(true);
 
                 made_any_change = true;
-                ++count;
             };
 
             do {
@@ -664,7 +1221,7 @@ namespace pdaggerq {
             // now print the final binarized term if a change was made
             if (made_any_change) {
                 output += binarized_term.str();
-                return output;
+                return Vertex::printer_->scratch_scope(temps, output);
             } // else we continue to print the original term
         }
 
@@ -340,12 +340,21 @@ namespace pdaggerq {
         rank_  = lines_.size();
         shape_ = shape(lines_);
         mem_scale_ = shape_;
-        has_blk_  = left_->has_blk_  || right_->has_blk_ || shape_.b_ > 0;
-        is_sigma_ = left_->is_sigma_ || right_->is_sigma_ || left_->shape_.L_ > 0 || right_->shape_.L_ > 0;
-        is_den_   = left_->is_den_   || right_->is_den_   || left_->shape_.Q_ > 0 || right_->shape_.Q_ > 0;
+        has_blk_  = left_->has_blk_  || right_->has_blk_ || shape_.b() > 0;
+        is_sigma_ = left_->is_sigma_ || right_->is_sigma_ || left_->shape_.L() > 0 || right_->shape_.L() > 0;
+        is_den_   = left_->is_den_   || right_->is_den_   || left_->shape_.Q() > 0 || right_->shape_.Q() > 0;
 
         // cache the hash for linkage_set lookups
         hash_ = std::hash<string>{}(base_name_);
+
+        // cache the ordering keys from the keys of the children (no strings involved)
+        structure_key_ = mix_key(left_->structure_key(), right_->structure_key());
+        structure_key_ = mix_key(structure_key_, addition_);
+        for (const auto &[leftidx, rightidx] : connec_map_)
+            structure_key_ = mix_key(structure_key_, (size_t) (leftidx + 1) << 8 | (size_t) (rightidx + 1));
+        for (const auto &line : lines_)
+            structure_key_ = mix_key(structure_key_, (size_t) line.type() << 8 | (unsigned char) line.block());
+        label_key_ = mix_key(mix_key(structure_key_, left_->label_key()), right_->label_key());
     }
 
     vector<Line> Linkage::internal_lines() const {
@@ -411,19 +420,27 @@ namespace pdaggerq {
     }
     bool Linkage::operator==(const Linkage &other) const {
 
+        // the same object (shared subtrees are common between terms and their permutations)
+        if (this == &other)
+            return true;
+
         // the roots of the linkages are not equivalent
         if (!similar_root(other))
             return false;
 
-        // recursively check if left linkages are equivalent
-        if (left_->is_linked()) {
-            if (*left_ != *other.left_) return false;
-        } else if ( !left_->equivalent( *other.left_)) return false;
+        // recursively check if left linkages are equivalent (shared subtrees are skipped)
+        if (left_ != other.left_) {
+            if (left_->is_linked()) {
+                if (*left_ != *other.left_) return false;
+            } else if ( !left_->equivalent( *other.left_)) return false;
+        }
 
         // check if right linkages are equivalent
-        if (right_->is_linked()) {
-            if (*right_ != *other.right_) return false;
-        } else if ( !right_->equivalent( *other.right_)) return false;
+        if (right_ != other.right_) {
+            if (right_->is_linked()) {
+                if (*right_ != *other.right_) return false;
+            } else if ( !right_->equivalent( *other.right_)) return false;
+        }
 
         // ensure root vertices are equivalent
         return Vertex::equivalent(other);
@@ -432,21 +449,27 @@ namespace pdaggerq {
     bool Linkage::operator!=(const Linkage &other) const {
 
         // repeat code from == operator, but invert the logic to end recursion early if possible
+        if (this == &other)
+            return false;
         if (!similar_root(other))
             return true;
 
         // recursively check if left linkages are equivalent
         bool left_same, right_same;
-        if (left_->is_linked())
-             left_same = *as_link(left_) == *as_link(other.left_);
+        if (left_ == other.left_)
+             left_same = true;
+        else if (left_->is_linked())
+             left_same = link_ref(left_) == link_ref(other.left_);
         else left_same = left_->equivalent( *other.left_);
 
         // left is not equivalent; therefore, the linkages are not equivalent
         if (!left_same) return true;
 
         // check if right linkages are equivalent
-        if (right_->is_linked())
-             right_same = *as_link(right_) == *as_link(other.right_);
+        if (right_ == other.right_)
+             right_same = true;
+        else if (right_->is_linked())
+             right_same = link_ref(right_) == link_ref(other.right_);
         else right_same = right_->equivalent( *other.right_);
 
         // right is not equivalent; therefore, the linkages are not equivalent
@@ -473,6 +496,16 @@ namespace pdaggerq {
     }
 
     void Linkage::copy_link(const Linkage &other) {
+        // release the old children and cached vectors after the lock (their linkages may need the cache list)
+        VertexPtr old_left, old_right;
+        vertex_vector old_all_vert, old_link_vector;
+        linkage_vector old_permutations;
+        old_left.swap(left_);
+        old_right.swap(right_);
+        old_all_vert.swap(all_vert_);
+        old_link_vector.swap(link_vector_);
+        old_permutations.swap(permutations_);
+
         // Lock the mutex of the source object ('other') to ensure thread-safe reads of its mutable members
         std::lock_guard<std::mutex> lock_other(other.mtx_);
 
@@ -494,6 +527,8 @@ namespace pdaggerq {
         mem_scale_  = other.mem_scale_;
         depth_      = other.depth_;
         hash_       = other.hash_;
+        structure_key_ = other.structure_key_;
+        label_key_     = other.label_key_;
 
         // copy misc properties
         copy_misc(other);
@@ -501,17 +536,22 @@ namespace pdaggerq {
 
     void Linkage::forget(bool forget_all) const {
         // clears all vectors that track the graph structure of the linkage (allows for rebuilding)
-        std::lock_guard<std::mutex> lock(mtx_);
-        all_vert_.clear();
-        link_vector_.clear();
-        permutations_.clear();
+        vertex_vector old_all_vert, old_link_vector;
+        linkage_vector old_permutations;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            old_all_vert.swap(all_vert_);
+            old_link_vector.swap(link_vector_);
+            old_permutations.swap(permutations_);
+        }
+        account_cache();
 
         if (forget_all) {
             // clear subgraphs
             if (left_ && left_->is_linked() && !left_->empty())
-                as_link(left_)->forget(true);
+                link_ref(left_).forget(true);
             if (right_ && right_->is_linked() && !right_->empty())
-                as_link(right_)->forget(true);
+                link_ref(right_).forget(true);
         }
     }
 
@@ -535,6 +575,7 @@ namespace pdaggerq {
 
     Linkage::Linkage(const Linkage &other) {
         copy_link(other);
+        account_cache();
     }
 
     Linkage &Linkage::operator=(const Linkage &other) {
@@ -542,10 +583,100 @@ namespace pdaggerq {
         if (this == &other) return *this;
         else copy_link(other);
 
+        account_cache();
         return *this;
     }
 
+    Linkage::~Linkage() {
+        if (!in_cache_) return;
+
+        // remove the linkage from the cache list (the vectors are released after the lock)
+        std::lock_guard<std::mutex> cache_lock(cache_mtx_);
+        if (!in_cache_) return;
+        cache_total_bytes_ -= cache_bytes_;
+        cache_list_.erase(cache_pos_);
+        in_cache_ = false;
+    }
+
+    size_t Linkage::cached_bytes() const {
+        size_t bytes = (all_vert_.capacity() + link_vector_.capacity() + permutations_.capacity()) * sizeof(VertexPtr);
+
+        // the permutations are new linkages; their vertices are shared with the linkages they were built from
+        for (const auto &permutation : permutations_) {
+            bytes += sizeof(Linkage) + permutation->lines_.capacity() * sizeof(Line)
+                   + permutation->name_.capacity() + permutation->base_name_.capacity();
+        }
+        return bytes;
+    }
+
+    void Linkage::account_cache() const {
+        if (!cache_bounded() && !in_cache_)
+            return; // caches are not accounted without a limit
+
+        // evicted vectors are released after the locks (their linkages may need the cache list)
+        vector<vertex_vector> evicted_vertices;
+        vector<linkage_vector> evicted_permutations;
+
+        std::lock_guard<std::mutex> cache_lock(cache_mtx_);
+
+        size_t bytes;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            bytes = cached_bytes();
+        }
+
+        if (in_cache_) {
+            cache_total_bytes_ -= cache_bytes_;
+            cache_list_.erase(cache_pos_);
+            in_cache_ = false;
+        }
+        cache_bytes_ = bytes;
+        if (bytes == 0) return;
+
+        cache_list_.push_front(this);
+        cache_pos_ = cache_list_.begin();
+        cache_total_bytes_ += bytes;
+        in_cache_ = true;
+
+        // evict the least recently stored caches, giving caches that were used since a second chance
+        size_t num_checks = 2 * cache_list_.size();
+        while (cache_total_bytes_ > max_cache_bytes_ && cache_list_.back() != this && num_checks-- > 0) {
+            const Linkage *victim = cache_list_.back();
+            if (victim->cache_used_.exchange(false)) {
+                cache_list_.splice(cache_list_.begin(), cache_list_, std::prev(cache_list_.end()));
+                victim->cache_pos_ = cache_list_.begin();
+                continue;
+            }
+
+            {
+                std::lock_guard<std::mutex> victim_lock(victim->mtx_);
+                evicted_vertices.push_back(std::move(victim->all_vert_));
+                evicted_vertices.push_back(std::move(victim->link_vector_));
+                evicted_permutations.push_back(std::move(victim->permutations_));
+                victim->all_vert_.clear();
+                victim->link_vector_.clear();
+                victim->permutations_.clear();
+            }
+
+            cache_total_bytes_ -= victim->cache_bytes_;
+            victim->cache_bytes_ = 0;
+            victim->in_cache_ = false;
+            cache_list_.pop_back();
+            ++cache_evictions_;
+        }
+    }
+
     void Linkage::move_link(Linkage &&other) {
+        // release the old children and cached vectors after the lock (their linkages may need the cache list)
+        VertexPtr old_left, old_right;
+        vertex_vector old_all_vert, old_link_vector;
+        linkage_vector old_permutations;
+        old_left.swap(left_);
+        old_right.swap(right_);
+        old_all_vert.swap(all_vert_);
+        old_link_vector.swap(link_vector_);
+        old_permutations.swap(permutations_);
+
         // Lock the mutex of the source object ('other') to ensure thread-safe reads/moves of its mutable members
         std::lock_guard<std::mutex> lock_other(other.mtx_);
 
@@ -567,6 +698,8 @@ namespace pdaggerq {
         mem_scale_  = other.mem_scale_;
         depth_      = other.depth_;
         hash_       = other.hash_;
+        structure_key_ = other.structure_key_;
+        label_key_     = other.label_key_;
 
         // copy misc properties
         copy_misc(other);
@@ -576,6 +709,8 @@ namespace pdaggerq {
 
         // call move constructor
         move_link(std::move(other));
+        account_cache();
+        other.account_cache();
     }
 
     Linkage &Linkage::operator=(Linkage &&other) noexcept {
@@ -583,6 +718,8 @@ namespace pdaggerq {
         if (this == &other) return *this;
         else move_link(std::move(other));
 
+        account_cache();
+        other.account_cache();
         return *this;
     }
 
@@ -27,6 +27,7 @@
 #include <stack>
 #include <numeric>
 #include <cmath>
+#include <tuple>
 #include "../include/linkage.h"
 #include "../include/linkage_set.hpp"
 
@@ -105,14 +106,14 @@ namespace pdaggerq {
 
         // add the scaling of the left vertex
         if (left_->is_linked()) {
-            auto [left_flops, left_mems] = as_link(left_)->scales(fully_expand);
+            auto [left_flops, left_mems] = link_ref(left_).scales(fully_expand);
             flops.insert(flops.end(), left_flops.begin(), left_flops.end());
             mems.insert(mems.end(), left_mems.begin(), left_mems.end());
         }
 
         // add the scaling of the right vertex
         if (right_->is_linked()) {
-            auto [right_flops, right_mems] = as_link(right_)->scales(fully_expand);
+            auto [right_flops, right_mems] = link_ref(right_).scales(fully_expand);
             flops.insert(flops.end(), right_flops.begin(), right_flops.end());
             mems.insert(mems.end(), right_mems.begin(), right_mems.end());
         }
@@ -137,9 +138,15 @@ namespace pdaggerq {
         
 
             // if the link vector is already generated and does not need to be regenerated, return it
-            if (!regenerate && !result.empty())
+            if (!regenerate && !result.empty()) {
+                if (cache_bounded()) {
+                    ++cache_hits_;
+                    cache_used_ = true;
+                }
                 return result;
+            }
 	    }
+        if (cache_bounded()) ++cache_misses_;
 
         // else regenerate the result vector
         result.clear();
@@ -181,18 +188,15 @@ namespace pdaggerq {
         // all reads/writes of the cache members are under the lock: the previous
         // `else if (... && !all_vert_.empty())` checks read the member OUTSIDE the lock,
         // racing with a concurrent forget()/assignment on another thread.
+        vertex_vector old_cache; // released after the lock
         {
             std::lock_guard<std::mutex> lock(mtx_);
-            if (store_vector) {
-                if (fully_expand)
-                     all_vert_ = result;
-                else link_vector_ = result;
-            } else {
-                // not storing (depth beyond cache_depth_): drop any stale cache
-                if (fully_expand) all_vert_.clear();
-                else link_vector_.clear();
-            }
+            // when not storing (depth beyond cache_depth_), this drops any stale cache
+            vertex_vector &cache = fully_expand ? all_vert_ : link_vector_;
+            old_cache.swap(cache);
+            if (store_vector) cache = result;
         }
+        account_cache();
 
         // return the result vector
         return result;
@@ -222,12 +226,12 @@ namespace pdaggerq {
             search_depth = search_depth == -1 ? -1 : search_depth - 1;
             if (left_->is_linked()) {
                 const auto &left_links =
-                        as_link(left_)->find_links(target_vertex, enter_temps, enter_additions, search_depth);
+                        link_ref(left_).find_links(target_vertex, enter_temps, enter_additions, search_depth);
                 links.insert(links.end(), left_links.begin(), left_links.end());
             }
             if (right_->is_linked()) {
                 const auto &right_links =
-                        as_link(right_)->find_links(target_vertex, enter_temps, enter_additions, search_depth);
+                        link_ref(right_).find_links(target_vertex, enter_temps, enter_additions, search_depth);
                 links.insert(links.end(), right_links.begin(), right_links.end());
             }
         }
@@ -249,12 +253,12 @@ namespace pdaggerq {
             scalars.push_back(this->shallow());
 
         if (left_->is_linked() && left_valid) {
-            const auto &left_scalars = as_link(left_)->find_scalars();
+            const auto &left_scalars = link_ref(left_).find_scalars();
             scalars.insert(scalars.end(), left_scalars.begin(), left_scalars.end());
         }
 
         if (right_->is_linked() && right_valid) {
-            const auto &right_scalars = as_link(right_)->find_scalars();
+            const auto &right_scalars = link_ref(right_).find_scalars();
             scalars.insert(scalars.end(), right_scalars.begin(), right_scalars.end());
         }
 
@@ -275,14 +279,14 @@ namespace pdaggerq {
 
         VertexPtr new_left = left_->shallow(), new_right = right_->shallow();
         if (left_->is_linked()) {
-            const auto &[replaced_left, left_found] = as_link(left_)->replace(target_vertex, new_vertex, exact_match);
+            const auto &[replaced_left, left_found] = link_ref(left_).replace(target_vertex, new_vertex, exact_match);
             if (left_found) {
                 new_left = replaced_left;
                 replaced = true;
             }
         }
         if (right_->is_linked()) {
-            const auto &[replaced_right, right_found] = as_link(right_)->replace(target_vertex, new_vertex, exact_match);
+            const auto &[replaced_right, right_found] = link_ref(right_).replace(target_vertex, new_vertex, exact_match);
             if (right_found) {
                 new_right = replaced_right;
                 replaced = true;
@@ -311,14 +315,14 @@ namespace pdaggerq {
         replaced = false;
         VertexPtr new_left = left_->shallow(), new_right = right_->shallow();
         if (left_->is_linked()) {
-            const auto &[replaced_left, left_found] = as_link(left_)->replace_id(target_vertex, new_id);
+            const auto &[replaced_left, left_found] = link_ref(left_).replace_id(target_vertex, new_id);
             if (left_found) {
                 new_left = replaced_left;
                 replaced = true;
             }
         }
         if (right_->is_linked()) {
-            const auto &[replaced_right, right_found] = as_link(right_)->replace_id(target_vertex, new_id);
+            const auto &[replaced_right, right_found] = link_ref(right_).replace_id(target_vertex, new_id);
             if (right_found) {
                 new_right = replaced_right;
                 replaced = true;
@@ -371,9 +375,9 @@ namespace pdaggerq {
         if (search_depth > 0 || search_depth == -1) {
             search_depth = search_depth == -1 ? -1 : search_depth - 1;
             if (left_->is_linked())
-                if (as_link(left_)->has_temp(temp, enter_temps, search_depth)) return true;
+                if (link_ref(left_).has_temp(temp, enter_temps, search_depth)) return true;
             if (right_->is_linked())
-                if (as_link(right_)->has_temp(temp, enter_temps, search_depth)) return true;
+                if (link_ref(right_).has_temp(temp, enter_temps, search_depth)) return true;
         }
         return false;
     }
@@ -409,17 +413,17 @@ namespace pdaggerq {
         if (search_depth > 0 || search_depth == -1) {
             search_depth = search_depth == -1 ? -1 : search_depth - 1;
             if (left_->is_linked())
-                if (as_link(left_)->has_link(link, enter_temps, search_depth)) return true;
+                if (link_ref(left_).has_link(link, enter_temps, search_depth)) return true;
             if (right_->is_linked())
-                if (as_link(right_)->has_link(link, enter_temps, search_depth)) return true;
+                if (link_ref(right_).has_link(link, enter_temps, search_depth)) return true;
         }
         return false;
     }
 
     bool Linkage::has_any_temp() const {
         if (is_temp()) return true;
-        if (left_->is_linked() && as_link(left_)->has_any_temp()) return true;
-        if (right_->is_linked() && as_link(right_)->has_any_temp()) return true;
+        if (left_->is_linked() && link_ref(left_).has_any_temp()) return true;
+        if (right_->is_linked() && link_ref(right_).has_any_temp()) return true;
         return false;
     }
 
@@ -435,12 +439,12 @@ namespace pdaggerq {
         }
 
         if (left_->is_linked()) {
-            const auto &left_temps = as_link(left_)->get_temps(enter_temps, enter_additions);
+            const auto &left_temps = link_ref(left_).get_temps(enter_temps, enter_additions);
             temps.insert(temps.end(), left_temps.begin(), left_temps.end());
         }
 
         if (right_->is_linked()) {
-            const auto &right_temps = as_link(right_)->get_temps(enter_temps, enter_additions);
+            const auto &right_temps = link_ref(right_).get_temps(enter_temps, enter_additions);
             temps.insert(temps.end(), right_temps.begin(), right_temps.end());
         }
 
@@ -461,11 +465,11 @@ namespace pdaggerq {
         }
 
         if (left_->is_linked()) {
-            const auto &left_ids = as_link(left_)->get_ids(type);
+            const auto &left_ids = link_ref(left_).get_ids(type);
             ids.insert(left_ids.begin(), left_ids.end());
         }
         if (right_->is_linked()) {
-            const auto &right_ids = as_link(right_)->get_ids(type);
+            const auto &right_ids = link_ref(right_).get_ids(type);
             ids.insert(right_ids.begin(), right_ids.end());
         }
 
@@ -479,13 +483,19 @@ namespace pdaggerq {
         {
             std::lock_guard<std::mutex> lock(mtx_);
             result = permutations_;
-            if (!regenerate && !result.empty())
+            if (!regenerate && !result.empty()) {
+                if (cache_bounded()) {
+                    ++cache_hits_;
+                    cache_used_ = true;
+                }
                 return result;
+            }
             if (empty()) {
                 result.clear();
                 return result;
             }
         }
+        if (cache_bounded()) ++cache_misses_;
 
         // Temps have fixed structure; only the identity permutation applies
         if (is_temp())
@@ -494,9 +504,9 @@ namespace pdaggerq {
         // Degenerate: one side is empty — delegate to the non-empty side
         if (left_->empty() || right_->empty()) {
             if (left_->empty() && right_->is_linked())
-                result = as_link(right_)->permutations(regenerate);
+                result = link_ref(right_).permutations(regenerate);
             else if (right_->empty() && left_->is_linked())
-                result = as_link(left_)->permutations(regenerate);
+                result = link_ref(left_).permutations(regenerate);
             else
                 result = {as_link(shallow())};
             return result;
@@ -517,11 +527,11 @@ namespace pdaggerq {
 
         if (left_->is_linked()) {
             if (!is_add) {
-                const linkage_vector &lperms = as_link(left_)->permutations(regenerate);
+                const linkage_vector &lperms = link_ref(left_).permutations(regenerate);
                 left_vp.insert(left_vp.end(), lperms.begin(), lperms.end());
             } else {
                 // for additions, we only add the best permutation of the left vertex to avoid generating duplicate permutations
-                left_vp.push_back(as_link(left_)->best_permutation());
+                left_vp.push_back(link_ref(left_).best_permutation());
             }
         } else {
             left_vp.push_back(left_);
@@ -529,11 +539,11 @@ namespace pdaggerq {
 
         if (right_->is_linked()) {
             if (!is_add) {
-                const linkage_vector &rperms = as_link(right_)->permutations(regenerate);
+                const linkage_vector &rperms = link_ref(right_).permutations(regenerate);
                 right_vp.insert(right_vp.end(), rperms.begin(), rperms.end());
             } else {
                 // for additions, we only add the best permutation of the right vertex to avoid generating duplicate permutations
-                right_vp.push_back(as_link(right_)->best_permutation());
+                right_vp.push_back(link_ref(right_).best_permutation());
             }
         } else {
             right_vp.push_back(right_);
@@ -658,15 +668,66 @@ namespace pdaggerq {
         // Store or discard the cache under the lock
         const size_t depth = this->depth();
         const bool cache_permutations = cache_elements_ && cache_depth_ >= depth;
+        linkage_vector old_permutations; // released after the lock
         {
             std::lock_guard<std::mutex> lock(mtx_);
+            old_permutations.swap(permutations_);
             if (cache_permutations) permutations_ = result;
-            else permutations_.clear();
         }
+        account_cache();
         return result;
 
     }
 
+    /**
+     * Decide whether one arrangement of a linkage is better than the best found so far: fewer flops, then
+     * less memory, then a more linear chain, fewer lines, and finally the smaller name (if compare_names)
+     */
+    static bool better_permutation(const LinkagePtr &perm, const scaling_map &flops, const scaling_map &mems,
+                                   const LinkagePtr &best_perm, const scaling_map &best_flops, const scaling_map &best_mems,
+                                   bool compare_names = true) {
+
+        // check if flops current permutation is better than best permutation
+        int scaling_check = flops.compare(best_flops);
+
+        bool make_best = scaling_check == scaling_map::this_better;
+        if (!make_best && scaling_check == scaling_map::this_same) {
+            // if flops are the same, check mems
+            scaling_check = mems.compare(best_mems);
+            make_best = scaling_check == scaling_map::this_better;
+
+            // if mems are the same, prefer linear chains
+            if (!make_best && scaling_check == scaling_map::this_same) {
+                make_best = perm->right()->depth() < best_perm->right()->depth();
+                bool same_depth = perm->right()->depth() == best_perm->right()->depth();
+                VertexPtr left_perm = perm->left();
+                VertexPtr left_best = best_perm->left();
+                while (same_depth && !make_best) {
+                    if (left_perm->is_linked() && left_best->is_linked()) {
+                        make_best = as_link(left_perm)->right()->depth() < as_link(left_best)->right()->depth();
+                        same_depth = as_link(left_perm)->right()->depth() == as_link(left_best)->right()->depth();
+                        left_perm = as_link(left_perm)->left();
+                        left_best = as_link(left_best)->left();
+                    } else {
+                        break;
+                    }
+                }
+            }
+
+            // if the right vertex expandability is the same, prefer the permutation with less dimensions (i.e., less lines)
+            if (!make_best && scaling_check == scaling_map::this_same) {
+                make_best = perm->lines() < best_perm->lines();
+            }
+
+            // if lines are the same, use string representation of names
+            if (!make_best && compare_names && scaling_check == scaling_map::this_same) {
+                make_best = perm->name() < best_perm->name();
+            }
+        }
+
+        return make_best;
+    }
+
     LinkagePtr Linkage::best_permutation() const {
 
         // initialize the best permutation as the current linkage
@@ -684,45 +745,7 @@ namespace pdaggerq {
         for (const auto &perm : all_perms) {
             auto [flops, mems] = perm->netscales();
 
-            // check if flops current permutation is better than best permutation
-            int scaling_check = flops.compare(best_flops);
-
-            bool make_best = scaling_check == scaling_map::this_better;
-            if (!make_best && scaling_check == scaling_map::this_same) {
-                // if flops are the same, check mems
-                scaling_check = mems.compare(best_mems);
-                make_best = scaling_check == scaling_map::this_better;
-
-                // if mems are the same, prefer linear chains
-                if (!make_best && scaling_check == scaling_map::this_same) {
-                    make_best = perm->right_->depth() < best_perm->right_->depth();
-                    bool same_depth = perm->right_->depth() == best_perm->right_->depth();
-                    VertexPtr left_perm = perm->left_;
-                    VertexPtr left_best = best_perm->left_;
-                    while (same_depth && !make_best) {
-                        if (left_perm->is_linked() && left_best->is_linked()) {
-                            make_best = as_link(left_perm)->right_->depth() < as_link(left_best)->right_->depth();
-                            same_depth = as_link(left_perm)->right_->depth() == as_link(left_best)->right_->depth();
-                            left_perm = as_link(left_perm)->left_;
-                            left_best = as_link(left_best)->left_;
-                        } else {
-                            break;
-                        }
-                    }
-                }
-
-                // if the right vertex expandability is the same, prefer the permutation with less dimensions (i.e., less lines)
-                if (!make_best && scaling_check == scaling_map::this_same) {
-                    make_best = perm->lines() < best_perm->lines();
-                }
-
-                // if lines are the same, use string representation of names
-                if (!make_best && scaling_check == scaling_map::this_same) {
-                    make_best = perm->name() < best_perm->name();
-                }
-            }
-
-            if (make_best) {
+            if (better_permutation(perm, flops, mems, best_perm, best_flops, best_mems)) {
                 best_flops = flops;
                 best_mems = mems;
                 best_perm = perm;
@@ -733,6 +756,80 @@ namespace pdaggerq {
         return best_perm;
     }
 
+    /**
+     * Collect the factors of a product (intermediates and additions are not entered)
+     * @param vertex root of the product
+     * @param factors the factors, from left to right
+     * @return false if the product contains an addition or a constant factor
+     */
+    static bool product_factors(const VertexPtr &vertex, vertex_vector &factors) {
+        if (vertex->empty()) return true;
+        if (vertex->is_linked() && !vertex->is_temp()) {
+            if (vertex->is_addition()) return false;
+            LinkagePtr link = as_link(vertex);
+            return product_factors(link->left(), factors) && product_factors(link->right(), factors);
+        }
+        if (vertex->is_constant()) return false;
+        factors.push_back(vertex);
+        return true;
+    }
+
+    LinkagePtr Linkage::best_contraction_tree() const {
+
+        if (is_temp() || empty()) return best_permutation();
+
+        vertex_vector factors;
+        if (!product_factors(as_link(shallow()), factors)) return best_permutation();
+
+        const size_t n = factors.size();
+        if (n < 3 || n > max_contraction_tree_size_) return best_permutation();
+
+        // best tree (and its scaling) for every subset of the factors, built up from smaller
+        // subsets. the scaling of a tree is the sum of that of its two subtrees and of the
+        // contraction joining them, which only depends on which factors are on each side.
+        // so the best tree of a subset always joins the best trees of two smaller subsets.
+        struct subset_tree {
+            VertexPtr tree;
+            scaling_map flops, mems;
+        };
+        const size_t n_subsets = (size_t) 1 << n;
+        vector<subset_tree> best(n_subsets);
+        for (size_t i = 0; i < n; i++) {
+            best[(size_t) 1 << i].tree = factors[i];
+        }
+
+        for (size_t subset = 1; subset < n_subsets; subset++) {
+            if ((subset & (subset - 1)) == 0) continue; // single factor
+
+            // start from the split that keeps the original order of the factors (the last factor on the
+            // right), so that ties are broken in favor of the input order rather than by name
+            size_t last = (size_t) 1 << (n - 1);
+            while (!(subset & last)) last >>= 1;
+            const size_t in_order = subset & ~last;
+
+            LinkagePtr best_link = as_link(best[in_order].tree * best[last].tree);
+            std::tie(best[subset].flops, best[subset].mems) = best_link->netscales();
+
+            for (size_t left = (subset - 1) & subset; left > 0; left = (left - 1) & subset) {
+                if (left == in_order) continue;
+                const size_t right = subset & ~left;
+
+                LinkagePtr link = as_link(best[left].tree * best[right].tree);
+                auto [flops, mems] = link->netscales();
+                if (better_permutation(link, flops, mems, best_link, best[subset].flops, best[subset].mems, false)) {
+                    best[subset].flops = flops;
+                    best[subset].mems = mems;
+                    best_link = link;
+                }
+            }
+            best[subset].tree = best_link;
+        }
+
+        MutableLinkagePtr best_tree = as_link(best[n_subsets - 1].tree->shallow());
+        best_tree->copy_misc(*this);
+        return best_tree;
+    }
+
     linkage_vector Linkage::subgraphs(size_t max_depth) const {
 
         if (is_temp()) { // do not generate subgraphs for temps
@@ -23,8 +23,10 @@
 
 #include "pybind11/pybind11.h"
 #include "pybind11/stl.h"
+#include "pybind11/numpy.h"
 #include "../include/pq_graph.h"
 #include "../include/printers/code_printer.h"
+#include "../runtime/pq_runtime.hpp"
 
 // include omp only if defined
 #ifdef _OPENMP
@@ -33,6 +35,7 @@
     #define omp_get_max_threads() 1
     #define omp_set_num_threads(n) 1
 #endif
+#include <algorithm>
 #include <memory>
 
 namespace py = pybind11;
@@ -66,6 +69,9 @@ namespace pdaggerq {
                 .def("analysis", &pdaggerq::PQGraph::analysis)
                 .def("clear", &pdaggerq::PQGraph::clear)
                 .def("write_dot", &pdaggerq::PQGraph::write_dot)
+                .def("dependency_graph", [](PQGraph& self, const std::string &print_type) {
+                    return self.dependency_graph(print_type);
+                }, py::arg("print_type") = "")
                 .def("reorder", [](PQGraph& self) {
                     bool old_opt_level = self.opt_level_; self.opt_level_ = 1;
                     self.reorder();                       self.opt_level_ = old_opt_level;
@@ -90,6 +96,62 @@ namespace pdaggerq {
                     bool old_opt_level = self.opt_level_; self.opt_level_ = 6;
                     self.merge_intermediates();           self.opt_level_ = old_opt_level;
                 })
+                .def("evaluate", [](PQGraph& self, const py::dict &tensors, const py::dict &includes) {
+                    // use the arrays without copying: a C-ordered array is the column-major tensor of its reversed axes
+                    using array = py::array_t<double, py::array::c_style | py::array::forcecast>;
+                    vector<array> arrays; // keep converted arrays alive during the evaluation
+                    auto view = [&arrays](const py::handle &value) {
+                        arrays.push_back(array::ensure(value));
+                        const array &values = arrays.back();
+                        if (!values) throw invalid_argument("evaluate: tensors must be arrays of floats");
+                        vector<size_t> dims(values.shape(), values.shape() + values.ndim());
+                        std::reverse(dims.begin(), dims.end());
+                        return pq_runtime::Tensor::view(const_cast<double *>(values.data()), dims);
+                    };
+
+                    tensor_map inputs;
+                    for (auto item : tensors) {
+                        string name = item.first.cast<string>();
+                        if (!py::isinstance<py::dict>(item.second)) {
+                            inputs[name][""] = view(item.second);
+                            continue;
+                        }
+                        for (auto block : item.second.cast<py::dict>())
+                            inputs[name][block.first.cast<string>()] = view(block.second);
+                    }
+
+                    map<string, bool> conditions;
+                    for (auto item : includes)
+                        conditions[item.first.cast<string>()] = item.second.cast<bool>();
+
+                    tensor_map outputs;
+                    {
+                        py::gil_scoped_release release;
+                        outputs = self.evaluate(inputs, conditions, true);
+                    }
+
+                    // hand the storage of the outputs to numpy (scalars are returned as floats)
+                    auto as_array = [](pq_runtime::Tensor &tensor) -> py::object {
+                        if (tensor.rank() == 0) return py::float_(tensor[0]);
+                        auto *owner = new pq_runtime::Tensor(std::move(tensor));
+                        py::capsule free_owner(owner, [](void *ptr) { delete static_cast<pq_runtime::Tensor *>(ptr); });
+                        vector<py::ssize_t> shape(owner->dims().rbegin(), owner->dims().rend());
+                        return py::array_t<double>(shape, owner->data(), free_owner);
+                    };
+
+                    py::dict result;
+                    for (auto &[name, blocks] : outputs) {
+                        if (blocks.size() == 1 && blocks.count("")) {
+                            if (blocks[""].allocated()) result[name.c_str()] = as_array(blocks[""]);
+                            continue;
+                        }
+                        py::dict block_arrays;
+                        for (auto &[block, tensor] : blocks)
+                            if (tensor.allocated()) block_arrays[block.c_str()] = as_array(tensor);
+                        result[name.c_str()] = block_arrays;
+                    }
+                    return result;
+                }, py::arg("tensors"), py::arg("includes") = py::dict())
                 .def("optimize", &pdaggerq::PQGraph::optimize);
     }
 
@@ -125,6 +187,14 @@ namespace pdaggerq {
             max_temps_ = (size_t) options["max_temps"].cast<long>();
         }
 
+        if (options.contains("time_budget")) {
+            time_budget_ = options["time_budget"].cast<double>();
+            if (time_budget_ < 0) time_budget_ = -1; // no limit
+        }
+
+        if (options.contains("max_rounds"))
+            max_rounds_ = (size_t) options["max_rounds"].cast<long>();
+
         if( options.contains("max_depth")) {
                 Term::max_depth_ = (size_t) options["max_depth"].cast<long>();
                 if (Term::max_depth_ < 1ul) {
@@ -182,11 +252,7 @@ namespace pdaggerq {
                 max_v = static_cast<size_t>(max_shape_map.at("v"));
             }
 
-            Term::max_shape_.n_  = max_o + max_v;
-            Term::max_shape_.o_  = max_o;
-            Term::max_shape_.oa_ = max_o;
-            Term::max_shape_.v_  = max_v;
-            Term::max_shape_.va_ = max_v;
+            Term::max_shape_ = shape(max_o, 0, max_v, 0);
 
         } else if (options.contains("max_shape")) { // define by parsing a string (e.g. o2v2 or o5v12 or o0v4)
             string max_shape_str = options["max_shape"].cast<string>();
@@ -210,21 +276,16 @@ namespace pdaggerq {
                 throw invalid_argument("max_shape values must be less than or equal to " + std::to_string(static_cast<size_t>(-1l)/2l));
             }
             // set the max shape
-            Term::max_shape_.n_  = max_o + max_v;
-            Term::max_shape_.o_  = max_o;
-            Term::max_shape_.oa_ = max_o;
-            Term::max_shape_.v_  = max_v;
-            Term::max_shape_.va_ = max_v;
+            Term::max_shape_ = shape(max_o, 0, max_v, 0);
         }
         else {
             auto n_max = static_cast<size_t>(-1l);
-            Term::max_shape_.n_  = n_max;
-            Term::max_shape_.o_  = n_max;
-            Term::max_shape_.oa_ = n_max;
-            Term::max_shape_.v_  = n_max;
-            Term::max_shape_.va_ = n_max;
+            Term::max_shape_ = shape(n_max, 0, n_max, 0);
         }
 
+        if (options.contains("batch_lines"))
+            Term::max_batch_lines_ = options["batch_lines"].cast<size_t>();
+
         if (options.contains("cache_elements")) {
             Linkage::cache_elements_ = options["cache_elements"].cast<bool>();
         }
@@ -233,6 +294,13 @@ namespace pdaggerq {
             Linkage::cache_depth_ = options["cache_depth"].cast<size_t>();
         }
 
+        if (options.contains("max_cache_size")) {
+            double max_cache_size = options["max_cache_size"].cast<double>();
+            if (max_cache_size < 0)
+                 Linkage::max_cache_bytes_ = static_cast<size_t>(-1l);
+            else Linkage::max_cache_bytes_ = static_cast<size_t>(max_cache_size * 1024 * 1024);
+        }
+
         if (options.contains("expand_permutations")) {
             expand_permutations_ = options["expand_permutations"].cast<bool>();
         }
@@ -248,6 +316,23 @@ namespace pdaggerq {
 
         }
 
+        if (options.contains("lazy_greedy"))
+            lazy_greedy_ = options["lazy_greedy"].cast<bool>();
+
+        if (options.contains("beam_width")) {
+            long beam_width = options["beam_width"].cast<long>();
+            if (beam_width < 1)
+                throw invalid_argument("beam_width must be at least 1");
+            beam_width_ = static_cast<size_t>(beam_width);
+        }
+
+        if (options.contains("beam_depth")) {
+            long beam_depth = options["beam_depth"].cast<long>();
+            if (beam_depth < 0)
+                throw invalid_argument("beam_depth must be non-negative");
+            beam_depth_ = static_cast<size_t>(beam_depth);
+        }
+
         if (options.contains("batched")) {
             batched_ = options["batched"].cast<bool>();
             if (batched_) batch_size_ = 1ul;
@@ -266,6 +351,27 @@ namespace pdaggerq {
             shape::nocc_ = static_cast<size_t>(options["nocc"].cast<long>());
         if (options.contains("nvirt"))
             shape::nvirt_ = static_cast<size_t>(options["nvirt"].cast<long>());
+        if (options.contains("nocc_a"))
+            shape::nocc_a_ = static_cast<size_t>(options["nocc_a"].cast<long>());
+        if (options.contains("nocc_b"))
+            shape::nocc_b_ = static_cast<size_t>(options["nocc_b"].cast<long>());
+        if (options.contains("nvirt_a"))
+            shape::nvirt_a_ = static_cast<size_t>(options["nvirt_a"].cast<long>());
+        if (options.contains("nvirt_b"))
+            shape::nvirt_b_ = static_cast<size_t>(options["nvirt_b"].cast<long>());
+        if (options.contains("naux"))
+            shape::naux_ = static_cast<size_t>(options["naux"].cast<long>());
+        if (options.contains("nroots"))
+            shape::nroots_ = static_cast<size_t>(options["nroots"].cast<long>());
+
+        if (options.contains("cost_model")) {
+            auto cost_model = options["cost_model"].cast<string>();
+            if (cost_model == "numeric") scaling_map::numeric_cost_ = true;
+            else if (cost_model == "asymptotic") scaling_map::numeric_cost_ = false;
+            else throw invalid_argument("cost_model must be 'asymptotic' or 'numeric'.");
+        }
+        if (scaling_map::numeric_cost_ && (shape::nocc_ == 0 || shape::nvirt_ == 0))
+            throw invalid_argument("cost_model 'numeric' requires nocc and nvirt to be set.");
 
 
         if (options.contains("nthreads")) {
@@ -338,6 +444,15 @@ namespace pdaggerq {
         if (options.contains("deallocate"))
             Term::deallocate_ = options["deallocate"].cast<bool>();
 
+        if (options.contains("buffer_pool"))
+            Term::buffer_pool_ = options["buffer_pool"].cast<bool>();
+
+        if (options.contains("task_parallel"))
+            Term::task_parallel_ = options["task_parallel"].cast<bool>();
+
+        if (options.contains("loop_tile"))
+            Term::loop_tile_ = options["loop_tile"].cast<size_t>();
+
         if (options.contains("binarize"))
             Term::binarize_ = options["binarize"].cast<bool>();
 
@@ -384,6 +499,17 @@ namespace pdaggerq {
         cout << "    deallocate: " << (Term::deallocate_ ? "true" : "false")
              << "  // whether to insert deallocation statements for intermediates after last use (default: true)" << endl;
 
+        cout << "    buffer_pool: " << (Term::buffer_pool_ ? "true" : "false")
+             << "  // whether intermediates with disjoint live ranges share a pool of buffers (blas and loop; default: true)" << endl
+             << "                 // requires deallocate; the generated code reports its estimated peak memory." << endl;
+
+        cout << "    task_parallel: " << (Term::task_parallel_ ? "true" : "false")
+             << "  // whether to evaluate independent statements as OpenMP tasks (blas and loop; default: false)" << endl
+             << "                   // tasks are ordered by depend clauses; accumulations into the same tensor are mutually exclusive." << endl;
+
+        cout << "    loop_tile: " << Term::loop_tile_
+             << "  // tile size of the loops over virtual indices in contractions (loop printer; default: 32; 0 for no tiling)" << endl;
+
         cout << "    binarize: " << (Term::binarize_ ? "true" : "false")
              << "  // whether to decompose contractions into binary operations (default: false)" << endl;
 
@@ -404,19 +530,49 @@ namespace pdaggerq {
         cout << "    batch_size: " << (long) batch_size_
              << "  // size of the batch for batched substitution (default: 10; -1 for no limit)" << endl;
 
+        cout << "    lazy_greedy: " << (lazy_greedy_ ? "true" : "false")
+             << "  // only retest the best candidate substitution after each substitution (default: false)" << endl;
+        cout << "                   // Generally faster, but may not yield the same results as retesting every candidate." << endl;
+
+        cout << "    beam_width: " << beam_width_
+             << "  // number of substitution sequences kept by a beam search (default: 1 for greedy substitution)" << endl;
+
+        cout << "    beam_depth: " << beam_depth_
+             << "  // number of greedy substitutions to look ahead when ranking sequences in the beam (default: 2)" << endl;
+
         cout << "    max_temps: " << (long) max_temps_
              << "  // maximum number of intermediates to find (default: -1 for no limit)" << endl;
 
+        cout << "    time_budget: " << time_budget_
+             << "  // time in seconds after which optimize() keeps the intermediates found so far, over all passes (default: -1 for no limit)" << endl;
+
+        cout << "    max_rounds: " << (long) max_rounds_
+             << "  // maximum number of intermediate substitution rounds in optimize(), over all passes but the scalar pass (default: -1 for no limit)" << endl;
+
         cout << "    max_depth: " << (long) Term::max_depth_
              << "  // maximum depth for chain of contractions (default: -1 for no limit)" << endl;
 
         cout << "    max_shape: " << Term::max_shape_.str() << " // a map of maximum sizes for each line type in an intermediate (default: {o: 255, v: 255}, "
                                                                "for no limit.): " << endl;
 
+        cout << "    batch_lines: " << Term::max_batch_lines_
+             << "  // number of output lines an intermediate above max_shape may be built and used in batches over" << endl
+             << "                  // (loop and blas printers; optimize() removes those whose uses cannot be batched;" << endl
+             << "                  // default: 0 to reject such intermediates)" << endl;
+
         cout << "    nocc: " << (shape::nocc_ ? std::to_string(shape::nocc_) : "0")
              << "  // number of occupied orbitals (default: 0 for arbitrary systems)" << endl;
         cout << "    nvirt: " << (shape::nvirt_ ? std::to_string(shape::nvirt_) : "0")
              << "  // number of virtual orbitals (default: 0 for arbitrary systems)" << endl;
+        cout << "    nocc_a, nocc_b, nvirt_a, nvirt_b: " << shape::nocc_a_ << ", " << shape::nocc_b_ << ", "
+             << shape::nvirt_a_ << ", " << shape::nvirt_b_
+             << "  // numbers of alpha/beta orbitals (default: 0 to use nocc and nvirt)" << endl;
+        cout << "    naux: " << shape::naux_
+             << "  // number of auxiliary functions for density (Q) indices (default: 0 for 5 * (nocc + nvirt))" << endl;
+        cout << "    nroots: " << shape::nroots_
+             << "  // number of roots for sigma (L) indices in cost estimates (default: 10)" << endl;
+        cout << "    cost_model: " << (scaling_map::numeric_cost_ ? "numeric" : "asymptotic")
+             << "  // rank contractions by asymptotic scaling or by estimated cost for nocc and nvirt (default: asymptotic)" << endl;
 
         cout << "    cache_elements: " << (Linkage::cache_elements_ ? "true" : "false")
              << "  // whether to cache the elements and permutations of linkages for faster access (default: true)" << endl;
@@ -424,6 +580,12 @@ namespace pdaggerq {
 	    cout << "    cache_depth: " << Linkage::cache_depth_
 	         << "  // maximum depth of linkages to cache in memory (default: 16)" << endl;
 
+        cout << "    max_cache_size: ";
+        if (Linkage::cache_bounded())
+             cout << (double) Linkage::max_cache_bytes_ / (1024 * 1024);
+        else cout << -1;
+        cout << "  // maximum memory in MB for cached elements and permutations of linkages (default: -1 for no limit)" << endl;
+
         cout << "    nthreads: " << nthreads_
              << "  // number of threads to use (default: OMP_NUM_THREADS | available: "
              << omp_get_max_threads() << ")" << endl;
@@ -755,6 +917,22 @@ namespace pdaggerq {
             cout << " (initial: " << num_terms_init_ << ")";
         cout << endl;
         cout << "Total Contractions: (last) " << n_flop_ops_pre << " -> (new) " << n_flop_ops << endl << endl;
+        if (Linkage::cache_bounded()) {
+            cout << "Linkage cache: " << Linkage::cache_hits_ << " hits, " << Linkage::cache_misses_ << " misses, "
+                 << Linkage::cache_evictions_ << " evictions, "
+                 << (double) Linkage::cache_size() / (1024 * 1024) << " MB in use" << endl << endl;
+        }
+        if (!pass_rounds_.empty()) {
+            cout << "Substitution rounds:";
+            for (size_t i = 0; i < pass_rounds_.size(); ++i)
+                cout << (i == 0 ? " " : ", ") << pass_rounds_[i].first << " " << pass_rounds_[i].second;
+            cout << endl;
+        }
+        if (!stop_reason_.empty()) {
+            cout << "Substitutions stopped by " << stop_reason_ << " after " << num_rounds_ << " intermediate rounds;"
+                 << " intermediates found so far are kept." << endl;
+        }
+        if (!pass_rounds_.empty() || !stop_reason_.empty()) cout << endl;
         cout << "Total FLOP scaling: " << endl;
         cout << "------------------" << endl;
         print_new_scaling(flop_map_init_, flop_map_pre_, is_optimized_ ? flop_map_ : flop_map_pre_);
@@ -782,7 +960,7 @@ namespace pdaggerq {
         auto last_order = static_cast<size_t>(-1);
         for (const auto & key : orig_merged + prev_merged + curr_merged) {
             shape cur_shape = key.first;
-            size_t new_order = cur_shape.n_;
+            size_t new_order = cur_shape.n();
             if (new_order < last_order) {
                 printf("%8s : %5s | %5s | %5s || %5s | %5s\n" , "--------", "-----", "-----", "-----", "-----", "----");
                 last_order = new_order;
@@ -821,13 +999,12 @@ namespace pdaggerq {
         print_guard guard;
         if (print_level_ < 1) guard.lock();
 
-        // Pin the printer backend for the duration of optimization. Candidate ordering
-        // keys are built from str()/tot_str(), which branch on Vertex::printer_ -- a
-        // process-wide pointer that to_strings() overwrites (set_printer). Without pinning,
-        // the optimization result depends on which output format was last emitted in the
-        // process, so the FIRST optimize() in a process (printer_ at its default) differs
-        // from every later one (printer_ left at the last-emitted backend). Force a fixed
-        // backend here and restore it after. (Declared after the print_guard so
+        // Pin the printer backend for the duration of optimization. Candidate ordering uses
+        // the printer-independent structure_key()/label_key(), but vertex names -- and with
+        // them the linkage hashes and the names of new vertices -- are still formatted by
+        // Vertex::printer_, a process-wide pointer that to_strings() overwrites
+        // (set_printer). Force a fixed backend here so vertices made during optimization
+        // agree with each other, and restore it after. (Declared after the print_guard so
         // set_printer's status line is suppressed, and destroyed before it so the restore
         // is suppressed too.)
         const CodePrinter *saved_printer = Vertex::printer_;
@@ -842,6 +1019,12 @@ namespace pdaggerq {
             mem_map_init_ = mem_map_;
         }
 
+        // start the budget for substitutions
+        optimize_start_ = std::chrono::steady_clock::now();
+        num_rounds_ = 0;
+        pass_rounds_.clear();
+        stop_reason_.clear();
+
         // set initial number of terms
         if (num_terms_init_ == 0)
             num_terms_init_ = get_num_terms();
@@ -863,6 +1046,7 @@ namespace pdaggerq {
         // substitute scalars first
         if (opt_level_ >= 1) {
             cout << "----- Substituting scalars -----" << endl;
+            pass_rounds_.emplace_back("scalars", 0);
             substitute(false, true);
         }
         if (opt_level_ >= 2) {
@@ -872,23 +1056,27 @@ namespace pdaggerq {
                 cout << "----- Separating Intermediates for sigma-vector build -----" << endl;
             else cout << "----- Substituting intermediates -----" << endl;
 
-            substitute(separate_sigma_, false);
+            pass_rounds_.emplace_back(separate_sigma_ ? "sigma intermediates" : "intermediates", 0);
+            beam_substitute(separate_sigma_);
 
             if (separate_sigma_) {
                 // apply substitutions again without separating intermediates
                 cout << "----- Substituting all intermediates -----" << endl;
-                substitute(false, false);
+                pass_rounds_.emplace_back("all intermediates", 0);
+                beam_substitute(false);
             }
         }
 
-        // clean up unused intermediates
+        // clean up unused intermediates, and those above max_shape that cannot be built in batches
         update_timer.start();
+        while (expand_unbatchable() > 0);
         prune(false);
         merge_terms();
         reorder(true);
 
         // set optimized flag to true
         is_optimized_ = true;
+        optimize_start_ = {};
 
         // recollect scaling of equations
         collect_scaling(true, true);
@@ -63,10 +63,14 @@ string BLASPrinter::format_intermediate_name(const Linkage* link, bool) const {
 }
 
 string BLASPrinter::allocate(const string& name) const {
+    string pooled = c_pool_acquire(buffers_, scratch_prefix(), name);
+    if (!pooled.empty()) return pooled;
     return name + " = (double*)calloc(" + name + "_size, sizeof(double));";
 }
 
 string BLASPrinter::deallocate(const string& name) const {
+    string pooled = c_pool_release(buffers_, scratch_prefix(), name);
+    if (!pooled.empty()) return pooled;
     return "free(" + name + "); " + name + " = NULL;";
 }
 
@@ -119,179 +123,401 @@ string BLASPrinter::format_declarations(const set<string>& names) const {
     // size variables for intermediates
     out += "\n/* Intermediate size variables (calloc argument):\n";
     out += " *   work__*_size = nocc * nvirt * ...\n";
+    out += " * Intermediates built in batches are assigned the size of one slice before their allocation.\n";
     out += " */\n";
     return out;
 }
 
-// ── DGEMM generation ────────────────────────────────────────────────────
+// ── Index layouts ───────────────────────────────────────────────────────
+//
+// Tensors are stored with the first index fastest (column major). A binary
+// contraction maps onto one DGEMM, C(M,N) = op(X)(M,K) * op(Y)(K,N), when
+// each operand stores its free and contracted lines as two ordered blocks.
+// plan() picks the stored order of every intermediate so that this holds for
+// as many terms as possible; dgemm_call() transposes whatever still does not
+// fit into scratch buffers (TTGT: transpose-transpose-GEMM-transpose).
+
+namespace {
+
+// lines that are a dimension of the stored tensor (trial lines only when requested)
+line_vector materialized(const line_vector& lines) {
+    line_vector out;
+    out.reserve(lines.size());
+    for (const Line& line : lines)
+        if (!line.sig_ || Vertex::use_trial_index) out.push_back(line);
+    return out;
+}
 
-string BLASPrinter::dgemm_call(const Term& t) const {
-    LinkagePtr link = as_link(t.term_linkage(true));
-    const auto& ops = link->link_vector();
+long index_of(const line_vector& lines, const Line& line) {
+    for (size_t i = 0; i < lines.size(); ++i)
+        if (lines[i].label_ == line.label_) return (long) i;
+    return -1;
+}
+
+bool same_order(const line_vector& a, const line_vector& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i].label_ != b[i].label_) return false;
+    return true;
+}
 
-    if (ops.size() < 2) return "";
+line_vector concat(const line_vector& a, const line_vector& b) {
+    line_vector out = a;
+    out.insert(out.end(), b.begin(), b.end());
+    return out;
+}
 
-    // Extract tensor-only operators
-    vertex_vector tensors;
-    for (const auto& op : ops) {
-        if (op->empty()) continue;
-        if (op->rank() == 0 && op->lines().empty()) continue;
-        tensors.push_back(op);
+// lines of `order` that are in `subset`, in the order of `order`
+line_vector in_order(const line_vector& order, const line_vector& subset) {
+    line_vector out;
+    for (const Line& line : order)
+        if (index_of(subset, line) >= 0) out.push_back(line);
+    return out;
+}
+
+// product of the dimensions of the lines ("1" for none)
+string dim_product(const line_vector& lines) {
+    string prod;
+    for (const Line& line : lines) {
+        string dn = BLASPrinter::instance().dim_name(line.type());
+        if (dn.empty()) continue;
+        if (!prod.empty()) prod += " * ";
+        prod += dn;
     }
-    if (tensors.size() != 2) return "";
+    return prod.empty() ? "1" : prod;
+}
 
-    const VertexPtr& A = tensors[0];
-    const VertexPtr& B = tensors[1];
+// estimated number of elements, used to decide which operand is cheaper to transpose
+double element_estimate(const line_vector& lines) {
+    double size = shape(lines).size();
+    if (size > 0) return size;
 
-    size_t a_n = A->lines().size();
-    size_t b_n = B->lines().size();
+    // no dimension sizes given: assume five virtual orbitals per occupied orbital
+    size = 1;
+    for (const Line& line : lines)
+        size *= line.type() == 'v' ? 50 : 10;
+    return size;
+}
 
-    // Build per-operand free/contracted lookup using connec_map_
-    // connec_map_ entry {L, R}: both >= 0 => contracted; one -1 => free
-    vector<bool> a_contr(a_n, false);
-    vector<bool> b_contr(b_n, false);
+// column-major offset of an element, using the line labels as loop variables
+string offset_expr(const line_vector& lines) {
+    string off, stride;
+    for (const Line& line : lines) {
+        if (!off.empty()) off += " + ";
+        off += stride.empty() ? line.label_ : line.label_ + " * " + stride;
+        string dn = BLASPrinter::instance().dim_name(line.type());
+        stride += stride.empty() ? dn : " * " + dn;
+    }
+    return off.empty() ? "0" : off;
+}
+
+// whether a line is fixed by an enclosing batch loop (labelled by its loop variable, see term_lines)
+bool is_fixed(const Term& t, const Line& line) {
+    for (const auto& [label, var] : t.batch_labels_)
+        if (line.label_ == var) return true;
+    return false;
+}
 
-    for (const auto& entry : link->connec_map_) {
-        int_fast8_t left_pos  = entry[0];
-        int_fast8_t right_pos = entry[1];
-        if (left_pos >= 0 && right_pos >= 0) {
-            a_contr[static_cast<size_t>(left_pos)] = true;
-            b_contr[static_cast<size_t>(right_pos)] = true;
+// lines that are not fixed by an enclosing batch loop
+line_vector unfixed(const Term& t, const line_vector& lines) {
+    line_vector out;
+    for (const Line& line : lines)
+        if (!is_fixed(t, line)) out.push_back(line);
+    return out;
+}
+
+// nested loops that store src (in src_lines order) into dst (in dst_lines order);
+// the first line of dst is innermost so that the writes are contiguous. Lines fixed
+// by a batch loop (see term_lines) are not looped over.
+string permute_loops(const string& dst, const line_vector& dst_lines,
+                     const string& src, const line_vector& src_lines, const string& op,
+                     const Term* batched = nullptr) {
+    string loops, indent;
+    size_t depth = 0;
+    for (size_t i = dst_lines.size(); i-- > 0;) {
+        if (batched && is_fixed(*batched, dst_lines[i])) continue;
+        const string& var = dst_lines[i].label_;
+        loops += indent + "for (int " + var + " = 0; " + var + " < "
+                 + BLASPrinter::instance().dim_name(dst_lines[i].type()) + "; ++" + var + ") {\n";
+        indent += "    ";
+        ++depth;
+    }
+    loops += indent + dst + "[" + offset_expr(dst_lines) + "] " + op + " "
+             + src + "[" + offset_expr(src_lines) + "];\n";
+    for (size_t i = 0; i < depth; ++i) {
+        indent.erase(indent.size() - 4);
+        loops += indent + "}\n";
+    }
+    return loops;
+}
+
+// operands of a term that are stored tensors
+vertex_vector tensor_operands(const Term& t) {
+    vertex_vector tensors;
+    for (const auto& rhs : t.rhs()) {
+        // an intermediate is an operand of its own (also when it is the only one)
+        vertex_vector ops = rhs->is_temp() ? vertex_vector{rhs} : rhs->link_vector();
+        for (const auto& op : ops) {
+            if (op->empty()) continue;
+            if (op->rank() == 0 && op->lines().empty()) continue;
+            tensors.push_back(op);
         }
     }
+    return tensors;
+}
 
-    // A's free line positions (in A's own order)
-    vector<size_t> a_free_pos, a_contr_pos;
-    for (size_t i = 0; i < a_n; ++i) {
-        if (a_contr[i])
-            a_contr_pos.push_back(i);
-        else
-            a_free_pos.push_back(i);
+// Split the lines of C = A * B into the free and contracted lines of each
+// operand (in operand order). Returns false if the contraction is not a matrix
+// product: a line shared by all three tensors, a line summed within one
+// operand, or a line repeated within a tensor.
+bool split_lines(const line_vector& a, const line_vector& b, const line_vector& c,
+                 line_vector& fa, line_vector& ka, line_vector& fb, line_vector& kb) {
+    for (const line_vector* lines : {&a, &b, &c})
+        for (size_t i = 0; i < lines->size(); ++i)
+            if (index_of(*lines, (*lines)[i]) != (long) i) return false;
+
+    auto split = [&c](const line_vector& x, const line_vector& y, line_vector& fx, line_vector& kx) {
+        for (const Line& line : x) {
+            bool in_y = index_of(y, line) >= 0, in_c = index_of(c, line) >= 0;
+            if (in_y == in_c) return false;
+            (in_c ? fx : kx).push_back(line);
+        }
+        return true;
+    };
+    if (!split(a, b, fa, ka) || !split(b, a, fb, kb)) return false;
+
+    for (const Line& line : c)
+        if (index_of(fa, line) < 0 && index_of(fb, line) < 0) return false;
+    return true;
+}
+
+// 'A' if the free lines of A come before those of B in c, 'B' if they come after,
+// and '\0' if they are interleaved
+char output_order(const line_vector& c, const line_vector& fa) {
+    bool seen_a = false, seen_b = false, a_after_b = false, b_after_a = false;
+    for (const Line& line : c) {
+        if (index_of(fa, line) >= 0) { a_after_b |= seen_b; seen_a = true; }
+        else                         { b_after_a |= seen_a; seen_b = true; }
     }
+    if (!a_after_b) return 'A';
+    if (!b_after_a) return 'B';
+    return '\0';
+}
 
-    // B's free line positions (in B's own order)
-    vector<size_t> b_free_pos, b_contr_pos;
-    for (size_t i = 0; i < b_n; ++i) {
-        if (b_contr[i])
-            b_contr_pos.push_back(i);
-        else
-            b_free_pos.push_back(i);
+} // namespace
+
+line_vector BLASPrinter::stored_lines(const VertexPtr& v) const {
+    if (!v->is_temp()) return v->lines();
+
+    auto it = layouts_.find(as_link(v)->str(true, false));
+    if (it == layouts_.end() || it->second.size() != v->lines().size())
+        return v->lines();
+
+    line_vector lines;
+    lines.reserve(it->second.size());
+    for (size_t pos : it->second)
+        lines.push_back(v->lines()[pos]);
+    return lines;
+}
+
+line_vector BLASPrinter::term_lines(const Term& t, const VertexPtr& v) const {
+    line_vector lines = materialized(stored_lines(v));
+    if (t.batch_labels_.empty()) return lines;
+
+    bool sliced = v->is_temp() && as_link(v)->str(true, false) == t.batch_temp_;
+    line_vector out;
+    for (Line line : lines) {
+        auto batch = t.batch_labels_.find(line.label_);
+        if (batch != t.batch_labels_.end()) {
+            if (sliced) continue;
+            line.label_ = batch->second;
+        }
+        out.push_back(line);
     }
+    return out;
+}
 
-    // Interleaving check: in each operand, all free must come before all
-    // contracted (or vice versa) for a clean DGEMM.
-    auto is_clean = [](const vector<size_t>& free_pos,
-                       const vector<size_t>& contr_pos) -> bool {
-        if (free_pos.empty() || contr_pos.empty()) return true;
-        return free_pos.back() < contr_pos.front() ||
-               contr_pos.back() < free_pos.front();
+void BLASPrinter::plan(const vector<const Term*>& terms) const {
+    layouts_.clear();
+
+    // each term votes for the layouts of its intermediates that avoid a transpose, weighted by
+    // the size of the term. Votes depend on the layouts of the other tensors, so repeat a few times.
+    map<string, map<vector<size_t>, double>> votes;
+    auto vote = [&votes](const VertexPtr& v, const line_vector& order, double weight) {
+        if (!v->is_temp()) return;
+
+        // positions in the lines of v; lines that are not stored go last
+        const line_vector& lines = v->lines();
+        vector<size_t> layout;
+        for (const Line& line : order)
+            layout.push_back((size_t) index_of(lines, line));
+        for (size_t i = 0; i < lines.size(); ++i)
+            if (index_of(order, lines[i]) < 0) layout.push_back(i);
+        votes[as_link(v)->str(true, false)][layout] += weight;
     };
-    if (!is_clean(a_free_pos, a_contr_pos)) return "";
-    if (!is_clean(b_free_pos, b_contr_pos)) return "";
-
-    // Determine TransA (NoTrans if free first, Trans if contr first)
-    bool a_contr_first = (!a_contr_pos.empty() &&
-                          (a_free_pos.empty() || a_contr_pos.front() < a_free_pos.front()));
-    bool b_free_first  = (!b_free_pos.empty() &&
-                          (b_contr_pos.empty() || b_free_pos.front() < b_contr_pos.front()));
-
-    char transA = a_contr_first ? 'T' : 'N';
-    char transB = b_free_first  ? 'T' : 'N';
-
-    // Build dimension products
-    auto dim_product_of_lines = [](const vector<size_t>& positions,
-                                   const line_vector& lines) -> string {
-        string prod;
-        for (size_t pos : positions) {
-            if (pos >= lines.size()) continue;
-            char t = lines[pos].type();
-            string dn;
-            switch (t) {
-                case 'o': dn = "nocc"; break;
-                case 'v': dn = "nvirt"; break;
-                case 'a': dn = "nalpha"; break;
-                case 'b': dn = "nbeta"; break;
-                default: continue;
+
+    for (size_t round = 0; round < 4; ++round) {
+        votes.clear();
+        for (const Term* t : terms) {
+            if (!t->print_override_.empty()) continue;
+
+            vertex_vector tensors = tensor_operands(*t);
+            const VertexPtr& C = t->lhs();
+            line_vector c = materialized(stored_lines(C));
+
+            if (tensors.size() == 1 && t->rhs().size() == 1) {
+                // a copy is a plain axpy when both tensors share a layout
+                line_vector src = materialized(stored_lines(tensors[0]));
+                if (in_order(src, c).size() != c.size() || src.size() != c.size()) continue;
+                vote(C, src, element_estimate(c));
+                vote(tensors[0], c, element_estimate(c));
+                continue;
             }
-            if (dn.empty()) continue;
-            if (!prod.empty()) prod += " * ";
-            prod += dn;
+            if (tensors.size() != 2) continue;
+
+            line_vector a = materialized(stored_lines(tensors[0]));
+            line_vector b = materialized(stored_lines(tensors[1]));
+            line_vector fa, ka, fb, kb;
+            if (!split_lines(a, b, c, fa, ka, fb, kb)) continue;
+
+            double weight = element_estimate(concat(a, fb));
+            char first = output_order(c, fa);
+
+            // the output only needs the free lines of each operand as two blocks
+            if (first) vote(C, c, weight);
+            else vote(C, concat(fa, fb), weight);
+
+            // an operand needs its free lines (in output order) and its contracted lines as two blocks,
+            // with the contracted lines in the order of the other operand if that one already fits
+            auto vote_operand = [&](const VertexPtr& X, const line_vector& x, const line_vector& fx,
+                                    const line_vector& kx, const line_vector& y, const line_vector& fy,
+                                    const line_vector& ky) {
+                line_vector F = first ? in_order(c, fx) : fx;
+                line_vector Fy = first ? in_order(c, fy) : fy;
+                bool y_fits = same_order(y, concat(ky, Fy)) || same_order(y, concat(Fy, ky));
+                const line_vector& K = y_fits ? ky : kx;
+                line_vector trans = concat(K, F);
+                vote(X, same_order(x, trans) ? trans : concat(F, K), weight);
+            };
+            vote_operand(tensors[0], a, fa, ka, b, fb, kb);
+            vote_operand(tensors[1], b, fb, kb, a, fa, ka);
         }
-        return prod.empty() ? "1" : prod;
-    };
 
-    string M_str = dim_product_of_lines(a_free_pos, A->lines());
-    string K_str = dim_product_of_lines(a_contr_pos, A->lines());
-    string N_str = dim_product_of_lines(b_free_pos, B->lines());
+        bool changed = false;
+        for (const auto& [name, options] : votes) {
+            // keep the current layout unless another one has strictly more weight
+            auto current = layouts_.find(name);
+            vector<size_t> best;
+            double best_weight = -1;
+            if (current != layouts_.end() && options.count(current->second)) {
+                best = current->second;
+                best_weight = options.at(best);
+            } else if (current == layouts_.end()) {
+                size_t rank = options.begin()->first.size();
+                vector<size_t> identity(rank);
+                for (size_t i = 0; i < rank; ++i) identity[i] = i;
+                if (options.count(identity)) {
+                    best = identity;
+                    best_weight = options.at(identity);
+                }
+            }
+            for (const auto& [layout, weight] : options) {
+                if (weight > best_weight * (1 + 1e-12)) {
+                    best = layout;
+                    best_weight = weight;
+                }
+            }
 
-    // Leading dimensions
-    string LDA_str = (transA == 'N') ? M_str : K_str;
-    string LDB_str = (transB == 'N') ? K_str : N_str;
+            bool identity = true;
+            for (size_t i = 0; i < best.size(); ++i)
+                identity &= best[i] == i;
 
-    // Output analysis: determine which operand's free lines come first
-    // in the output, to decide whether we need to swap A/B for DGEMM.
-    // The output lines_ of the linkage are the free lines.
-    const line_vector& out_lines = link->lines();
-
-    // Label the output lines by which operand they came from:
-    // match by line identity against A's/B's free lines.
-    vector<char> out_origin(out_lines.size(), '?');
-    for (size_t oi = 0; oi < out_lines.size(); ++oi) {
-        for (size_t ai : a_free_pos) {
-            if (ai < A->lines().size() &&
-                out_lines[oi] == A->lines()[ai]) {
-                out_origin[oi] = 'A';
-                goto next_out;
+            if (identity) {
+                changed |= layouts_.erase(name) > 0;
+            } else if (current == layouts_.end() || current->second != best) {
+                layouts_[name] = best;
+                changed = true;
             }
         }
-        for (size_t bi : b_free_pos) {
-            if (bi < B->lines().size() &&
-                out_lines[oi] == B->lines()[bi]) {
-                out_origin[oi] = 'B';
-                goto next_out;
-            }
-        }
-        next_out: ;
+        if (!changed) break;
     }
+}
 
-    // Check interleaving in output
-    bool seen_B = false, seen_A_after_B = false;
-    for (char o : out_origin) {
-        if (o == 'B') seen_B = true;
-        else if (o == 'A' && seen_B) { seen_A_after_B = true; break; }
-    }
-    bool seen_A = false, seen_B_after_A = false;
-    for (char o : out_origin) {
-        if (o == 'A') seen_A = true;
-        else if (o == 'B' && seen_A) { seen_B_after_A = true; break; }
-    }
+// ── DGEMM generation ────────────────────────────────────────────────────
 
-    // Decide if we need to swap operands for correct output order.
-    // DGEMM computes C(M,N) where M = A_free, N = B_free.
-    // If output has B before A, we swap: new A = B, new B = A.
-    bool need_swap = seen_A_after_B; // B comes first in output
-
-    // Resolve operands for DGEMM
-    const VertexPtr* dA = need_swap ? &B : &A;
-    const VertexPtr* dB = need_swap ? &A : &B;
-    const string* dM_str = need_swap ? &N_str : &M_str;
-    const string* dN_str = need_swap ? &M_str : &N_str;
-    const string* dK_str = &K_str;
-    char dTransA = need_swap ? transB : transA;
-    char dTransB = need_swap ? transA : transB;
-    string dLDA_str, dLDB_str;
-    if (need_swap) {
-        dLDA_str = (dTransA == 'N') ? *dM_str : *dK_str;
-        dLDB_str = (dTransB == 'N') ? *dK_str : *dN_str;
-    } else {
-        dLDA_str = LDA_str;
-        dLDB_str = LDB_str;
-    }
-    string dLDC_str = *dM_str;
+string BLASPrinter::dgemm_call(const Term& t) const {
+    vertex_vector tensors = tensor_operands(t);
+    if (tensors.size() != 2) return "";
+
+    const VertexPtr& A = tensors[0];
+    const VertexPtr& B = tensors[1];
+
+    // in a batch loop, the tensors with fixed lines are strided slices: they are copied (or written back) like
+    // a transposed operand, and the matrix product runs over the other lines
+    line_vector a_lines = term_lines(t, A), b_lines = term_lines(t, B), c_lines = term_lines(t, t.lhs());
+    line_vector a = unfixed(t, a_lines);
+    line_vector b = unfixed(t, b_lines);
+    line_vector c = unfixed(t, c_lines);
+
+    line_vector fa, ka, fb, kb;
+    if (!split_lines(a, b, c, fa, ka, fb, kb)) return "";
+
+    // X is the operand whose free lines come first in the output (M), Y gives the rest (N).
+    // If the free lines are interleaved in the output, DGEMM writes a scratch copy of C instead.
+    char first = output_order(c, fa);
+    bool swap = first == 'B';
+    bool permute_c = !first;
+
+    const VertexPtr& X = swap ? B : A;
+    const VertexPtr& Y = swap ? A : B;
+    const line_vector& x = swap ? b : a;
+    const line_vector& y = swap ? a : b;
+    const line_vector& x_lines = swap ? b_lines : a_lines;
+    const line_vector& y_lines = swap ? a_lines : b_lines;
+    bool x_slice = x_lines.size() != x.size(), y_slice = y_lines.size() != y.size();
+    permute_c |= c_lines.size() != c.size();
+    line_vector M = first ? in_order(c, swap ? fb : fa) : (swap ? fb : fa);
+    line_vector N = first ? in_order(c, swap ? fa : fb) : (swap ? fa : fb);
+
+    // 'N' or 'T' if the operand can be used as stored with the contracted lines in order K, '\0' otherwise
+    auto x_trans = [&](const line_vector& K) {
+        if (x_slice) return '\0';
+        if (same_order(x, concat(M, K))) return 'N';
+        if (same_order(x, concat(K, M))) return 'T';
+        return '\0';
+    };
+    auto y_trans = [&](const line_vector& K) {
+        if (y_slice) return '\0';
+        if (same_order(y, concat(K, N))) return 'N';
+        if (same_order(y, concat(N, K))) return 'T';
+        return '\0';
+    };
+
+    // take the order of the contracted lines from whichever operand leaves less to transpose
+    const line_vector& kx = swap ? kb : ka;
+    const line_vector& ky = swap ? ka : kb;
+    auto transpose_cost = [&](const line_vector& K) {
+        return (x_trans(K) ? 0 : element_estimate(x)) + (y_trans(K) ? 0 : element_estimate(y));
+    };
+    const line_vector& K = transpose_cost(ky) < transpose_cost(kx) ? ky : kx;
+
+    char transA = x_trans(K), transB = y_trans(K);
+    bool permute_x = !transA, permute_y = !transB;
+    if (permute_x) transA = 'N';
+    if (permute_y) transB = 'N';
+
+    string M_str = dim_product(M);
+    string N_str = dim_product(N);
+    string K_str = dim_product(K);
+
+    // Leading dimensions
+    string LDA_str = (transA == 'N') ? M_str : K_str;
+    string LDB_str = (transB == 'N') ? K_str : N_str;
+    string LDC_str = M_str;
 
     // Tensor names
-    string A_name = (*dA)->str();
-    string B_name = (*dB)->str();
+    string A_name = X->str();
+    string B_name = Y->str();
     string C_name = t.lhs()->str();
 
     // Alpha / beta
@@ -305,7 +531,7 @@ string BLASPrinter::dgemm_call(const Term& t) const {
         alpha_str = to_string_with_precision(abs_coeff, prec);
         if (is_negative) alpha_str = "-" + alpha_str;
     }
-    string beta_str = t.is_assignment_ ? "0.0" : "1.0";
+    string beta_str = (t.is_assignment_ || permute_c) ? "0.0" : "1.0";
 
     // Build comment
     string comment = "// ";
@@ -313,16 +539,52 @@ string BLASPrinter::dgemm_call(const Term& t) const {
     comment += (t.is_assignment_ ? " = " : " += ");
     comment += A_name + " * " + B_name;
 
+    // Operands that do not fit are transposed into scratch buffers first
+    string A_arg = permute_x ? "perm_a" : A_name;
+    string B_arg = permute_y ? "perm_b" : B_name;
+    string C_arg = permute_c ? "perm_c" : C_name;
+
     // Build DGEMM call
     string dgemm = "cblas_dgemm(CblasColMajor,\n";
-    dgemm += "                  Cblas" + string(dTransA == 'N' ? "NoTrans" : "Trans") + ",\n";
-    dgemm += "                  Cblas" + string(dTransB == 'N' ? "NoTrans" : "Trans") + ",\n";
-    dgemm += "                  " + *dM_str + ", " + *dN_str + ", " + *dK_str + ",\n";
-    dgemm += "                  " + alpha_str + ", " + A_name + ", " + dLDA_str + ",\n";
-    dgemm += "                                " + B_name + ", " + dLDB_str + ",\n";
-    dgemm += "                  " + beta_str + ", " + C_name + ", " + dLDC_str + ");";
-
-    return comment + "\n" + dgemm;
+    dgemm += "                  Cblas" + string(transA == 'N' ? "NoTrans" : "Trans") + ",\n";
+    dgemm += "                  Cblas" + string(transB == 'N' ? "NoTrans" : "Trans") + ",\n";
+    dgemm += "                  " + M_str + ", " + N_str + ", " + K_str + ",\n";
+    dgemm += "                  " + alpha_str + ", " + A_arg + ", " + LDA_str + ",\n";
+    dgemm += "                                " + B_arg + ", " + LDB_str + ",\n";
+    dgemm += "                  " + beta_str + ", " + C_arg + ", " + LDC_str + ");";
+
+    if (!permute_x && !permute_y && !permute_c)
+        return comment + "\n" + dgemm;
+
+    string body;
+    if (permute_x) {
+        body += "double *perm_a = (double*)malloc(" + dim_product(x) + " * sizeof(double));\n";
+        body += permute_loops("perm_a", concat(M, K), A_name, x_lines, "=");
+    }
+    if (permute_y) {
+        body += "double *perm_b = (double*)malloc(" + dim_product(y) + " * sizeof(double));\n";
+        body += permute_loops("perm_b", concat(K, N), B_name, y_lines, "=");
+    }
+    if (permute_c)
+        body += "double *perm_c = (double*)malloc(" + dim_product(c) + " * sizeof(double));\n";
+    body += dgemm + "\n";
+    if (permute_c) {
+        body += permute_loops(C_name, c_lines, "perm_c", concat(M, N), t.is_assignment_ ? "=" : "+=", &t);
+        body += "free(perm_c);\n";
+    }
+    if (permute_y) body += "free(perm_b);\n";
+    if (permute_x) body += "free(perm_a);\n";
+
+    // indent the scoped block
+    string block = "{\n";
+    size_t pos = 0, next;
+    while ((next = body.find('\n', pos)) != string::npos) {
+        block += "    " + body.substr(pos, next - pos) + "\n";
+        pos = next + 1;
+    }
+    block += "}";
+
+    return comment + " (transposed)\n" + block;
 }
 
 string BLASPrinter::format_term(const Term& t) const {
@@ -360,18 +622,19 @@ string BLASPrinter::format_term(const Term& t) const {
 
         string size_str = make_size(dst->lines());
 
-        // Determine if index ordering matches between src and dst
-        bool same_order = (src->lines().size() == dst->lines().size());
-        if (same_order) {
-            for (size_t i = 0; i < src->lines().size(); ++i) {
-                if (!(src->lines()[i] == dst->lines()[i])) {
-                    same_order = false;
+        // Determine if index ordering matches between src and dst (as stored)
+        line_vector src_lines = stored_lines(src), dst_lines = stored_lines(dst);
+        bool is_copy = t.batch_labels_.empty() && src_lines.size() == dst_lines.size();
+        if (is_copy) {
+            for (size_t i = 0; i < src_lines.size(); ++i) {
+                if (!(src_lines[i] == dst_lines[i])) {
+                    is_copy = false;
                     break;
                 }
             }
         }
 
-        if (same_order) {
+        if (is_copy) {
             // Identity copy — can use daxpy / dcopy
             string alpha_str;
             if (std::fabs(std::fabs(alpha) - 1.0) < 1e-12) {
@@ -409,10 +672,23 @@ string BLASPrinter::format_term(const Term& t) const {
                 fallback += "-";
             }
             fallback += src->str();
-            fallback += "  // dst[" + dst->line_str() + "] ";
+            fallback += "  // dst[" + format_lines(dst_lines) + "] ";
             fallback += (t.is_assignment_ ? "=" : "+=");
-            fallback += " src[" + src->line_str() + "]";
-            return fallback;
+            fallback += " src[" + format_lines(src_lines) + "]";
+
+            // explicit transpose, unless the lines do not match up (e.g. a trace)
+            line_vector dst_stored = term_lines(t, dst), src_stored = term_lines(t, src);
+            line_vector dst_free = unfixed(t, dst_stored), src_free = unfixed(t, src_stored);
+            if (dst_free.size() != src_free.size() || in_order(dst_free, src_free).size() != dst_free.size())
+                return fallback;
+
+            string scale;
+            if (std::fabs(alpha - 1.0) > 1e-12) {
+                if (std::fabs(alpha + 1.0) < 1e-12) scale = "-";
+                else scale = to_string_with_precision(alpha, minimum_precision(std::fabs(alpha))) + " * ";
+            }
+            return fallback + "\n" + permute_loops(dst->str(), dst_stored, scale + src->str(), src_stored,
+                                                   t.is_assignment_ ? "=" : "+=", &t);
         }
     }
 
@@ -437,32 +713,26 @@ string BLASPrinter::format_term(const Term& t) const {
         auto find_or_add = [&](char label, char type) -> size_t {
             for (size_t i = 0; i < indices.size(); ++i)
                 if (indices[i].label == label) return i;
-            string dn;
-            switch (type) {
-                case 'o': dn = "nocc"; break;
-                case 'v': dn = "nvirt"; break;
-                case 'a': dn = "nalpha"; break;
-                case 'b': dn = "nbeta"; break;
-                default:  dn = string(1, type); break;
-            }
+            string dn = dim_name(type);
+            if (dn.empty()) dn = string(1, type);
             indices.push_back({label, type, dn, false, false, false});
             return indices.size() - 1;
         };
 
-        for (const auto& l : A->lines()) {
-            if (!l.label_.empty()) {
+        for (const auto& l : materialized(A->lines())) {
+            if (!l.label_.empty() && !t.batch_labels_.count(l.label_)) {
                 size_t idx = find_or_add(l.label_[0], l.type());
                 indices[idx].in_A = true;
             }
         }
-        for (const auto& l : B->lines()) {
-            if (!l.label_.empty()) {
+        for (const auto& l : materialized(B->lines())) {
+            if (!l.label_.empty() && !t.batch_labels_.count(l.label_)) {
                 size_t idx = find_or_add(l.label_[0], l.type());
                 indices[idx].in_B = true;
             }
         }
-        for (const auto& l : C->lines()) {
-            if (!l.label_.empty()) {
+        for (const auto& l : materialized(C->lines())) {
+            if (!l.label_.empty() && !t.batch_labels_.count(l.label_)) {
                 size_t idx = find_or_add(l.label_[0], l.type());
                 indices[idx].in_C = true;
             }
@@ -482,16 +752,23 @@ string BLASPrinter::format_term(const Term& t) const {
             string off;
             bool has_stride = false;
             string stride_expr;
-            for (size_t p = 0; p < V->lines().size(); ++p) {
-                const Line& l = V->lines()[p];
+            const line_vector lines = term_lines(t, V);
+            for (size_t p = 0; p < lines.size(); ++p) {
+                const Line& l = lines[p];
                 if (l.label_.empty()) continue;
 
-                // Find index info
+                // Find index info (lines fixed by a batch loop are indexed by its variable)
                 IndexInfo* info = nullptr;
-                for (auto& idx : indices) {
-                    if (idx.label == l.label_[0]) {
-                        info = &idx;
-                        break;
+                IndexInfo batch_info{};
+                if (is_fixed(t, l)) {
+                    batch_info = {'\0', l.type(), dim_name(l.type()), false, false, true};
+                    info = &batch_info;
+                } else {
+                    for (auto& idx : indices) {
+                        if (idx.label == l.label_[0]) {
+                            info = &idx;
+                            break;
+                        }
                     }
                 }
                 if (!info) continue;
@@ -501,7 +778,7 @@ string BLASPrinter::format_term(const Term& t) const {
                 bool is_contr = !info->in_C;
                 if (!add_contr && is_contr) continue;
 
-                string var = string(1, info->label);
+                string var = info == &batch_info ? l.label_ : string(1, info->label);
                 string dim = info->dim;
 
                 if (!off.empty()) off += " + ";
@@ -511,7 +788,7 @@ string BLASPrinter::format_term(const Term& t) const {
                     off += var;
                 }
 
-                if (p + 1 < V->lines().size()) {
+                if (p + 1 < lines.size()) {
                     if (has_stride) {
                         stride_expr += " * " + dim;
                     } else {
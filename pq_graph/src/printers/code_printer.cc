@@ -38,6 +38,7 @@
 #include "../../include/printers/tiledarray_printer.h"
 #include "../../include/printers/blas_printer.h"
 #include "../../include/printers/loop_printer.h"
+#include "../../include/printers/runtime_printer.h"
 
 using std::string;
 using std::stringstream;
@@ -77,6 +78,9 @@ void Vertex::set_printer(const string& type) {
         printer_ = &LoopPrinter::instance();
         Term::binarize_ = true;
         std::cout << "Setting printer to Loop (C) format" << std::endl;
+    } else if (t == "runtime" || t == "pq_runtime") {
+        printer_ = &RuntimePrinter::instance();
+        std::cout << "Setting printer to pq_runtime (C++) format" << std::endl;
     } else {
         std::cout << "Unknown printer type: " << type << std::endl;
     }
@@ -239,4 +243,160 @@ string CodePrinter::format_term_line(const string& term_str, int indent) const {
     return output;
 }
 
+// ── Buffer pool (C backends) ────────────────────────────────────────────
+
+namespace {
+
+string pool_name(const string& prefix, size_t buffer) {
+    return prefix + "pool_" + std::to_string(buffer);
+}
+
+string megabytes(double elements) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2) << elements * sizeof(double) / (1024.0 * 1024.0) << " MB";
+    return ss.str();
+}
+
+} // namespace
+
+string c_pool_buffer(const BufferPlan& plan, const string& prefix, const string& name) {
+    auto it = plan.buffer_of.find(name);
+    if (it == plan.buffer_of.end()) return "";
+    return pool_name(prefix, it->second);
+}
+
+string c_pool_acquire(const BufferPlan& plan, const string& prefix, const string& name) {
+    string pool = c_pool_buffer(plan, prefix, name);
+    if (pool.empty()) return "";
+    return "POOL_ACQUIRE(" + name + ", " + pool + ", " + name + "_size);";
+}
+
+string c_pool_release(const BufferPlan& plan, const string& prefix, const string& name) {
+    string pool = c_pool_buffer(plan, prefix, name);
+    if (pool.empty()) return "";
+    return name + " = NULL; /* returned to " + pool + " */";
+}
+
+string c_buffer_pool(const BufferPlan& plan, const string& prefix) {
+    if (plan.empty()) return "";
+
+    std::stringstream ss;
+    ss << std::setprecision(0) << std::fixed;
+    ss << "/* Intermediates with disjoint live ranges share a buffer of the pool.\n";
+    ss << " * Estimated for nocc = " << plan.nocc << ", nvirt = " << plan.nvirt << ":\n";
+    ss << " *   peak of live intermediates: " << megabytes(plan.live_peak) << "\n";
+    ss << " *   pool: " << megabytes(plan.pool_size) << " in " << plan.occupants.size() << " buffers\n";
+    for (size_t k = 0; k < plan.occupants.size(); ++k) {
+        ss << " *   " << pool_name(prefix, k) << " (" << megabytes(plan.capacity[k]) << "):";
+        for (const string& name : plan.occupants[k])
+            ss << " " << name;
+        ss << "\n";
+    }
+    ss << " */\n";
+    ss << "#include <string.h>\n";
+    ss << "#define POOL_ACQUIRE(ptr, pool, n) do { \\\n";
+    ss << "    if (pool##_size < (n)) { free(pool); pool = (double*)malloc((n) * sizeof(double)); pool##_size = (n); } \\\n";
+    ss << "    (ptr) = pool; memset((ptr), 0, (n) * sizeof(double)); \\\n";
+    ss << "} while (0)\n\n";
+    for (size_t k = 0; k < plan.occupants.size(); ++k)
+        ss << "double *" << pool_name(prefix, k) << " = NULL; size_t " << pool_name(prefix, k) << "_size = 0;\n";
+    return ss.str();
+}
+
+string c_buffer_release(const BufferPlan& plan, const string& prefix, const string& pad) {
+    string out;
+    for (size_t k = 0; k < plan.occupants.size(); ++k) {
+        string pool = pool_name(prefix, k);
+        out += pad + "free(" + pool + "); " + pool + " = NULL; " + pool + "_size = 0;\n";
+    }
+    return out;
+}
+
+string c_batch_open(const CodePrinter& printer, const string& temp, const line_vector& lines) {
+    string out;
+    for (const Line& line : lines)
+        out += "for (int " + line.label_ + " = 0; " + line.label_ + " < " + printer.dim_name(line.type())
+             + "; ++" + line.label_ + ") ";
+    return out + "{ // one slice of " + temp + " per batch";
+}
+
+string c_batch_size(const CodePrinter& printer, const string& temp, const line_vector& slice) {
+    string size;
+    for (const Line& line : slice) {
+        if (line.sig_ && !Vertex::use_trial_index) continue;
+        if (!size.empty()) size += " * ";
+        size += printer.dim_name(line.type());
+    }
+    return temp + "_size = " + (size.empty() ? "1" : size) + "; // one slice per batch";
+}
+
+string c_batch_reset(const string& temp) {
+    return "memset(" + temp + ", 0, " + temp + "_size * sizeof(double));";
+}
+
+string c_scratch_scope(const CodePrinter& printer, const vector<pair<string, line_vector>>& temps, const string& statements) {
+    if (temps.empty()) return statements;
+
+    string indent = printer.padding(1);
+    string out = "{\n";
+    for (const auto& [name, lines] : temps) {
+        string size;
+        for (const Line& line : lines) {
+            // trial (sigma) indices are not a materialized tensor dimension unless requested
+            if (line.sig_ && !Vertex::use_trial_index) continue;
+            if (!size.empty()) size += " * ";
+            size += printer.dim_name(line.type());
+        }
+        out += indent + "double *" + name + " = (double*)calloc(" + (size.empty() ? "1" : size) + ", sizeof(double));\n";
+    }
+
+    // statements keep their relative indentation
+    out += indent;
+    for (char c : statements) {
+        out += c;
+        if (c == '\n') out += indent;
+    }
+    out += "\n";
+
+    for (const auto& temp : temps)
+        out += indent + "free(" + temp.first + ");\n";
+    return out + "}";
+}
+
+string c_task_region_open(const string& pad) {
+    return pad + "// independent statements run as OpenMP tasks (mutexinoutset requires OpenMP 5.0)\n"
+         + pad + "#pragma omp parallel default(shared)\n"
+         + pad + "#pragma omp single\n"
+         + pad + "{\n";
+}
+
+string c_task_region_close(const string& pad) {
+    return pad + "} // all tasks complete at the end of the parallel region\n";
+}
+
+string c_task(const vector<string>& lines, const TaskDepends& depends, const string& pad, const string& indent) {
+    string out = pad + "#pragma omp task default(shared)";
+    auto clause = [&out](const string& type, const set<string>& names) {
+        if (names.empty()) return;
+        out += " depend(" + type + ":";
+        for (const string& name : names)
+            out += (name == *names.begin() ? " " : ", ") + name;
+        out += ")";
+    };
+    clause("in", depends.in);
+    clause("out", depends.out);
+    clause("inout", depends.inout);
+    clause("mutexinoutset", depends.mutex);
+    out += "\n" + pad + "{\n";
+
+    for (const string& line : lines) {
+        // continuation lines carry the padding of a statement outside a task (one level); shift them with it
+        string shifted = pad + indent + line;
+        for (size_t pos = shifted.find('\n'); pos != string::npos; pos = shifted.find('\n', pos + 1))
+            shifted.insert(pos + 1, pad);
+        out += shifted + "\n";
+    }
+    return out + pad + "}\n";
+}
+
 } // namespace pdaggerq
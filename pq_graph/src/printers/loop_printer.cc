@@ -3,6 +3,7 @@
 #include <cmath>
 #include <set>
 #include <map>
+#include <algorithm>
 
 #include "../../include/printers/loop_printer.h"
 #include "../../include/vertex.h"
@@ -63,10 +64,14 @@ string LoopPrinter::format_intermediate_name(const Linkage* link, bool) const {
 }
 
 string LoopPrinter::allocate(const string& name) const {
+    string pooled = c_pool_acquire(buffers_, scratch_prefix(), name);
+    if (!pooled.empty()) return pooled;
     return name + " = (double*)calloc(" + name + "_size, sizeof(double));";
 }
 
 string LoopPrinter::deallocate(const string& name) const {
+    string pooled = c_pool_release(buffers_, scratch_prefix(), name);
+    if (!pooled.empty()) return pooled;
     return "free(" + name + "); " + name + " = NULL;";
 }
 
@@ -110,11 +115,13 @@ string LoopPrinter::format_declarations(const set<string>& names) const {
     out += " *   int nsigma; // number of sigma (L) trial vectors\n";
     out += " *   int nden;   // number of density (Q) vectors\n";
     out += " */\n";
-    out += "#include <stdlib.h>\n\n";
+    out += "#include <stdlib.h>\n";
+    out += "#include <string.h>\n\n";
     for (const auto& name : names)
         out += "double *" + name + ";\n";
     out += "\n/* Intermediate size variables (calloc argument):\n";
     out += " *   work__*_size = nocc * nvirt * ...\n";
+    out += " * Intermediates built in batches are assigned the size of one slice before their allocation.\n";
     out += " */\n";
     return out;
 }
@@ -136,10 +143,13 @@ string LoopPrinter::format_term(const Term& t) const {
     }
 
     // Collect all unique index labels from LHS and RHS operands
+    // labels fixed by an enclosing batch loop use its variable and are not looped over
     struct IndexInfo {
         char label;
         char type;
         string dim;
+        string var;
+        bool fixed;
         bool in_C, in_A, in_B;
     };
     vector<IndexInfo> indices;
@@ -147,12 +157,16 @@ string LoopPrinter::format_term(const Term& t) const {
         for (size_t i = 0; i < indices.size(); ++i)
             if (indices[i].label == label) return i;
         string dn = dim_name(type);
+        auto batch = t.batch_labels_.find(string(1, label));
+        bool fixed = batch != t.batch_labels_.end();
         indices.push_back({label, type, dn.empty() ? string(1, type) : dn,
+                           fixed ? batch->second : string(1, label), fixed,
                            false, false, false});
         return indices.size() - 1;
     };
 
     for (const auto& l : C->lines()) {
+        if (l.sig_ && !Vertex::use_trial_index) continue; // not a stored dimension
         if (!l.label_.empty()) {
             size_t idx = find_or_add(l.label_[0], l.type());
             indices[idx].in_C = true;
@@ -165,6 +179,7 @@ string LoopPrinter::format_term(const Term& t) const {
 
     if (A) {
         for (const auto& l : A->lines()) {
+            if (l.sig_ && !Vertex::use_trial_index) continue; // not a stored dimension
             if (!l.label_.empty()) {
                 size_t idx = find_or_add(l.label_[0], l.type());
                 indices[idx].in_A = true;
@@ -173,6 +188,7 @@ string LoopPrinter::format_term(const Term& t) const {
     }
     if (B) {
         for (const auto& l : B->lines()) {
+            if (l.sig_ && !Vertex::use_trial_index) continue; // not a stored dimension
             if (!l.label_.empty()) {
                 size_t idx = find_or_add(l.label_[0], l.type());
                 indices[idx].in_B = true;
@@ -183,51 +199,17 @@ string LoopPrinter::format_term(const Term& t) const {
     // Separate into free (appear in C) and contracted (only in RHS)
     vector<size_t> free_idx, contr_idx;
     for (size_t i = 0; i < indices.size(); ++i) {
+        if (indices[i].fixed) continue;
         if (indices[i].in_C)
             free_idx.push_back(i);
         else
             contr_idx.push_back(i);
     }
 
-    // Build column-major offset expression for a vertex given its lines
-    auto make_offset = [&](const VertexPtr& V) -> string {
-        string off;
-        bool has_stride = false;
-        string stride_expr;
-        for (size_t p = 0; p < V->lines().size(); ++p) {
-            const Line& l = V->lines()[p];
-            if (l.label_.empty()) continue;
-            IndexInfo* info = nullptr;
-            for (auto& idx : indices) {
-                if (idx.label == l.label_[0]) {
-                    info = &idx;
-                    break;
-                }
-            }
-            if (!info) continue;
-            string var = string(1, info->label);
-            string dim = info->dim;
-            if (!off.empty()) off += " + ";
-            if (has_stride) {
-                off += var + " * " + stride_expr;
-            } else {
-                off += var;
-            }
-            if (p + 1 < V->lines().size()) {
-                if (has_stride) {
-                    stride_expr += " * " + dim;
-                } else {
-                    stride_expr = dim;
-                    has_stride = true;
-                }
-            }
-        }
-        return off.empty() ? "0" : off;
-    };
-
     // Build comment describing the operation
     string loop_vars;
     for (size_t i = 0; i < indices.size(); ++i) {
+        if (indices[i].fixed) continue;
         if (!loop_vars.empty()) loop_vars += ", ";
         loop_vars += string(1, indices[i].label);
     }
@@ -248,21 +230,72 @@ string LoopPrinter::format_term(const Term& t) const {
     if (B) comment += " * " + B->str();
     if (!loop_vars.empty()) comment += "  over (" + loop_vars + ")";
 
-    // Generate loop nest: free indices outermost, contracted innermost
-    string loops;
-    string indent;
-
-    vector<size_t> all_idx = free_idx;
-    all_idx.insert(all_idx.end(), contr_idx.begin(), contr_idx.end());
-
-    for (size_t li = 0; li < all_idx.size(); ++li) {
-        const auto& idx = indices[all_idx[li]];
-        loops += indent + "for (int " + string(1, idx.label) + " = 0; "
-                 + string(1, idx.label) + " < " + idx.dim + "; ++"
-                 + string(1, idx.label) + ") {\n";
-        indent += "    ";
+    // Column-major offset of each operand: the stored lines with a loop (or batch) variable and their strides
+    // (the batched intermediate stores one slice, without the fixed lines)
+    struct Operand {
+        string name, ptr;
+        vector<std::pair<size_t, string>> terms; // index, stride ("" for unit stride)
+    };
+    auto make_operand = [&](const VertexPtr& V, const string& ptr) -> Operand {
+        bool sliced = !t.batch_temp_.empty() && V->is_temp() && as_link(V)->str(true, false) == t.batch_temp_;
+        Operand op{V->str(), ptr, {}};
+        string stride;
+        for (const Line& l : V->lines()) {
+            if (l.label_.empty() || (l.sig_ && !Vertex::use_trial_index)) continue;
+            if (sliced && t.batch_labels_.count(l.label_)) continue;
+            for (size_t i = 0; i < indices.size(); ++i) {
+                if (indices[i].label != l.label_[0]) continue;
+                op.terms.emplace_back(i, stride);
+                stride += (stride.empty() ? "" : " * ") + indices[i].dim;
+                break;
+            }
+        }
+        return op;
+    };
+    vector<Operand> operands = {make_operand(C, "C")};
+    if (A) operands.push_back(make_operand(A, "A"));
+    if (B) operands.push_back(make_operand(B, "B"));
+
+    // Loop order: an index goes further in the more operands it has a small stride in (its position in
+    // each operand, as the sizes are not known), so the innermost loop has unit stride where possible.
+    // The outermost loop runs over a free index, to be shared between threads.
+    vector<size_t> order = free_idx;
+    order.insert(order.end(), contr_idx.begin(), contr_idx.end());
+    map<size_t, size_t> depth;
+    for (const Operand& op : operands)
+        for (size_t p = 0; p < op.terms.size(); ++p)
+            depth[op.terms[p].first] += p;
+    std::stable_sort(order.begin(), order.end(), [&depth](size_t a, size_t b) { return depth[a] > depth[b]; });
+    if (!free_idx.empty() && !indices[order.front()].in_C) {
+        auto first_free = std::find_if(order.begin(), order.end(), [&](size_t i) { return indices[i].in_C; });
+        std::rotate(order.begin(), first_free, first_free + 1);
     }
 
+    // Loop nest: tile loops over the virtual (and density) indices of a contraction. The tile loops and
+    // element loops of the other free indices (but the innermost loop) come first, to be shared between
+    // threads, then the contracted tile loops and the remaining element loops in the chosen order.
+    struct Loop { size_t index; bool tile; };
+    auto tiled = [&](size_t i) {
+        return Term::loop_tile_ > 0 && !contr_idx.empty() && (indices[i].type == 'v' || indices[i].type == 'Q');
+    };
+    vector<Loop> nest;
+    for (size_t i : order)
+        if (tiled(i) && indices[i].in_C) nest.push_back({i, true});
+    for (size_t i : order)
+        if (!tiled(i) && indices[i].in_C && i != order.back()) nest.push_back({i, false});
+    for (size_t i : order)
+        if (tiled(i) && !indices[i].in_C) nest.push_back({i, true});
+    for (size_t i : order)
+        if (tiled(i) || !indices[i].in_C || i == order.back()) nest.push_back({i, false});
+
+    // Threads share the leading loops over free indices with rectangular bounds; the innermost
+    // loop is vectorized on its own unless it is the only one
+    size_t collapse = 0;
+    while (collapse + 1 < nest.size() && indices[nest[collapse].index].in_C
+           && (nest[collapse].tile || !tiled(nest[collapse].index)))
+        ++collapse;
+    if (nest.size() == 1 && indices[nest[0].index].in_C) collapse = 1;
+
     // Coefficient string for body
     string coeff_str;
     if (std::fabs(abs_coeff - 1.0) < 1e-12) {
@@ -274,22 +307,108 @@ string LoopPrinter::format_term(const Term& t) const {
         coeff_str += " * ";
     }
 
+    // Offsets invariant in the inner loops are computed once per iteration of the loop they depend on.
+    // Fixed (batch) variables are part of the offset from the start.
+    map<string, string> offset; // operand pointer -> offset expression so far
+    for (const Operand& op : operands) {
+        string& off = offset[op.ptr];
+        for (const auto& [i, stride] : op.terms) {
+            if (!indices[i].fixed) continue;
+            if (!off.empty()) off += " + ";
+            off += stride.empty() ? indices[i].var : "(size_t) " + indices[i].var + " * " + stride;
+        }
+    }
+    auto add_offset = [&](const Operand& op, size_t index) {
+        string off = offset[op.ptr];
+        for (const auto& [i, stride] : op.terms) {
+            if (i != index) continue;
+            if (!off.empty()) off += " + ";
+            off += stride.empty() ? indices[i].var : "(size_t) " + indices[i].var + " * " + stride;
+        }
+        return off;
+    };
+
+    string tile = std::to_string(Term::loop_tile_);
+    bool reduction = !nest.empty() && !indices[nest.back().index].in_C;
+
+    string loops = "{\n";
+    string indent = "    ";
+    loops += indent + "double *C = " + C->str() + ";\n";
+    if (A) loops += indent + "const double *A = " + A->str() + ";\n";
+    if (B) loops += indent + "const double *B = " + B->str() + ";\n";
+
+    vector<string> hoisted; // statements of the loops opened since the last intervening statements
+    for (size_t li = 0; li < nest.size(); ++li) {
+        const IndexInfo& idx = indices[nest[li].index];
+        const string& v = idx.var;
+        bool innermost = li + 1 == nest.size();
+
+        if (li == 0 && collapse > 0) {
+            loops += indent + "#pragma omp parallel for";
+            if (innermost) loops += " simd";
+            if (collapse > 1) loops += " collapse(" + std::to_string(collapse) + ")";
+            loops += "\n";
+        } else if (innermost && reduction) {
+            loops += indent + "double sum = 0.0;\n";
+            loops += indent + "#pragma omp simd reduction(+:sum)\n";
+        } else if (innermost) {
+            loops += indent + "#pragma omp simd\n";
+        }
+
+        if (nest[li].tile) {
+            loops += indent + "for (int " + v + "_t = 0; " + v + "_t < " + idx.dim + "; " + v + "_t += " + tile + ") {\n";
+            hoisted.push_back("const int " + v + "_end = " + v + "_t + " + tile + " < " + idx.dim
+                              + " ? " + v + "_t + " + tile + " : " + idx.dim + ";");
+        } else if (tiled(nest[li].index)) {
+            loops += indent + "for (int " + v + " = " + v + "_t; " + v + " < " + v + "_end; ++" + v + ") {\n";
+        } else {
+            loops += indent + "for (int " + v + " = 0; " + v + " < " + idx.dim + "; ++" + v + ") {\n";
+        }
+        indent += "    ";
+
+        if (!nest[li].tile && !innermost) {
+            for (const Operand& op : operands) {
+                string off = add_offset(op, nest[li].index);
+                if (off == offset[op.ptr]) continue;
+                if (off == v) { offset[op.ptr] = v; continue; } // unit stride: nothing to compute
+                string name = "o" + op.ptr + "_" + v;
+                hoisted.push_back("const size_t " + name + " = " + off + ";");
+                offset[op.ptr] = name;
+            }
+        }
+
+        // collapsed loops must be perfectly nested
+        if (li + 1 >= collapse) {
+            for (const string& statement : hoisted)
+                loops += indent + statement + "\n";
+            hoisted.clear();
+        }
+    }
+
     // Loop body: C[off] += coeff * A[off] [* B[off]]
-    string C_off = C->str() + "[" + make_offset(C) + "]";
-    string A_off = A ? A->str() + "[" + make_offset(A) + "]" : "";
-    string B_off = B ? B->str() + "[" + make_offset(B) + "]" : "";
+    size_t inner = nest.empty() ? 0 : nest.back().index;
+    auto element = [&](const Operand& op) {
+        string off = nest.empty() ? offset[op.ptr] : add_offset(op, inner);
+        return op.ptr + "[" + (off.empty() ? "0" : off) + "]";
+    };
+    string product = A ? element(operands[1]) : "";
+    if (B) product += " * " + element(operands[2]);
 
-    loops += indent + C_off + " += " + coeff_str + A_off;
-    if (B) loops += " * " + B_off;
-    loops += ";\n";
+    if (reduction) {
+        loops += indent + "sum += " + product + ";\n";
+    } else {
+        loops += indent + element(operands[0]) + " += " + coeff_str + product + ";\n";
+    }
 
     // Close loops
-    for (size_t li = 0; li < all_idx.size(); ++li) {
+    for (size_t li = nest.size(); li-- > 0;) {
         indent.erase(indent.size() - 4);
         loops += indent + "}\n";
+        if (reduction && li + 1 == nest.size())
+            loops += indent + element(operands[0]) + " += " + coeff_str + "sum;\n";
     }
 
-    return comment + "\n" + loops;
+    return comment + "\n" + loops + "}\n";
 }
 
 } // namespace pdaggerq
@@ -0,0 +1,32 @@
+#include "../../include/printers/runtime_printer.h"
+
+using std::string;
+using std::set;
+
+namespace pdaggerq {
+
+// ── RuntimePrinter implementations ──────────────────────────────────────────────────
+
+string RuntimePrinter::deallocate(const string& name) const {
+    return name + ".reset();";
+}
+
+string RuntimePrinter::perm_delete(const string& name) const {
+    return name + ".reset();\n";
+}
+
+string RuntimePrinter::format_declarations(const set<string>& names) const {
+    string out;
+    out += "// Types expected from pq_runtime.hpp (add pq_graph/runtime to the include path):\n";
+    out += "//   Tensor    for tensors printed without a block, e.g. t1, rt2;\n";
+    out += "//   TensorMap for blocked tensors and intermediates, e.g. eri, f, tmps_, reused_;\n";
+    out += "//   ScalarMap for scalar intermediates (scalars_), and std::map<std::string, bool> includes_.\n";
+    out += "// Intermediates are allocated at their first assignment and released by reset().\n";
+    out += "#include \"pq_runtime.hpp\"\n";
+    out += "using namespace pq_runtime;\n\n";
+    for (const auto& name : names)
+        out += decl_comment() + name + ";\n";
+    return out;
+}
+
+} // namespace pdaggerq
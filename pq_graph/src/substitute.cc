@@ -25,6 +25,7 @@
 #include <map>
 #include <iostream>
 #include <memory>
+#include <unordered_map>
 #include "../include/pq_graph.h"
 
 #ifdef _OPENMP
@@ -51,7 +52,24 @@ using std::max;
 
 using namespace pdaggerq;
 
-void PQGraph::make_all_links(bool recompute) {
+/**
+ * A tested candidate intermediate, queued by how much it improves the scaling of the graph
+ */
+struct substitution_candidate {
+    scaling_map flop_diff_, mem_diff_; // change in the scaling of the graph when tested
+    LinkagePtr candidate_; // candidate in the test set
+    MutableLinkagePtr linkage_; // tested copy of the candidate to substitute
+    size_t pass_; // substitution pass in which the candidate was tested
+
+    /// heap order: true if a should come after b (best scaling first, then in canonical order)
+    static bool worse(const substitution_candidate &a, const substitution_candidate &b) {
+        if (a.flop_diff_ != b.flop_diff_) return b.flop_diff_ < a.flop_diff_;
+        if (a.mem_diff_ != b.mem_diff_) return b.mem_diff_ < a.mem_diff_;
+        return Linkage::canonical_less(*b.linkage_, *a.linkage_);
+    }
+};
+
+void PQGraph::make_all_links(bool recompute, size_t max_depth) {
 
     if (recompute)
         all_links_.clear(); // clear all prior candidates
@@ -59,7 +77,7 @@ void PQGraph::make_all_links(bool recompute) {
     linkage_set candidate_linkages; // set of linkages
     for (auto &[eq_name, equation]: equations_) {
         // get all linkages of equation and add to candidates
-        all_links_ += equation.make_all_links(recompute);
+        all_links_ += equation.make_all_links(max_depth, recompute);
     }
 
     // clear history of all linkages
@@ -68,20 +86,13 @@ void PQGraph::make_all_links(bool recompute) {
 
 }
 
-linkage_set Equation::make_all_links(bool compute_all) {
+linkage_set Equation::make_all_links(size_t max_depth, bool compute_all) {
 
     linkage_set all_linkages(2048);
 
-    // determine thread count for thread-local accumulation
-    int num_threads = 1;
-    #pragma omp parallel
-    {
-        #pragma omp single
-        num_threads = omp_get_num_threads();
-    }
-    std::vector<linkage_set> local_sets(num_threads);
-
-#pragma omp parallel for schedule(guided) default(none) shared(terms_, local_sets) firstprivate(compute_all)
+    // the set is sharded by hash with a lock per shard, so all threads can merge their
+    // candidates into it directly
+#pragma omp parallel for schedule(guided) default(none) shared(terms_, all_linkages) firstprivate(compute_all, max_depth)
     for (size_t i = 0; i < terms_.size(); i++) {
         auto &term = terms_[i];
 
@@ -89,19 +100,76 @@ linkage_set Equation::make_all_links(bool compute_all) {
             continue;
 
         term.reorder();
-        local_sets[omp_get_thread_num()] += term.make_all_links();
+        all_linkages += term.make_all_links(max_depth);
 
         term.generated_linkages_ = true;
     }
 
-    // serial merge — no contention
-    for (auto &ls : local_sets)
-        all_linkages += ls;
-
     return all_linkages;
 }
 
-linkage_set Term::make_all_links() const {
+line_vector Term::choose_batch_lines(const line_vector &lines, const line_vector &candidates) {
+    if (max_batch_lines_ == 0 || !(shape(lines) > max_shape_)) return {};
+
+    // lines of the intermediate that may be batched over, virtual lines first
+    line_vector batchable;
+    for (const Line &line : lines) {
+        if (line.sig_ || line.den_) continue;
+        bool found = false;
+        for (const Line &candidate : candidates)
+            if (candidate.label_ == line.label_) { found = true; break; }
+        if (found) batchable.push_back(line);
+    }
+    std::stable_partition(batchable.begin(), batchable.end(), [](const Line &line) { return !line.o_; });
+
+    // drop batch lines until one slice fits
+    line_vector batch, slice = lines;
+    for (const Line &line : batchable) {
+        if (batch.size() == max_batch_lines_) break;
+        batch.push_back(line);
+        slice.erase(std::find(slice.begin(), slice.end(), line));
+        if (!(shape(slice) > max_shape_)) return batch;
+    }
+    return {};
+}
+
+line_vector Term::batch_lines(const Term &build, const vector<const Term *> &uses) {
+    if (!build.lhs_->is_temp() || !build.batch_labels_.empty() || uses.empty()) return {};
+    const VertexPtr &temp = build.lhs_;
+    const line_vector &lines = temp->lines();
+
+    // lines of the intermediate (by position) that are output lines of every use
+    vector<bool> candidate(lines.size(), true);
+    for (const Term *use : uses) {
+        if (use->lhs_->is_temp() || use->is_assignment_ || !use->batch_labels_.empty()
+            || use->conditions() != build.conditions())
+            return {};
+
+        const Vertex *operand = nullptr;
+        for (const VertexPtr &op : use->rhs_) {
+            if (!op->is_temp() || !op->same_temp(temp)) continue;
+            if (operand) return {}; // used twice
+            operand = op.get();
+        }
+        // not an operand of its own: printed within a product of other operands (a binarized intermediate)
+        if (!operand || operand->lines().size() != lines.size()) return {};
+
+        for (size_t p = 0; p < lines.size(); ++p) {
+            const string &label = operand->lines()[p].label_;
+            bool in_output = false;
+            for (const Line &line : use->lhs_->lines())
+                in_output |= line.label_ == label;
+            candidate[p] = candidate[p] && in_output;
+        }
+    }
+
+    line_vector candidates;
+    for (size_t p = 0; p < lines.size(); ++p)
+        if (candidate[p]) candidates.push_back(lines[p]);
+    return choose_batch_lines(lines, candidates);
+}
+
+linkage_set Term::make_all_links(size_t max_depth) const {
 
     if (rhs_.empty())
         return {}; // if constant, return an empty set of linkages
@@ -112,11 +180,13 @@ linkage_set Term::make_all_links() const {
     if (term_linkage()->is_temp()) return {}; // the term_linkage is already a temp, no need to test it.
 
     // generate all subgraphs of the term
-    auto subgraphs = term_linkage()->subgraphs(Term::max_depth_);
+    auto subgraphs = term_linkage()->subgraphs(max_depth);
 
     // insert all subgraphs of a given deoth into the set of linkages
     for (const auto &subgraph : subgraphs) {
-        if (subgraph->shape_ > Term::max_shape_) continue; // skip if subgraph shape is too large
+        // skip if subgraph shape is too large, unless it can be built and used in batches over output lines
+        if (subgraph->shape_ > Term::max_shape_ && choose_batch_lines(subgraph->lines(), lhs_->lines()).empty())
+            continue;
         if (subgraph->empty()) continue; // skip if subgraph is empty
         if (subgraph->is_temp()) continue; // the subgraph is already a temp, no need to test it.
 
@@ -170,17 +240,11 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
 
     cout << "Generating all possible linkages..." << flush;
 
+    // the depth is kept here rather than in Term::max_depth_, which is shared by concurrent branches of the beam search
     size_t org_max_depth = Term::max_depth_;
-    size_t current_depth;
-    if (batched_) {
-        Term::max_depth_ = 1; // set max depth to 1 for initial linkage generation
-        current_depth = 1;
-    } else {
-        current_depth = Term::max_depth_;
-    }
-
+    size_t current_depth = batched_ ? 1 : org_max_depth; // start at depth 1 for initial linkage generation if batched
 
-    make_all_links(true); // generate all possible linkages
+    make_all_links(true, current_depth); // generate all possible linkages
     cout << " Done" << endl;
 
     size_t num_terms = get_num_terms();
@@ -195,7 +259,7 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
     if (batched_)
         cout << "                Batch size: " << ((long) batch_size_ == -1 ? "no limit" : to_string(batch_size_))
              << endl;
-    cout << "         Max linkage depth: " << ((long) Term::max_depth_ == -1 ? "no limit" : to_string(Term::max_depth_))
+    cout << "         Max linkage depth: " << ((long) current_depth == -1 ? "no limit" : to_string(current_depth))
          << endl;
     cout << "    Possible intermediates: " << all_links_.size() << endl;
     cout << "    Number of threads used: " << nthreads_ << endl;
@@ -233,195 +297,164 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
 
     bool makeSub; // flag to make a substitution
     bool found_any = false; // flag to check if we found any linkages
+    std::unordered_map<LinkagePtr, substitution_cache> substitution_caches; // results of the last test of each candidate
+
+    // candidate substitutions, ordered by scaling. ties (linkages that yield the
+    // same scaling) are broken by a canonical key so that the substitution order
+    // -- and therefore the generated intermediates and final equations -- does not
+    // depend on the order in which the parallel search happened to populate the
+    // candidate set (which varies with thread scheduling).
+    vector<substitution_candidate> candidate_queue; // heap with the best candidate first
+    size_t pass = 0; // number of the current substitution pass
+    bool rebuild_queue = true; // whether every candidate must be tested again
+    bool allow_equality = true; // flag to allow equality in flop map
+    size_t skip_best = skip_best_; // best candidates left to skip (for branches of the beam search)
+    num_subs_made_ = 0;
+
+    // filter a tested candidate and queue it by how much it improves the current scaling
+    auto queue_candidate = [&](const LinkagePtr &candidate, pair<pair<scaling_map, scaling_map>, MutableLinkagePtr> &&test) {
+
+        auto &[test_maps, test_linkage] = test;
+        auto &[test_flop_map, test_mem_map] = test_maps;
+
+        // skip empty linkages
+        if (test_linkage == nullptr) return;
+        if (test_linkage->empty()) return;
+        test_linkage->forget(true); // clear linkage history
+
+        if (test_flop_map > flop_map_) {
+            // remove the linkage completely if the scaling only got worse
+            ignore_linkages.insert(test_linkage);
+            return;
+        }
+
+        bool is_scalar = test_linkage->is_scalar(); // check if linkage is a scalar
+        bool is_reused = test_linkage->reused_; // check if linkage is reused
+
+        // test if this is the best flop map seen
+        int comparison = test_flop_map.compare(flop_map_);
+        bool is_equiv = comparison == scaling_map::this_same;
+        bool keep = comparison == scaling_map::this_better;
+
+        // if we haven't made a substitution yet and this is either a
+        // scalar or a sigma vector, keep it
+        if (keep || is_reused || (is_scalar && !Equation::no_scalars_)) keep = true;
+
+        // if the scaling is the same and it is allowed, set keep to true
+        if (is_equiv && allow_equality) keep = true;
+
+        if (keep) {
+            // the scaling maps are compared element by element, so ranking the changes
+            // to the current scaling is the same as ranking the resulting scaling
+            candidate_queue.push_back({test_flop_map - flop_map_, test_mem_map - mem_map_,
+                                       candidate, test_linkage, pass});
+            std::push_heap(candidate_queue.begin(), candidate_queue.end(), substitution_candidate::worse);
+        } else {
+            ignore_linkages.insert(test_linkage); // add linkage to ignore linkages
+        }
+    };
+
     size_t retries = 0; // number of retries
-    while ((!test_linkages.empty() || first_pass) && temp_counts_[temp_type] < max_temps_) {
+    while ((!test_linkages.empty() || first_pass) && temp_counts_[temp_type] < max_temps_
+           && num_subs_made_ < max_subs_ && !out_of_budget(!only_scalars)) {
         substitute_timer.start();
 
         makeSub = false; // reset flag
-        bool allow_equality = true; // flag to allow equality in flop map
         size_t n_linkages = test_linkages.size(); // get number of linkages
         MutableLinkagePtr link_to_sub; // best linkage to substitute
 
-        // populate with pairs of flop maps with linkage for each equation
-        vector<pair<pair<scaling_map,scaling_map>, MutableLinkagePtr>> test_data(n_linkages);
-
+        ++pass;
+        if (!only_scalars) ++num_rounds_;
+        if (!pass_rounds_.empty()) ++pass_rounds_.back().second;
 
-        // print ratio for showing progress
-        size_t print_ratio = n_linkages / 20;
-        bool print_progress = n_linkages > 2000;
-
-        if (print_progress)
-            cout << "PROGRESS:" << endl;
-
-        /**
-         * Iterate over all linkages in parallel and test if they can be substituted into the equations.
-         * If they can, save the flop map for each equation.
-         * If the flop map is better than the current best flop map, save the linkage.
-         */
-
-        int num_threads = 1;
-        #pragma omp parallel
-        {
-            #pragma omp single
-            num_threads = omp_get_num_threads();
-        }
-        std::vector<linkage_vector> local_ignores(num_threads);
+        for (auto &[eq_name, equation]: equations_)
+            equation.index_terms();
 
-#pragma omp parallel for schedule(guided) default(none) shared(test_linkages, test_data, \
-            ignore_linkages, equations_, stdout, local_ignores) firstprivate(n_linkages, temp_counts_, temp_type, allow_equality, \
-            format_sigma, print_ratio, print_progress, only_scalars, separate_sigma_)
-        for (int i = 0; i < n_linkages; ++i) {
+        // test every candidate unless lazy_greedy_ lets the queue carry over from the last pass
+        if (!lazy_greedy_ || rebuild_queue || candidate_queue.empty()) {
 
-            // use original const pointer for early-exit checks (avoids expensive shallow copy)
-            const LinkagePtr &orig_linkage = test_linkages[i];
-            bool is_scalar = orig_linkage->is_scalar();
-            bool is_sigma = orig_linkage->is_sigma_;
+            // populate with pairs of flop maps with linkage for each equation
+            vector<pair<pair<scaling_map,scaling_map>, MutableLinkagePtr>> test_data(n_linkages);
 
-            if (is_scalar && Equation::no_scalars_) {
-                local_ignores[omp_get_thread_num()].push_back(orig_linkage);
-                continue;
-            }
+            // print ratio for showing progress
+            size_t print_ratio = n_linkages / 20;
+            bool print_progress = n_linkages > 2000;
 
-            if ((format_sigma && is_sigma) || (only_scalars && !is_scalar)) {
-                local_ignores[omp_get_thread_num()].push_back(orig_linkage);
-                continue;
-            }
+            if (print_progress)
+                cout << "PROGRESS:" << endl;
 
-            // check if this linkage is in the ignore set
-            if (ignore_linkages.contains(orig_linkage)) {
-                continue;
-            }
+            /**
+             * Iterate over all linkages in parallel and test if they can be substituted into the equations.
+             * If they can, save the flop map for each equation.
+             * If the flop map is better than the current best flop map, save the linkage.
+             */
 
-            // now make the mutable shallow copy (only for linkages that pass early checks)
-            MutableLinkagePtr linkage = as_link(orig_linkage->shallow());
-
-            string eq_type; // get equation type
-            if (is_scalar){
-                eq_type = "scalar";
-            } else if (!is_sigma && separate_sigma_) {
-                eq_type = "reused";
-                linkage->reused_ = true;
-            } else {
-                eq_type = "temp";
+            int num_threads = 1;
+            #pragma omp parallel
+            {
+                #pragma omp single
+                num_threads = omp_get_num_threads();
             }
+            std::vector<linkage_vector> local_ignores(num_threads);
 
-            // set id of linkage
-            long temp_id = temp_counts_[eq_type] + 1; // get number of temps
-            linkage->id() = temp_id;
-
-            scaling_map test_flop_map; // flop map for test equation
-            scaling_map test_mem_map; // flop map for test equation
-            size_t numSubs = 0; // number of substitutions made
-            for (auto &[eq_name, equation]: equations_) { // iterate over equations
-
-                if (eq_name == "scalar" || eq_name == "reused") continue; // skip scalar and reuse equations
-
-                // if the substitution is possible and beneficial, collect the flop map for the test equation
-                numSubs += equation.test_substitute(linkage, test_flop_map, test_mem_map, allow_equality);
+            // only the terms that changed since the last pass are substituted again; the others
+            // reuse the results cached for each candidate. drop the caches of past candidates.
+            {
+                std::unordered_map<LinkagePtr, substitution_cache> kept_caches;
+                kept_caches.reserve(n_linkages);
+                for (const auto &linkage: test_linkages) {
+                    auto cache_pos = substitution_caches.find(linkage);
+                    if (cache_pos != substitution_caches.end())
+                         kept_caches.emplace(linkage, std::move(cache_pos->second));
+                    else kept_caches.emplace(linkage, substitution_cache());
+                }
+                substitution_caches.swap(kept_caches);
             }
 
-            // add to test scalings if we found a tmp that occurs in more than one term
-            // or that occurs at least once and can be reused / is a scalar
+#pragma omp parallel for schedule(guided) default(none) shared(test_linkages, test_data, substitution_caches, \
+            ignore_linkages, stdout, local_ignores) firstprivate(n_linkages, allow_equality, \
+            format_sigma, print_ratio, print_progress, only_scalars)
+            for (int i = 0; i < n_linkages; ++i) {
 
-            // include declaration for scaling?
-            bool keep_declaration = eq_type != "scalar" && eq_type != "reused";
+                // leave the remaining candidates untested once the time budget runs out
+                if (past_deadline()) continue;
 
-            // test if we made a valid substitution
-            if (numSubs > 0) {
+                // use original const pointer for early-exit checks (avoids expensive shallow copy)
+                const LinkagePtr &orig_linkage = test_linkages[i];
+                test_data[i] = test_candidate(orig_linkage, substitution_caches.find(orig_linkage)->second, ignore_linkages,
+                                              local_ignores[omp_get_thread_num()], format_sigma, only_scalars, allow_equality);
 
-                if (keep_declaration) {
-                    // make term of tmp declaration
-                    Term precon_term = Term(linkage, 1.0);
-                    precon_term.compute_scaling();
-                    // add scaling of declaration term to the test flop map if we are keeping the declaration
-                    test_flop_map += precon_term.flop_map();
-                    test_mem_map += precon_term.mem_map();
+                if (print_progress && i % print_ratio == 0) {
+                    printf("  %2.1lf%%", (double) i / (double) n_linkages * 100);
+                    std::fflush(stdout);
                 }
 
-                // set any negative values to zero
-                test_flop_map.all_positive();
-                test_mem_map.all_positive();
-
-                // save this test flop map and linkage for serial testing
-                test_data[i] = make_pair(make_pair(test_flop_map, test_mem_map), linkage);
+            } // end iterations over all linkages
+            if (print_progress) std::cout << "  Done" << std::endl << std::endl;
 
-            } else { // if we didn't make a substitution, add linkage to ignore linkages
-                linkage->forget(); // clear linkage history
-                local_ignores[omp_get_thread_num()].push_back(linkage);
+            // merge thread-local ignore sets into the shared ignore set (serial, no contention)
+            for (auto &local : local_ignores) {
+                ignore_linkages.insert(local.begin(), local.end());
             }
 
-            if (print_progress && i % print_ratio == 0) {
-                printf("  %2.1lf%%", (double) i / (double) n_linkages * 100);
-                std::fflush(stdout);
-            }
-
-        } // end iterations over all linkages
-        if (print_progress) std::cout << "  Done" << std::endl << std::endl;
+            /**
+             * Iterate over all test scalings, remove incompatible ones, and queue them
+             */
+            candidate_queue.clear();
+            for (size_t i = 0; i < n_linkages; ++i)
+                queue_candidate(test_linkages[i], std::move(test_data[i]));
+            rebuild_queue = false;
 
-        // merge thread-local ignore sets into the shared ignore set (serial, no contention)
-        for (auto &local : local_ignores) {
-            ignore_linkages.insert(local.begin(), local.end());
         }
+        substitute_timer.stop(); // stop timer for substitution
 
-
-
-        /**
-         * Iterate over all test scalings, remove incompatible ones, and sort them
-         */
-
-        // candidate substitutions, ordered by scaling. ties (linkages that yield the
-        // same scaling) are broken by a canonical key so that the substitution order
-        // -- and therefore the generated intermediates and final equations -- does not
-        // depend on the order in which the parallel search happened to populate the
-        // candidate set (which varies with thread scheduling).
-        std::vector<std::tuple<pair<scaling_map, scaling_map>, std::string, MutableLinkagePtr>> sorted_test_data;
-        for (auto &[test_maps, test_linkage]: test_data) {
-
-            auto &[test_flop_map, test_mem_map] = test_maps;
-
-            // skip empty linkages
-            if (test_linkage == nullptr) continue;
-            if (test_linkage->empty()) continue;
-            test_linkage->forget(true); // clear linkage history
-
-            if (test_flop_map > flop_map_) {
-                // remove the linkage completely if the scaling only got worse
-                ignore_linkages.insert(test_linkage);
-                continue;
-            }
-
-            bool is_scalar = test_linkage->is_scalar(); // check if linkage is a scalar
-            bool is_reused = test_linkage->reused_; // check if linkage is reused
-
-            // test if this is the best flop map seen
-            int comparison = test_flop_map.compare(flop_map_);
-            bool is_equiv = comparison == scaling_map::this_same;
-            bool keep = comparison == scaling_map::this_better;
-
-            // if we haven't made a substitution yet and this is either a
-            // scalar or a sigma vector, keep it
-            if (keep || is_reused || (is_scalar && !Equation::no_scalars_)) keep = true;
-
-            // if the scaling is the same and it is allowed, set keep to true
-            if (is_equiv && allow_equality) keep = true;
-
-            if (keep) {
-                sorted_test_data.emplace_back(std::make_pair(test_flop_map, test_mem_map), test_linkage->tot_str(true), test_linkage);
-            } else {
-                ignore_linkages.insert(test_linkage); // add linkage to ignore linkages
-            }
+        // the candidates may not all be tested, so keep the substitutions made so far
+        if (past_deadline()) {
+            stop_reason_ = "time_budget";
+            break;
         }
-        // sort by scaling (best first), breaking ties on the canonical linkage string
-        std::sort(sorted_test_data.begin(), sorted_test_data.end(),
-                  [](const std::tuple<std::pair<scaling_map, scaling_map>, std::string, MutableLinkagePtr> &a,
-                     const std::tuple<std::pair<scaling_map, scaling_map>, std::string, MutableLinkagePtr> &b) {
-                      if (std::get<0>(a).first != std::get<0>(b).first) return std::get<0>(a).first < std::get<0>(b).first;
-                      if (std::get<0>(a).second != std::get<0>(b).second) return std::get<0>(a).second < std::get<0>(b).second;
-                      return std::get<1>(a) < std::get<1>(b);
-                  });
-        substitute_timer.stop(); // stop timer for substitution
 
-        makeSub = !sorted_test_data.empty();
+        makeSub = !candidate_queue.empty();
         if (makeSub) {
 
             /**
@@ -440,13 +473,35 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
             update_timer.start();
 
             size_t batch_count = 0;
-            for (const auto &[found_scalings, found_key, found_linkage]: sorted_test_data) {
-
-                auto & [found_flop, found_mem] = found_scalings;
+            while (!candidate_queue.empty()) {
 
                 substitute_timer.start();
 
-                link_to_sub = found_linkage;
+                std::pop_heap(candidate_queue.begin(), candidate_queue.end(), substitution_candidate::worse);
+                substitution_candidate found = std::move(candidate_queue.back());
+                candidate_queue.pop_back();
+
+                if (found.pass_ != pass) {
+                    // the candidate was tested before the last substitutions; retest and requeue it
+                    substitute_timer.stop();
+                    if (ignore_linkages.contains(found.candidate_)) continue;
+
+                    linkage_vector ignores;
+                    queue_candidate(found.candidate_, test_candidate(found.candidate_, substitution_caches[found.candidate_],
+                                                                     ignore_linkages, ignores, format_sigma, only_scalars,
+                                                                     allow_equality));
+                    ignore_linkages.insert(ignores.begin(), ignores.end());
+                    continue;
+                }
+
+                if (skip_best > 0) {
+                    // leave this candidate to another branch of the beam search
+                    substitute_timer.stop();
+                    --skip_best;
+                    continue;
+                }
+
+                link_to_sub = found.linkage_;
 
                 // get number of temps for this type
                 string eq_type = link_to_sub->type();
@@ -482,6 +537,11 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
 
                 // collect new scaling
                 collect_scaling();
+                if (lazy_greedy_) {
+                    // queued candidates may be retested before the next pass
+                    for (auto &[eq_name, equation]: equations_)
+                        equation.index_terms();
+                }
 
                 if (num_subs == 0) {
                     temp_counts_[eq_type]--;
@@ -502,6 +562,7 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
                     // add linkage to this set
                     saved_linkages_[eq_type].insert(link_to_sub); // add tmp to tmps
                     found_any = true; // set found any flag to true
+                    ++num_subs_made_;
                 }
 
                 num_terms = get_num_terms(); // get number of terms
@@ -533,7 +594,8 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
                 // break if not batching substitutions or if we have reached the batch size
                 // at batch_size_=1 this will only substitute the best link found and then completely regenerate the results.
                 // otherwise it will substitute the best batch_size_ number of linkages and then regenerate the results.
-                if (!batched_ || ++batch_count >= batch_size_ || temp_counts_[eq_type] > max_temps_) {
+                if (!batched_ || ++batch_count >= batch_size_ || temp_counts_[eq_type] > max_temps_
+                    || num_subs_made_ >= max_subs_) {
                     break;
                 }
             }
@@ -541,6 +603,9 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
             update_timer.stop();
         }
 
+        // fewer candidates than this branch of the beam search skips
+        if (skip_best > 0) break;
+
         update_timer.start();
 
         // remove all prior substituted linkages
@@ -556,6 +621,9 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
 
         if (recompute) {
 
+            // the graph and the candidates change below, so test every candidate again
+            rebuild_queue = true;
+
             // synchronize all pointers in graph
             forget();
 
@@ -586,8 +654,13 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
             // gradually increase max depth if we have not found any linkages (start from lowest depth; only if batching)
             while (test_linkages.empty()) {
 
-                if (++current_depth == 0) --current_depth; // reset depth if overflow
-                Term::max_depth_ = current_depth; // increase max depth
+                // regenerating the linkages takes long at larger depths; keep the substitutions made so far
+                if (past_deadline()) {
+                    stop_reason_ = "time_budget";
+                    break;
+                }
+
+                if (++current_depth == 0) --current_depth; // reset depth if overflow (increase max depth)
 
                 {
                     cout << "Regenerating test set with depth " << flush;
@@ -597,7 +670,7 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
                 }
 
                 // regenerate all valid linkages with the new depth
-                make_all_links(true);
+                make_all_links(true, current_depth);
 
                 // update test linkages
                 test_linkages = all_links_ - ignore_linkages;
@@ -661,8 +734,6 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
     // prune intermediates, but also remove single use intermediates
     prune();
 
-    Term::max_depth_ = org_max_depth;
-
     // resort tmps
     for (auto & [type, eq] : equations_)
         eq.rearrange();
@@ -706,6 +777,266 @@ void PQGraph::substitute(bool format_sigma, bool only_scalars) {
     total_timer.stop();
 }
 
+pair<pair<scaling_map, scaling_map>, MutableLinkagePtr> PQGraph::test_candidate(
+        const LinkagePtr &orig_linkage, substitution_cache &cache, const linkage_set &ignore_linkages,
+        linkage_vector &ignores, bool format_sigma, bool only_scalars, bool allow_equality) {
+
+    // use original const pointer for early-exit checks (avoids expensive shallow copy)
+    bool is_scalar = orig_linkage->is_scalar();
+    bool is_sigma = orig_linkage->is_sigma_;
+
+    if (is_scalar && Equation::no_scalars_) {
+        ignores.push_back(orig_linkage);
+        return {{scaling_map(), scaling_map()}, nullptr};
+    }
+
+    if ((format_sigma && is_sigma) || (only_scalars && !is_scalar)) {
+        ignores.push_back(orig_linkage);
+        return {{scaling_map(), scaling_map()}, nullptr};
+    }
+
+    // check if this linkage is in the ignore set
+    if (ignore_linkages.contains(orig_linkage)) {
+        return {{scaling_map(), scaling_map()}, nullptr};
+    }
+
+    // now make the mutable shallow copy (only for linkages that pass early checks)
+    MutableLinkagePtr linkage = as_link(orig_linkage->shallow());
+
+    string eq_type; // get equation type
+    if (is_scalar){
+        eq_type = "scalar";
+    } else if (!is_sigma && separate_sigma_) {
+        eq_type = "reused";
+        linkage->reused_ = true;
+    } else {
+        eq_type = "temp";
+    }
+
+    // set id of linkage
+    long temp_id = temp_counts_.at(eq_type) + 1; // get number of temps
+    linkage->id() = temp_id;
+
+    scaling_map test_flop_map; // flop map for test equation
+    scaling_map test_mem_map; // flop map for test equation
+    size_t numSubs = 0; // number of substitutions made
+    substitution_cache next_cache;
+    for (auto &[eq_name, equation]: equations_) { // iterate over equations
+
+        if (eq_name == "scalar" || eq_name == "reused") continue; // skip scalar and reuse equations
+
+        // if the substitution is possible and beneficial, collect the flop map for the test equation
+        numSubs += equation.test_substitute(linkage, test_flop_map, test_mem_map, allow_equality, cache, next_cache);
+    }
+    cache.swap(next_cache); // keep only the results for terms that still exist
+
+    // add to test scalings if we found a tmp that occurs in more than one term
+    // or that occurs at least once and can be reused / is a scalar
+
+    // include declaration for scaling?
+    bool keep_declaration = eq_type != "scalar" && eq_type != "reused";
+
+    // test if we made a valid substitution
+    if (numSubs > 0) {
+
+        if (keep_declaration) {
+            // make term of tmp declaration
+            Term precon_term = Term(linkage, 1.0);
+            precon_term.compute_scaling();
+            // add scaling of declaration term to the test flop map if we are keeping the declaration
+            test_flop_map += precon_term.flop_map();
+            test_mem_map += precon_term.mem_map();
+        }
+
+        // set any negative values to zero
+        test_flop_map.all_positive();
+        test_mem_map.all_positive();
+
+        // save this test flop map and linkage for serial testing
+        return make_pair(make_pair(test_flop_map, test_mem_map), linkage);
+
+    } else { // if we didn't make a substitution, add linkage to ignore linkages
+        linkage->forget(); // clear linkage history
+        ignores.push_back(linkage);
+    }
+    return {{scaling_map(), scaling_map()}, nullptr};
+}
+
+bool PQGraph::past_deadline() const {
+    if (time_budget_ < 0 || optimize_start_ == std::chrono::steady_clock::time_point{})
+        return false;
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - optimize_start_;
+    return elapsed.count() >= time_budget_;
+}
+
+bool PQGraph::out_of_budget(bool count_rounds) {
+    if (!stop_reason_.empty())
+        return true;
+
+    if (count_rounds && num_rounds_ >= max_rounds_)
+        stop_reason_ = "max_rounds";
+    else if (past_deadline())
+        stop_reason_ = "time_budget";
+    return !stop_reason_.empty();
+}
+
+void PQGraph::beam_substitute(bool format_sigma) {
+
+    if (beam_width_ <= 1) {
+        substitute(format_sigma, false);
+        return;
+    }
+
+    // a substitution sequence with the scaling it reaches after the lookahead
+    struct beam_state {
+        PQGraph graph_;
+        scaling_map flop_map_, mem_map_;
+        size_t rank_; // order in which the branch was made (breaks ties)
+    };
+    auto better_state = [](const beam_state &left, const beam_state &right) {
+        int comparison = left.flop_map_.compare(right.flop_map_);
+        if (comparison != scaling_map::this_same) return comparison == scaling_map::this_better;
+        comparison = left.mem_map_.compare(right.mem_map_);
+        if (comparison != scaling_map::this_same) return comparison == scaling_map::this_better;
+        return left.rank_ < right.rank_;
+    };
+
+    size_t beam_width = beam_width_, lookahead_depth = beam_depth_;
+    vector<beam_state> beam;
+    beam.push_back({clone(), flop_map_, mem_map_, 0});
+    vector<beam_state> finished; // sequences that cannot be extended
+
+    // the greedy sequence is always a candidate, so the search is never worse than greedy substitution
+    {
+        print_guard guard;
+        guard.lock();
+
+        PQGraph greedy = clone();
+        greedy.substitute(format_sigma, false);
+        finished.push_back({std::move(greedy), scaling_map(), scaling_map(), 0});
+        finished.back().flop_map_ = finished.back().graph_.flop_map_;
+        finished.back().mem_map_ = finished.back().graph_.mem_map_;
+    }
+
+    // a substitution can be pruned again at the end of substitute() (e.g. an intermediate of equal scaling that is
+    // used once), which leaves the graph as it was. only branches whose intermediates survive, or whose scaling
+    // improves, are extended; the others would be extended forever.
+    auto num_saved = [](const PQGraph &graph) {
+        size_t count = 0;
+        for (const auto &[type, linkages]: graph.saved_linkages_)
+            count += linkages.size();
+        return count;
+    };
+    auto improved = [](const PQGraph &graph, const scaling_map &flop_map, const scaling_map &mem_map) {
+        int comparison = graph.flop_map_.compare(flop_map);
+        if (comparison != scaling_map::this_same) return comparison == scaling_map::this_better;
+        return graph.mem_map_.compare(mem_map) == scaling_map::this_better;
+    };
+
+    size_t step = 0, num_branches = 0;
+    bool out_of_time = false;
+    while (!beam.empty()) {
+
+        // once the time budget runs out, the sequences of the beam are done as they are
+        if (past_deadline()) {
+            out_of_time = true;
+            for (beam_state &state: beam) {
+                state.flop_map_ = state.graph_.flop_map_;
+                state.mem_map_ = state.graph_.mem_map_;
+                state.rank_ = finished.size();
+                finished.push_back(std::move(state));
+            }
+            break;
+        }
+        ++step;
+
+        // branch on the beam_width_ best candidates of each sequence
+        vector<beam_state> branches;
+        branches.reserve(beam.size() * beam_width);
+        for (const auto &state: beam) {
+            for (size_t b = 0; b < beam_width; ++b) {
+                branches.push_back({state.graph_.clone(), scaling_map(), scaling_map(), branches.size()});
+                branches.back().graph_.skip_best_ = b;
+                branches.back().graph_.max_subs_ = 1;
+            }
+        }
+        num_branches += branches.size();
+
+        vector<char> advanced(branches.size(), 0);
+        {
+            print_guard guard;
+            guard.lock();
+
+            // branches share no state (the depth of the linkages is local to each call of substitute)
+#pragma omp parallel for schedule(dynamic) default(none) shared(branches, advanced, num_saved, improved) \
+            firstprivate(format_sigma, lookahead_depth)
+            for (int i = 0; i < (int) branches.size(); ++i) {
+                PQGraph &graph = branches[i].graph_;
+                if (graph.past_deadline()) continue;
+                size_t saved = num_saved(graph);
+                scaling_map flop_map = graph.flop_map_, mem_map = graph.mem_map_;
+                graph.substitute(format_sigma, false);
+                if (graph.num_subs_made_ == 0) continue;
+                if (num_saved(graph) <= saved && !improved(graph, flop_map, mem_map)) continue;
+                advanced[i] = 1;
+
+                // rank the branch by its scaling after a few greedy substitutions (or by its own scaling
+                // once the time budget runs out)
+                if (lookahead_depth == 0 || graph.past_deadline()) {
+                    branches[i].flop_map_ = graph.flop_map_;
+                    branches[i].mem_map_ = graph.mem_map_;
+                    continue;
+                }
+                PQGraph lookahead = graph.clone();
+                lookahead.skip_best_ = 0;
+                lookahead.max_subs_ = lookahead_depth;
+                lookahead.substitute(format_sigma, false);
+                branches[i].flop_map_ = lookahead.flop_map_;
+                branches[i].mem_map_ = lookahead.mem_map_;
+            }
+        }
+
+        // sequences without any substitution left are done
+        for (size_t j = 0; j < beam.size(); ++j) {
+            auto first = advanced.begin() + (long) (j * beam_width);
+            if (std::find(first, first + (long) beam_width, 1) != first + (long) beam_width) continue;
+
+            beam_state &state = beam[j];
+            state.flop_map_ = state.graph_.flop_map_;
+            state.mem_map_ = state.graph_.mem_map_;
+            state.rank_ = finished.size();
+            finished.push_back(std::move(state));
+        }
+
+        // keep the best branches
+        vector<beam_state> next_beam;
+        for (size_t i = 0; i < branches.size(); ++i) {
+            if (advanced[i]) next_beam.push_back(std::move(branches[i]));
+        }
+        std::sort(next_beam.begin(), next_beam.end(), better_state);
+        if (next_beam.size() > beam_width)
+            next_beam.erase(next_beam.begin() + (long) beam_width, next_beam.end());
+        beam = std::move(next_beam);
+
+        cout << "Beam step " << step << ": kept " << beam.size() << " of " << branches.size() << " branches";
+        if (!beam.empty())
+            cout << " (best contractions: " << beam.front().flop_map_.total() << ")";
+        cout << endl;
+    }
+
+    // the scaling of finished sequences is final, so the best one is the result
+    auto best = std::min_element(finished.begin(), finished.end(), better_state);
+    PQGraph result = std::move(best->graph_);
+    result.max_subs_ = max_subs_;
+    result.skip_best_ = skip_best_;
+    *this = std::move(result);
+    if (out_of_time) stop_reason_ = "time_budget";
+
+    cout << endl << "Beam search tested " << num_branches << " branches in " << step << " steps." << endl;
+    cout << "    Total contractions: " << flop_map_.total() << endl << endl;
+}
+
 size_t Equation::substitute(const LinkagePtr &linkage, bool allow_equality) {
 
     /// iterate over terms and substitute
@@ -737,47 +1068,90 @@ size_t Equation::substitute(const LinkagePtr &linkage, bool allow_equality) {
     return num_subs;
 }
 
-size_t Equation::test_substitute(const MutableLinkagePtr &linkage, scaling_map &test_flop_map, scaling_map &test_mem_map, bool allow_equality) {
+void Equation::index_terms() {
+
+    term_index_.clear();
+    for (size_t i = 0; i < terms_.size(); i++) {
+        const Term &term = terms_[i];
+        if (term.rhs().empty()) continue; // cannot be compatible with any linkage
+
+        for (const auto &vertex : term.term_linkage()->vertices()) {
+            vector<size_t> &positions = term_index_[vertex->name_];
+            if (positions.empty() || positions.back() != i)
+                positions.push_back(i);
+        }
+    }
+}
+
+size_t Equation::test_substitute(const MutableLinkagePtr &linkage, scaling_map &test_flop_map, scaling_map &test_mem_map,
+                                 bool allow_equality, const substitution_cache &cache, substitution_cache &next_cache) {
 
     // scaling of the linkage cannot be more than the equation
     if (linkage->netscales().first > flop_map()) return 0;
 
-    /// iterate over terms and substitute
-    size_t num_terms = terms_.size();
     size_t num_subs = 0; // number of substitutions
     test_flop_map += flop_map_; // test flop scaling map
     test_mem_map += mem_map_; // test memory scaling map
 
-    for (int i = 0; i < num_terms; i++) {
-        // skip term if linkage is not compatible
-        if (!terms_[i].is_compatible(linkage)) continue;
-
-        // Take the vertex orderings from the term ITSELF, not from the copy made
-        // below. They depend only on the term, and generating them builds up to
-        // 2^depth linkages -- by far the most expensive thing that happens here.
-        // The term's own memoized set survives from one candidate intermediate to
-        // the next (a copied linkage deliberately starts with empty caches), so
-        // hoisting the call turns per-candidate regeneration into one generation
-        // per term per pass.
-        const linkage_vector graph_perms = terms_[i].term_linkage()->permutations();
-
-        // get term copy
-        Term term = terms_[i];
-        term.term_linkage() = as_link(term.term_linkage()->shallow()); // deep copy of term linkage
-
-        // It's faster to subtract the old scaling and add the new scaling than
-        // to recompute the scaling map from scratch
-        test_flop_map -= term.flop_map(); // subtract flop scaling map for term
-        test_mem_map -= term.mem_map(); // subtract memory scaling map for term
-
-        // substitute linkage in term copy
-        bool madeSub = term.substitute(linkage, graph_perms);
-        term.term_linkage()->forget(); // clear the linkage history for lazy evaluation
-        test_flop_map += term.flop_map(); // add new flop scaling map for term
-        test_mem_map += term.mem_map(); // add new memory scaling map for term
+    // a compatible term contains every vertex of the linkage, so only the terms
+    // containing its least common vertex need to be tested
+    const vector<size_t> *positions = nullptr;
+    for (const auto &vertex : linkage->vertices()) {
+        auto index_pos = term_index_.find(vertex->name_);
+        if (index_pos == term_index_.end()) return num_subs; // no term contains this vertex
+        if (!positions || index_pos->second.size() < positions->size())
+            positions = &index_pos->second;
+    }
+    if (!positions) return num_subs;
+
+    for (size_t i : *positions) {
+        const Term &original = terms_[i];
+
+        // the result of substituting into a term only changes with the term
+        pair<const Vertex*, const Linkage*> key(original.lhs().get(), original.term_linkage().get());
+        auto cached = cache.find(key);
+        if (cached == cache.end()) {
+            term_substitution result;
+            result.lhs_ = original.lhs();
+            result.linkage_ = original.term_linkage();
+            result.compatible_ = original.is_compatible(linkage);
+
+            if (result.compatible_) {
+                // Take the vertex orderings from the term ITSELF, not from the copy made
+                // below. They depend only on the term, and generating them builds up to
+                // 2^depth linkages -- by far the most expensive thing that happens here.
+                // The term's own memoized set survives from one candidate intermediate to
+                // the next (a copied linkage deliberately starts with empty caches), so
+                // hoisting the call turns per-candidate regeneration into one generation
+                // per term per pass.
+                const linkage_vector graph_perms = original.term_linkage()->permutations();
+
+                // get term copy
+                Term term = original;
+                term.term_linkage() = as_link(term.term_linkage()->shallow()); // deep copy of term linkage
+
+                // substitute linkage in term copy
+                result.made_sub_ = term.substitute(linkage, graph_perms);
+                term.term_linkage()->forget(); // clear the linkage history for lazy evaluation
+
+                // It's faster to subtract the old scaling and add the new scaling than
+                // to recompute the scaling map from scratch
+                result.flop_diff_ = term.flop_map() - original.flop_map();
+                result.mem_diff_ = term.mem_map() - original.mem_map();
+            }
+            cached = next_cache.emplace(key, std::move(result)).first;
+        } else {
+            cached = next_cache.insert(*cached).first;
+        }
+
+        const term_substitution &result = cached->second;
+        if (!result.compatible_) continue; // skip term if linkage is not compatible
+
+        test_flop_map += result.flop_diff_; // add change in flop scaling map for term
+        test_mem_map += result.mem_diff_; // add change in memory scaling map for term
 
         // increment number of substitutions if substitution was successful
-        if (madeSub) ++num_subs; // increment number of substitutions
+        if (result.made_sub_) ++num_subs; // increment number of substitutions
 
     } // substitute linkage in term copy
 
@@ -846,7 +1220,7 @@ bool Term::substitute(const LinkagePtr &linkage, const linkage_vector &graph_per
         // the score is only multiset-determined for the general permutation branch
         const bool score_is_reusable = !new_term_linkage->is_temp() && !new_term_linkage->is_addition();
 
-        new_term_linkage = as_link(new_term_linkage)->best_permutation();
+        new_term_linkage = new_term_linkage->best_permutation();
         const auto &[new_flop, new_mem] = new_term_linkage->netscales();
         const auto &[best_flop, best_mem] = best_linkage->netscales();
 
@@ -270,6 +270,13 @@ namespace pdaggerq {
             rhs_ = {term_link};
         }
 
+        merge_constants();
+        request_update();
+        compute_scaling(true);
+    }
+
+    void Term::merge_constants() {
+
         // find constants in rhs and merge them into the coefficient. skip empty vertices
         double merged_factor = coefficient_;
 
@@ -293,9 +300,6 @@ namespace pdaggerq {
 
         // update rhs
         rhs_ = new_rhs;
-
-        request_update();
-        compute_scaling(true);
     }
 
     void Term::reorder(bool recompute) { // reorder rhs in term
@@ -311,11 +315,11 @@ namespace pdaggerq {
 
         if (is_optimal_) return; // if term is already optimal, return
 
-        /// Reorder by taking every permutation of the term and finding the best one.
-        /// We use the linkage to determine the best permutation
+        /// Reorder by finding the best contraction tree of the term.
+        /// We use the linkage to determine the best tree
 
-        // generate every permutation and return the best one
-        LinkagePtr best_linkage = term_linkage()->best_permutation();
+        // search every binary contraction tree and return the best one
+        LinkagePtr best_linkage = term_linkage()->best_contraction_tree();
 
         // replace the rhs with the best linkage (if it is a temp or addition, we should not expand into a vector)
         expand_rhs(best_linkage);
@@ -752,12 +756,12 @@ namespace pdaggerq {
     bool Term::is_valid() {
         for (const auto & op : rhs_) {
             // any 'ab' or 'ba' blocks for 1 body operators are invalid
-            if (op->rank() == 2 && op->shape_.a_ == 1 && op->shape_.b_ == 1) {
+            if (op->rank() == 2 && op->shape_.a() == 1 && op->shape_.b() == 1) {
                 return false;
             }
 
             // should have same number of alpha and beta lines for 2 body operators
-            if (op->rank() == 4 && (op->shape_.a_ > 0 && op->shape_.b_ > 0) && (op->shape_.a_ != op->shape_.b_)) {
+            if (op->rank() == 4 && (op->shape_.a() > 0 && op->shape_.b() > 0) && (op->shape_.a() != op->shape_.b())) {
                 return false;
             }
         }
@@ -794,7 +798,7 @@ namespace pdaggerq {
 
         // first we change lines associated with all beta amplitudes
         for (auto & op : alpha_term.rhs_) {
-            if (op->vertex_type_ == 'a' && op->shape_.a_ == 0 && op->shape_.b_ > 0){
+            if (op->vertex_type_ == 'a' && op->shape_.a() == 0 && op->shape_.b() > 0){
                 for (const auto & line : op->lines()){
                     Line new_line = line;
                     new_line.a_ = true;
@@ -811,7 +815,7 @@ namespace pdaggerq {
         // now we replace all t2-aa blocks with permutations of t2-ab blocks
         LineMap t2abij_map, t2baij_map;
         for (auto & op : alpha_term.rhs_) {
-            if (op->vertex_type_ == 'a' && op->shape_.a_ == 4){
+            if (op->vertex_type_ == 'a' && op->shape_.a() == 4){
 
                 // create alpha and beta lines
                 Line aa = op->lines()[0]; aa.a_ = true;
@@ -334,7 +334,7 @@ namespace pdaggerq {
         lines_ = lines; // set lines
         rank_ = lines.size(); // set rank
         shape_ = shape(lines_); // create shape from lines
-        has_blk_ |= shape_.b_ > 0; // beta dims only occurs with blocking
+        has_blk_ |= shape_.b() > 0; // beta dims only occurs with blocking
         for (const Line &line : lines_) {
             has_blk_ |= line.has_blk(); // check if any line has a block
         }
@@ -591,6 +591,8 @@ namespace pdaggerq {
     /****** operator overlaods ******/
 
     bool Vertex::operator==(const Vertex &other) const {
+        if (this == &other) return true;
+
         // check if rank, n_occ, n_vir, n_alph, n_beta are equal
 
         if (rank_ != other.rank_) return false;
@@ -615,6 +617,7 @@ namespace pdaggerq {
     }
 
     bool Vertex::equivalent(const Vertex &other) const {
+        if (this == &other) return true;
 
         // check if rank, n_occ, n_vir, n_alph, n_beta are equal
         if (this->is_linked() != other.is_linked())
@@ -633,6 +636,25 @@ namespace pdaggerq {
         return base_name_ == other.base_name_;
     }
 
+    size_t Vertex::structure_key() const {
+        // FNV-1a over the bytes of the name (std::hash differs between standard libraries)
+        uint64_t key = 0xCBF29CE484222325ull;
+        for (char c : base_name_)
+            key = (key ^ (unsigned char) c) * 0x100000001B3ull;
+        key = mix_key(key, (size_t) vertex_type_);
+        for (const Line &line : lines_)
+            key = mix_key(key, (size_t) line.type() << 8 | (unsigned char) line.block());
+        return key;
+    }
+
+    size_t Vertex::label_key() const {
+        size_t key = structure_key();
+        for (const Line &line : lines_)
+            for (char c : line.label_)
+                key = mix_key(key, (unsigned char) c);
+        return key;
+    }
+
     map<Line, uint_fast8_t> Vertex::self_links() const {
         // if rank is 0 or 1, return empty vector
         if (rank_ <= 1) return {};
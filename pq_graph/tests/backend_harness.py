@@ -0,0 +1,722 @@
+#!/usr/bin/env python
+"""
+Numerical validation and timing of the pq_graph printer backends.
+
+The equations of a codegen script in this directory (e.g. ccsd_codegen.py) are printed for each backend
+(python, runtime, blas, loop). The C/C++ outputs are compiled into small drivers and all backends are evaluated
+on the same random tensors. Every output is compared against the einsum (python) output, and the time and FLOP
+rate of each statement, equation and intermediate are reported as JSON. The evaluate backend runs the graph
+in memory with graph.evaluate instead of printed code (it is timed as a whole).
+
+Usage:
+    python backend_harness.py ccsd cisd --nocc 4 --nvirt 8 --json timings.json
+    python backend_harness.py ccsd --backends python,runtime,evaluate
+    python backend_harness.py ccsd --variants default,tiled,no_pool
+
+Each variant prints the codes with printer or optimization options of pq_graph on top of those of the codegen
+script (see variants_all); the default variant uses the options of the script as they are.
+
+The codes are generated in a separate process for each script (the printers change global state of pq_graph).
+Use --code-dir to evaluate codes printed elsewhere instead: the files <dir>/<test>.<backend> (or
+<dir>/<test>-<variant>.<backend> for other variants) hold the output of graph.str(backend). The runtime output
+is always needed, since the shapes of the tensors are read from it.
+"""
+
+import argparse
+import json
+import os
+import re
+import runpy
+import subprocess
+import sys
+import tempfile
+import textwrap
+import time
+from collections import defaultdict
+
+import numpy as np
+
+script_path = os.path.dirname(os.path.realpath(__file__))
+runtime_path = os.path.join(script_path, "..", "runtime")
+
+backends_all = ("python", "runtime", "blas", "loop")
+backends_graph = ("evaluate",) # backends that evaluate the graph itself (not printed code)
+
+# options of pq_graph for each variant of the printed codes (added to the options of the codegen script)
+variants_all = {
+    "default": {},
+    "tasks":   {"task_parallel": True},
+    "tiled":   {"loop_tile": 4},
+    "no_pool": {"buffer_pool": False},
+    "beam":    {"beam_width": 2, "beam_depth": 1},
+    "numeric": {"cost_model": "numeric", "nocc": 40, "nvirt": 400},
+    "batched": {"max_shape": "o2v1", "batch_lines": 1},
+}
+
+# line labels by type (as in pq_graph/include/line.hpp)
+occ_labels  = set("ijklmnoIJKMNO")
+virt_labels = set("abcdefghvABCDEFGHV")
+sig_labels  = set("LRXY")
+den_labels  = set("QU")
+
+# names of intermediates in the printed code
+scratch_names = ("tmps_", "scalars_", "reused_")
+
+banner_regex    = re.compile(r'^(/{5,}|#{5,}) (.*\S) \1\s*$')
+closing_regex   = re.compile(r'^(/{5,}|#{5,})\s*$')
+tensor_regex    = re.compile(r'\b([A-Za-z_]\w*(?:\["[^"]*"\])?)\("([^"]*)"\)')
+name_regex      = re.compile(r'^([A-Za-z_]\w*)(?:\["([^"]*)"\])?$')
+lhs_regex       = re.compile(r'^(?:loops:\s*)?([A-Za-z_]\w*(?:\["[^"]*"\])?)(?:\([^()]*\))?\s*(?:\+=|-=|=)(?!=)')
+flops_regex     = re.compile(r'flops:[^=]*=\s*(.*)')
+size_regex      = re.compile(r'\b(\w+)_size\b')
+
+
+def label_dim(label, dims):
+    """
+    Dimension of a line from the first character of its label.
+
+    Args:
+        label (str): label of the line (e.g. 'a', 'i', 'L').
+        dims (dict): dimension of each line type ('o', 'v', 'L', 'Q').
+    """
+    c = label[0]
+    if c in occ_labels: return dims['o']
+    if c in virt_labels: return dims['v']
+    if c in sig_labels: return dims['L']
+    if c in den_labels: return dims['Q']
+    return dims['v'] # as pq_graph, unknown labels are virtual
+
+
+def flop_count(text, dims):
+    """
+    Number of floating point operations of a statement from its 'flops:' comment (e.g. 'o1v1 += o2v1 o2v2').
+    Each contraction of scaling o^m v^n costs 2 o^m v^n operations (a multiplication and an addition).
+    """
+    match = flops_regex.search(text)
+    if not match: return 0
+    total = 0
+    for token in match.group(1).split():
+        count = 2
+        for kind, power in re.findall(r'([ovLQ])(\d+)', token):
+            count *= dims[kind] ** int(power)
+        total += count
+    return total
+
+
+def split_sections(code):
+    """
+    Split printed code into its named sections (Declarations, Scalars, Evaluate Equations, ...).
+
+    Returns:
+        list of (name, lines) in order of appearance.
+    """
+    sections = []
+    name, lines = None, []
+    for line in code.splitlines():
+        match = banner_regex.match(line)
+        if match:
+            if name is not None: sections.append((name, lines))
+            name, lines = " ".join(match.group(2).split()), []
+        elif closing_regex.match(line):
+            break
+        elif name is not None:
+            lines.append(line)
+    if name is not None: sections.append((name, lines))
+    return sections
+
+
+def code_parts(code):
+    """
+    Split printed code into declarations (file scope in C) and statements (body of a function).
+    """
+    top, body = [], []
+    for name, lines in split_sections(code):
+        if name in ("Declarations", "Buffer Pool"):
+            top += lines
+        elif name in ("Scalars", "Shared Operators", "Evaluate Equations"):
+            body += lines
+    return top, body
+
+
+def indent_of(line):
+    return len(line) - len(line.lstrip())
+
+
+def comment_text(line):
+    """ text of a comment line (None if the line is code) """
+    s = line.strip()
+    for prefix in ("//", "#"):
+        if s.startswith(prefix): return s.lstrip(prefix).strip()
+    return None
+
+
+def statement_blocks(body):
+    """
+    Group statements into blocks separated by blank lines (one block per printed term).
+
+    Returns:
+        list of dicts with the lines of each block and whether it can be timed on its own, that is, whether
+        it starts at the outermost level and the next block does as well (it does not open a scope it leaves open).
+    """
+    blocks, current = [], []
+    for line in body + [""]:
+        if line.strip():
+            current.append(line)
+        elif current:
+            blocks.append({"lines": current})
+            current = []
+    if not blocks: return blocks
+
+    base = min(indent_of(b["lines"][0]) for b in blocks)
+    for k, block in enumerate(blocks):
+        lines = block["lines"]
+        code = "\n".join(l for l in lines if comment_text(l) is None)
+        next_base = k + 1 == len(blocks) or indent_of(blocks[k + 1]["lines"][0]) == base
+        block["timed"] = (indent_of(lines[0]) == base and next_base and code.strip() != ""
+                          and code.count("{") == code.count("}"))
+        block["indent"] = " " * base
+    return blocks
+
+
+def describe_block(block, dims):
+    """ comment, target and FLOP count of a block """
+    comment, lhs, flops = "", "", 0
+    for line in block["lines"]:
+        text = comment_text(line)
+        is_comment = text is not None
+        text = text if is_comment else line.strip()
+        if text.startswith("flops:"):
+            flops += flop_count(text, dims)
+            continue
+        if text.startswith("mems:"): continue
+        if is_comment and not comment: comment = text
+        if not lhs:
+            match = lhs_regex.match(text)
+            if match: lhs = match.group(1)
+    return {"statement": comment, "target": lhs, "flops": flops}
+
+
+def base_name(name):
+    return re.split(r'[\[(]', name, maxsplit=1)[0]
+
+
+def is_scratch(name):
+    base = base_name(name)
+    return base in scratch_names or base.startswith("work_") or base.startswith("perm_")
+
+
+# ── Tensors ─────────────────────────────────────────────────────────────────────────
+
+def find_tensors(python_code, runtime_code, dims):
+    """
+    Find the inputs and outputs of the equations and their shapes.
+
+    Inputs are the declared names that are not intermediates and are never assigned; outputs are the assigned
+    names that are not intermediates. Shapes follow from the labels of each tensor in the runtime code.
+
+    Returns:
+        (inputs, outputs): dicts from name (e.g. 'eri["vvoo"]', 't1') to shape (empty for scalars).
+    """
+    declared = re.findall(r'initialize -> (.*);', python_code)
+    _, body = code_parts(python_code)
+
+    assigned = []
+    for line in body:
+        if comment_text(line) is not None: continue
+        match = lhs_regex.match(line.strip())
+        if match and not is_scratch(match.group(1)) and match.group(1) not in assigned:
+            assigned.append(match.group(1))
+
+    labels = {}
+    for name, label_str in tensor_regex.findall(runtime_code):
+        labels.setdefault(name, [l.strip() for l in label_str.split(",") if l.strip()])
+
+    def shape(name):
+        return tuple(label_dim(l, dims) for l in labels.get(name, []))
+
+    inputs = {n: shape(n) for n in declared if n not in assigned and not is_scratch(n)}
+    outputs = {n: shape(n) for n in assigned}
+    return inputs, outputs
+
+
+def make_inputs(inputs, seed):
+    """ random tensors for the inputs (identity for Id) """
+    rng = np.random.default_rng(seed)
+    values = {}
+    for name in sorted(inputs):
+        shape = inputs[name]
+        if base_name(name) == "Id":
+            values[name] = np.eye(shape[0], shape[1]) if len(shape) == 2 else np.ones(shape)
+        elif shape:
+            values[name] = rng.uniform(-0.5, 0.5, shape)
+        else:
+            values[name] = float(rng.uniform(-0.5, 0.5))
+    return values
+
+
+# ── Python (einsum) backend ─────────────────────────────────────────────────────────
+
+def run_python(code, values, outputs, repeat):
+    _, body = code_parts(code)
+    body = textwrap.dedent("\n".join(body)).splitlines()
+    blocks = statement_blocks(body)
+
+    source = []
+    for k, block in enumerate(blocks):
+        if block["timed"]: source.append(f"_tic({k})")
+        source += block["lines"]
+        if block["timed"]: source.append(f"_toc({k})")
+    compiled = compile("\n".join(source), "<pq_graph python>", "exec")
+
+    times = [float("inf")] * len(blocks)
+    total = float("inf")
+    result = {}
+    for _ in range(repeat):
+        start, elapsed = {}, defaultdict(float)
+        def _tic(k): start[k] = time.perf_counter()
+        def _toc(k): elapsed[k] += time.perf_counter() - start[k]
+
+        namespace = {"np": np, "einsum": np.einsum, "_tic": _tic, "_toc": _toc,
+                     "tmps_": {}, "scalars_": {}, "reused_": {},
+                     "includes_": defaultdict(lambda: True)}
+        for name, value in values.items():
+            base, block = name_regex.match(name).groups()
+            value = value.copy() if isinstance(value, np.ndarray) else value
+            if block is None: namespace[base] = value
+            else: namespace.setdefault(base, {})[block] = value
+
+        t0 = time.perf_counter()
+        exec(compiled, namespace)
+        total = min(total, time.perf_counter() - t0)
+        for k, t in elapsed.items(): times[k] = min(times[k], t)
+
+        for name in outputs:
+            base, block = name_regex.match(name).groups()
+            value = namespace[base] if block is None else namespace[base][block]
+            result[name] = np.asarray(value, dtype=float)
+
+    return blocks, times, total, result
+
+
+# ── C/C++ backends ──────────────────────────────────────────────────────────────────
+
+def mangle(name):
+    """ C identifier of a name: eri["vvoo"] -> eri_vvoo """
+    base, block = name_regex.match(name).groups()
+    return base if block is None else base + "_" + re.sub(r'\W', '_', block)
+
+
+def size_expr(dims_str):
+    """ C expression for the number of elements of a tensor from its line types ('vvoo' -> nvirt*nvirt*nocc*nocc) """
+    names = {'o': "nocc", 'v': "nvirt", 'L': "nsigma", 'Q': "nden"}
+    return " * ".join(["(size_t) 1"] + [names[c] for c in dims_str])
+
+
+def scratch_size(name):
+    """ size of a C intermediate from the line types in its name (work__0001_vvoo, work__vooo_1, work__0006) """
+    for part in reversed(name.split("_")):
+        if part and all(c in "ovLQ" for c in part):
+            return size_expr(part)
+    return "(size_t) 1"
+
+
+def c_source(backend, code, inputs, outputs, blocks):
+    """ source of a driver that evaluates printed C/C++ code """
+    top, _ = code_parts(code)
+    runtime = backend == "runtime"
+    if not runtime:
+        top = [re.sub(r'\b(\w+)\["([^"]*)"\]', lambda m: mangle(m.group(0)), l) for l in top]
+
+    src = ["// driver generated by backend_harness.py",
+           "#include <chrono>", "#include <cstdio>", "#include <cstdlib>", "#include <cstring>",
+           "#include <map>", "#include <string>", "#include <vector>",
+           "int nocc, nvirt, nalpha, nbeta, nsigma, nden;",
+           "struct { bool operator[](const std::string &) const { return true; } } includes_;",
+           "static double pq_now() { return std::chrono::duration<double>(",
+           "    std::chrono::steady_clock::now().time_since_epoch()).count(); }",
+           f"static double pq_start_[{len(blocks) + 1}], pq_time_[{len(blocks) + 1}];",
+           ""]
+    src += top
+    src.append("")
+
+    # storage of inputs and outputs
+    names = sorted(inputs) + list(outputs)
+    shapes = dict(inputs, **outputs)
+    if runtime:
+        maps = sorted({name_regex.match(n).group(1) for n in names if name_regex.match(n).group(2) is not None})
+        for base in maps: src.append(f"TensorMap {base};")
+        for n in names:
+            if name_regex.match(n).group(2) is None:
+                src.append(("Tensor " if shapes[n] else "double ") + n + ";")
+        src.append("TensorMap tmps_, reused_;")
+        src.append("ScalarMap scalars_;")
+    else:
+        text = "\n".join(top) + "\n" + "\n".join(l for b in blocks for l in b["lines"])
+        declared = set(re.findall(r'\bsize_t\s+(\w+_size)\b', text))
+        for size in sorted(set(size_regex.findall(text))):
+            if size + "_size" not in declared and not size.startswith("work_pool"):
+                src.append(f"size_t {size}_size;")
+    src.append("")
+
+    # the statements, with timers around each block that can be timed
+    src.append("static void pq_evaluate() {")
+    for k, block in enumerate(blocks):
+        if block["timed"]: src.append(block["indent"] + f"pq_start_[{k}] = pq_now();")
+        src += block["lines"]
+        if block["timed"]: src.append(block["indent"] + f"pq_time_[{k}] += pq_now() - pq_start_[{k}];")
+        src.append("")
+    src.append("}")
+    src.append("")
+
+    def elements(n):
+        return f"(size_t) {int(np.prod(shapes[n])) if shapes[n] else 1}"
+
+    src += ["int main(int argc, char **argv) {",
+            "    nocc = atoi(argv[1]); nvirt = atoi(argv[2]); nsigma = atoi(argv[3]); nden = atoi(argv[4]);",
+            "    nalpha = nocc; nbeta = nocc;",
+            "    int repeat = atoi(argv[5]);",
+            "    FILE *in = fopen(argv[6], \"rb\");",
+            "    if (!in) { fprintf(stderr, \"cannot open inputs\\n\"); return 1; }",
+            "    size_t n_read = 0;"]
+    if not runtime:
+        text = "\n".join(l for b in blocks for l in b["lines"]) + "\n" + "\n".join(top)
+        for size in sorted(set(size_regex.findall(text))):
+            if not size.startswith("work_pool") and f"size_t {size}_size;" in src:
+                src.append(f"    {size}_size = {scratch_size(size)};")
+
+    for n in sorted(inputs):
+        var, count = (n if runtime else mangle(n)), elements(n)
+        if runtime and shapes[n]:
+            src.append(f"    {var} = Tensor({{{', '.join(str(d) for d in shapes[n])}}});")
+            src.append(f"    n_read += fread({var}.data(), sizeof(double), {count}, in);")
+        elif runtime:
+            src.append(f"    n_read += fread(&{var}, sizeof(double), 1, in);")
+        else:
+            src.append(f"    {var} = (double*) malloc({count} * sizeof(double));")
+            src.append(f"    n_read += fread({var}, sizeof(double), {count}, in);")
+    src.append("    fclose(in);")
+    if not runtime:
+        for n in outputs:
+            src.append(f"    {mangle(n)} = (double*) calloc({elements(n)}, sizeof(double));")
+
+    src.append("    double total = 1e300;")
+    src.append("    std::vector<double> best(sizeof(pq_time_) / sizeof(double), 1e300);")
+    src.append("    for (int r = 0; r < repeat; ++r) {")
+    for n in outputs:
+        var = n if runtime else mangle(n)
+        if runtime:
+            src.append(f"        {var} = {'Tensor()' if shapes[n] else '0.0'};")
+        else:
+            src.append(f"        memset({var}, 0, {elements(n)} * sizeof(double));")
+    if runtime:
+        src.append("        tmps_.clear(); reused_.clear(); scalars_.clear();")
+    src += ["        memset(pq_time_, 0, sizeof(pq_time_));",
+            "        double t0 = pq_now();",
+            "        pq_evaluate();",
+            "        double t = pq_now() - t0;",
+            "        if (t < total) total = t;",
+            "        for (size_t k = 0; k < best.size(); ++k) if (pq_time_[k] < best[k]) best[k] = pq_time_[k];",
+            "    }",
+            "    for (size_t k = 0; k < best.size(); ++k) printf(\"TIME %zu %.9e\\n\", k, best[k]);",
+            "    printf(\"TOTAL %.9e\\n\", total);",
+            "    FILE *out = fopen(argv[7], \"wb\");"]
+    for n in outputs:
+        var, count = (n if runtime else mangle(n)), elements(n)
+        if runtime and shapes[n]:
+            src.append(f"    if ({var}.size() != {count}) {{ fprintf(stderr, \"wrong size of {var}\\n\"); return 1; }}")
+            src.append(f"    fwrite({var}.data(), sizeof(double), {count}, out);")
+        elif runtime:
+            src.append(f"    fwrite(&{var}, sizeof(double), 1, out);")
+        else:
+            src.append(f"    fwrite({var}, sizeof(double), {count}, out);")
+    src += ["    fclose(out);",
+            "    return n_read == 0 && argc < 0;",
+            "}", ""]
+    return "\n".join(src)
+
+
+def run_c(backend, code, values, inputs, outputs, dims, args, work_dir, test_name):
+    _, body = code_parts(code)
+    if backend != "runtime":
+        body = [re.sub(r'\b(\w+)\["([^"]*)"\]', lambda m: mangle(m.group(0)), l) for l in body]
+    blocks = statement_blocks(body)
+
+    stem = os.path.join(work_dir, f"{test_name}_{backend}")
+    with open(stem + ".cc", "w") as file:
+        file.write(c_source(backend, code, inputs, outputs, blocks))
+
+    cmd = [args.cxx, "-std=c++17"] + args.cxxflags.split() + ["-I", runtime_path]
+    if args.blas: cmd.append("-DPQ_RUNTIME_BLAS")
+    cmd += [stem + ".cc", "-o", stem] + args.blas.split()
+    build = subprocess.run(cmd, capture_output=True, text=True)
+    if build.returncode != 0:
+        raise RuntimeError("compilation failed:\n" + " ".join(cmd) + "\n" + build.stderr[-4000:])
+
+    with open(stem + ".in", "wb") as file:
+        for name in sorted(inputs):
+            np.asarray(values[name], dtype=np.float64).ravel(order='F').tofile(file)
+
+    run = subprocess.run([stem, str(dims['o']), str(dims['v']), str(dims['L']), str(dims['Q']),
+                          str(args.repeat), stem + ".in", stem + ".out"], capture_output=True, text=True)
+    if run.returncode != 0:
+        raise RuntimeError("execution failed:\n" + run.stderr[-4000:])
+
+    times = [0.0] * len(blocks)
+    total = 0.0
+    for line in run.stdout.splitlines():
+        fields = line.split()
+        if fields[0] == "TIME" and int(fields[1]) < len(blocks): times[int(fields[1])] = float(fields[2])
+        if fields[0] == "TOTAL": total = float(fields[1])
+
+    data = np.fromfile(stem + ".out", dtype=np.float64)
+    result, offset = {}, 0
+    for name, shape in outputs.items():
+        count = int(np.prod(shape)) if shape else 1
+        result[name] = data[offset:offset + count].reshape(shape, order='F')
+        offset += count
+    return blocks, times, total, result
+
+
+# ── In-memory evaluation ────────────────────────────────────────────────────────────
+
+def run_evaluate(test_name, variant, values, outputs, blocks, args, work_dir):
+    """ evaluate the graph of a codegen script with graph.evaluate on the same inputs (in a separate process) """
+    if args.code_dir is not None:
+        raise RuntimeError("the evaluate backend needs the graph of the codegen script (do not use --code-dir)")
+
+    stem = os.path.join(work_dir, f"{code_name(test_name, variant)}_evaluate")
+    names = sorted(values)
+    np.savez(stem + "_in.npz", **{f"t{k}": np.asarray(values[n], dtype=np.float64) for k, n in enumerate(names)})
+    with open(stem + "_in.json", "w") as file:
+        json.dump({"inputs": names, "outputs": list(outputs), "repeat": args.repeat}, file)
+
+    log_path = stem + ".log"
+    with open(log_path, "w") as log:
+        status = subprocess.run([sys.executable, os.path.realpath(__file__), "--evaluate", test_name,
+                                 "--variants", variant, "--work-dir", work_dir],
+                                stdout=log, stderr=subprocess.STDOUT).returncode
+    if status != 0:
+        with open(log_path) as log:
+            raise RuntimeError("evaluation failed:\n" + log.read()[-4000:])
+
+    with open(stem + "_out.json") as file:
+        total = json.load(file)["time"]
+    data = np.load(stem + "_out.npz")
+    result = {name: data[f"t{k}"] for k, name in enumerate(outputs)}
+
+    # the statements are not timed separately; keep them for the FLOP count
+    return [dict(block, timed=False) for block in blocks], [0.0] * len(blocks), total, result
+
+
+def evaluate(test_name, variant, work_dir):
+    """ run a codegen script and evaluate its graph on the saved inputs (called in a separate process) """
+    graph = run_codegen(test_name, variants_all[variant])
+    stem = os.path.join(work_dir, f"{code_name(test_name, variant)}_evaluate")
+    with open(stem + "_in.json") as file:
+        config = json.load(file)
+    data = np.load(stem + "_in.npz")
+
+    tensors = {}
+    for k, name in enumerate(config["inputs"]):
+        base, block = name_regex.match(name).groups()
+        value = data[f"t{k}"]
+        if block is None: tensors[base] = value
+        else: tensors.setdefault(base, {})[block] = value
+
+    total = float("inf")
+    for _ in range(config["repeat"]):
+        t0 = time.perf_counter()
+        result = graph.evaluate(tensors)
+        total = min(total, time.perf_counter() - t0)
+
+    arrays = {}
+    for k, name in enumerate(config["outputs"]):
+        base, block = name_regex.match(name).groups()
+        arrays[f"t{k}"] = np.asarray(result[base] if block is None else result[base][block], dtype=np.float64)
+    np.savez(stem + "_out.npz", **arrays)
+    with open(stem + "_out.json", "w") as file:
+        json.dump({"time": total}, file)
+
+
+# ── Report ──────────────────────────────────────────────────────────────────────────
+
+def report(blocks, times, total, result, reference, outputs, dims, tolerance):
+    statements = []
+    equations, intermediates = defaultdict(lambda: {"time": 0.0, "flops": 0}), defaultdict(lambda: {"time": 0.0, "flops": 0})
+    total_flops = 0
+    for k, block in enumerate(blocks):
+        info = describe_block(block, dims)
+        total_flops += info["flops"]
+        if not block["timed"]: continue
+        info["time"] = times[k]
+        info["gflops"] = info["flops"] / times[k] * 1e-9 if times[k] > 0 else 0.0
+        statements.append(info)
+        if not info["target"]: continue
+        base = base_name(info["target"])
+        group = equations[base] if base in {base_name(n) for n in outputs} else intermediates[info["target"]]
+        group["time"] += info["time"]
+        group["flops"] += info["flops"]
+    for group in list(equations.values()) + list(intermediates.values()):
+        group["gflops"] = group["flops"] / group["time"] * 1e-9 if group["time"] > 0 else 0.0
+
+    errors, passed = {}, reference is not None
+    for name in outputs if reference is not None else []:
+        ref = np.asarray(reference[name])
+        diff = float(np.max(np.abs(result[name] - ref))) if ref.size else 0.0
+        scale = max(1.0, float(np.max(np.abs(ref))) if ref.size else 0.0)
+        errors[name] = diff
+        passed = passed and diff / scale < tolerance
+
+    return {"status": "passed" if passed else "failed", "max_error": errors,
+            "time": total, "flops": total_flops, "gflops": total_flops / total * 1e-9 if total > 0 else 0.0,
+            "equations": dict(equations), "intermediates": dict(intermediates), "statements": statements}
+
+
+# ── Driver ──────────────────────────────────────────────────────────────────────────
+
+def code_name(test_name, variant):
+    """ name of the printed codes of a test for a variant """
+    return test_name if variant == "default" else f"{test_name}-{variant}"
+
+
+def run_codegen(test_name, options=None):
+    """ run a codegen script and return the last pq_graph it created (with the options added to its own) """
+    import pdaggerq
+
+    graphs = []
+    make_graph = pdaggerq.pq_graph
+    def capture(*args, **kwargs):
+        if options:
+            args = (dict(args[0] if args else {}, **options),) + args[1:]
+        graph = make_graph(*args, **kwargs)
+        graphs.append(graph)
+        return graph
+    pdaggerq.pq_graph = capture
+
+    sys.path.insert(0, script_path)
+    try:
+        runpy.run_path(os.path.join(script_path, f"{test_name}_codegen.py"), run_name="__main__")
+    finally:
+        pdaggerq.pq_graph = make_graph
+    if not graphs:
+        raise RuntimeError(f"{test_name}_codegen.py did not create a pq_graph")
+    return graphs[-1]
+
+
+def generate(test_name, variant, out_dir):
+    """ run a codegen script and print its graph for every backend (called in a separate process) """
+    graph = run_codegen(test_name, variants_all[variant])
+    for backend in backends_all: # python first: the C printers enable binarization
+        with open(os.path.join(out_dir, f"{code_name(test_name, variant)}.{backend}"), "w") as file:
+            file.write(graph.str(backend))
+
+
+def run_test(test_name, variant, args, work_dir):
+    dims = {'o': args.nocc, 'v': args.nvirt, 'L': args.nsigma, 'Q': args.nden}
+    name = code_name(test_name, variant)
+    code_dir = args.code_dir
+    if code_dir is None:
+        code_dir = work_dir
+        log_path = os.path.join(work_dir, f"{name}_codegen.log")
+        with open(log_path, "w") as log:
+            status = subprocess.run([sys.executable, os.path.realpath(__file__), "--generate", test_name,
+                                     "--variants", variant, "--work-dir", work_dir],
+                                    stdout=log, stderr=subprocess.STDOUT).returncode
+        if status != 0:
+            return {"status": "codegen failed", "log": log_path}
+
+    codes = {}
+    for backend in (set(args.backends) | {"python", "runtime"}) - set(backends_graph):
+        with open(os.path.join(code_dir, f"{name}.{backend}")) as file:
+            codes[backend] = file.read()
+
+    inputs, outputs = find_tensors(codes["python"], codes["runtime"], dims)
+    values = make_inputs(inputs, args.seed)
+
+    results = {"inputs": {n: list(s) for n, s in inputs.items()},
+               "outputs": {n: list(s) for n, s in outputs.items()}, "backends": {}}
+    reference = None
+    for backend in ["python"] + [b for b in args.backends if b != "python"]:
+        print(f"{name}: {backend}", flush=True)
+        try:
+            if backend == "python":
+                run = run_python(codes[backend], values, outputs, args.repeat)
+                reference, python_blocks = run[3], run[0]
+            elif backend == "evaluate":
+                run = run_evaluate(test_name, variant, values, outputs, python_blocks, args, work_dir)
+            else:
+                run = run_c(backend, codes[backend], values, inputs, outputs, dims, args, work_dir, name)
+            results["backends"][backend] = report(*run, reference, outputs, dims, args.tolerance)
+        except Exception as error:
+            results["backends"][backend] = {"status": "error", "message": str(error)}
+    if "python" not in args.backends:
+        del results["backends"]["python"]
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Numerical validation and timing of the pq_graph backends")
+    parser.add_argument("tests", nargs="*", default=["ccsd"], help="codegen scripts to run (e.g. ccsd cisd)")
+    parser.add_argument("--backends", default=",".join(backends_all),
+                        help="backends to evaluate: python, runtime, blas, loop and evaluate (default: all printers)")
+    parser.add_argument("--variants", default="default",
+                        help="option variants of the printed codes: " + ", ".join(variants_all) + " or all (default: default)")
+    parser.add_argument("--nocc", type=int, default=4, help="number of occupied orbitals (default: 4)")
+    parser.add_argument("--nvirt", type=int, default=8, help="number of virtual orbitals (default: 8)")
+    parser.add_argument("--nsigma", type=int, default=2, help="number of trial vectors (default: 2)")
+    parser.add_argument("--nden", type=int, default=10, help="number of density-fitting vectors (default: 10)")
+    parser.add_argument("--repeat", type=int, default=3, help="evaluations per backend; the fastest is reported (default: 3)")
+    parser.add_argument("--seed", type=int, default=0, help="seed of the random tensors (default: 0)")
+    parser.add_argument("--tolerance", type=float, default=1e-8, help="relative error to pass (default: 1e-8)")
+    parser.add_argument("--cxx", default=os.environ.get("CXX", "c++"), help="C++ compiler (default: $CXX or c++)")
+    parser.add_argument("--cxxflags", default="-O2 -fopenmp", help="compiler flags (default: -O2 -fopenmp)")
+    parser.add_argument("--blas", default="-lblas", help="link flags for cblas and dgemm (default: -lblas; empty "
+                                                         "to use the built-in kernels of the runtime)")
+    parser.add_argument("--code-dir", default=None, help="read <test>.<backend> files instead of generating them")
+    parser.add_argument("--work-dir", default=None, help="directory for generated files (default: a temporary one)")
+    parser.add_argument("--json", default=None, help="write the results to this file")
+    parser.add_argument("--generate", default=None, help=argparse.SUPPRESS)
+    parser.add_argument("--evaluate", default=None, help=argparse.SUPPRESS)
+    args = parser.parse_args()
+    args.backends = [b.strip() for b in args.backends.split(",") if b.strip()]
+    args.variants = list(variants_all) if args.variants == "all" else [v.strip() for v in args.variants.split(",") if v.strip()]
+    for variant in args.variants:
+        if variant not in variants_all:
+            parser.error(f"unknown variant {variant} (choose from {', '.join(variants_all)})")
+
+    work_dir = args.work_dir or tempfile.mkdtemp(prefix="pq_backends_")
+    os.makedirs(work_dir, exist_ok=True)
+    if args.generate:
+        generate(args.generate, args.variants[0], work_dir)
+        return 0
+    if args.evaluate:
+        evaluate(args.evaluate, args.variants[0], work_dir)
+        return 0
+
+    results = {"nocc": args.nocc, "nvirt": args.nvirt, "nsigma": args.nsigma, "nden": args.nden,
+               "repeat": args.repeat, "work_dir": work_dir, "tests": {}}
+    failed = False
+    for test_name in args.tests:
+        for variant in args.variants:
+            label = test_name if variant == "default" else f"{test_name}[{variant}]"
+            results["tests"][label] = run_test(test_name, variant, args, work_dir)
+
+    # summary
+    print(f"\n{'test':<20}{'backend':<10}{'status':<16}{'time (s)':>12}{'GFLOP/s':>10}{'max error':>12}")
+    for test_name, test in results["tests"].items():
+        for backend, res in test.get("backends", {"-": test}).items():
+            error = max(res.get("max_error", {"": 0.0}).values(), default=0.0)
+            print(f"{test_name:<20}{backend:<10}{res['status']:<16}{res.get('time', 0.0):>12.4g}"
+                  f"{res.get('gflops', 0.0):>10.3g}{error:>12.3g}")
+            if res["status"] != "passed":
+                failed = True
+                if "message" in res: print(textwrap.indent(res["message"], "    "))
+
+    if args.json:
+        with open(args.json, "w") as file:
+            json.dump(results, file, indent=2)
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -80,7 +80,7 @@ def compare_outputs(test_name, script_path):
         raise AssertionError(f"Test {test_name} failed. Check {script_path}/test_outputs/difference/{test_name}_diff.out for details")
 
 # Tests
-ccsd_tests     = ("ccsd", "ccsd_d1", "ccsd_d2", "ccsd_doubles", "ccsd_energy", "ccsd_singles", "ccsd_t",
+ccsd_tests     = ("ccsd", "ccsd_batched", "ccsd_d1", "ccsd_d2", "ccsd_doubles", "ccsd_energy", "ccsd_singles", "ccsd_t",
                   "eom_ccsd_sigma", "ea_eom_ccsd", "eom_ccsd_d1_by_hand", "eom_ccsd_d1", "eom_ccsd_hamiltonian","eom_ccsd", "ip_eom_ccsd",
                   "lambda_singles", "lambda_doubles", "ccsd_with_spin", "ucc3", "ucc4")
 ci_tests       = ("cid_d1", "cid_d2", "cisd_hamiltonian")
@@ -132,6 +132,53 @@ def test_script_output(test_name):
     # Compare outputs
     compare_outputs(test_name, script_path)
 
+# spin labels of the exported ccsd doubles (None for the terms without spin blocking)
+export_spin_labels = {"unblocked": None, "spin_blocked": {'a': 'a', 'b': 'b', 'i': 'a', 'j': 'b'}}
+
+@pytest.mark.parametrize("blocking", export_spin_labels)
+def test_string_exports(blocking, tmp_path):
+
+    # ccsd doubles residual
+    pq = pdaggerq.pq_helper("fermi")
+    pq.set_left_operators([['e2(i,j,b,a)']])
+    pq.add_st_operator(1.0, ['f'], ['t1', 't2'])
+    pq.add_st_operator(1.0, ['v'], ['t1', 't2'])
+    pq.simplify()
+
+    spin_labels = export_spin_labels[blocking]
+    expected = pq.strings() if spin_labels is None else pq.strings(spin_labels=spin_labels)
+    assert len(expected) > 0
+
+    # iter_strings yields the same terms in the same order
+    assert list(pq.iter_strings()) == expected
+
+    # the iterator is its own iterator, so a partly consumed one continues where it stopped
+    it = pq.iter_strings()
+    assert iter(it) is it
+    first = next(it)
+    assert [first] + [term for term in it] == expected
+    assert next(it, None) is None
+
+    # write_strings writes each term on a line, with tab-separated strings
+    path = tmp_path / f"{blocking}.txt"
+    pq.write_strings(str(path))
+    assert [line.split("\t") for line in path.read_text().splitlines()] == expected
+
+    # string_table stores the signed factor of each term and codes for the strings after it
+    table = pq.string_table()
+    assert len(table) == len(expected)
+    assert len(table.offsets) == len(expected) + 1
+    assert table.offsets[0] == 0 and table.offsets[-1] == len(table.codes)
+    assert len(set(table.labels)) == len(table.labels)
+    assert any(factor < 0 for factor in table.factors)
+    for i, term in enumerate(expected):
+        assert table.factors[i] == pytest.approx(float(term[0]))
+        codes = table.codes[table.offsets[i]:table.offsets[i + 1]]
+        assert [table.labels[code] for code in codes] == term[1:]
+
+    # spin blocking is global: reset it for the other tests
+    pq.clear()
+
 if __name__ == "__main__":
     print("Please use pytest to run the tests")
     print("Syntax: python -m pytest numerical_test.py")